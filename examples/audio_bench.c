@@ -0,0 +1,217 @@
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cdplusg.h>
+#include <cdplusg/audio.h>
+#include <cdplusg/null_audio.h>
+
+// how often the graphics are brought up to the clock, well under the 3.3 ms between packets
+#define UPDATE_INTERVAL_US 1000
+#define DEFAULT_BUFFER_FRAMES 512
+
+static char *progname;
+
+struct audio_bench_options
+{
+  const char *backend_name;
+  struct cdplusg_null_audio_options audio;
+  double tempo;
+  int semitones;
+  double vocal_reduction;
+  const char *graphics_filename;
+  const char *audio_filename;
+};
+
+static void
+usage (void)
+{
+  fprintf (stderr,
+      "usage: %s [-a backend] [-v] [-b frames] [-t tempo] [-k semitones] [-r amount] [-w output.wav] [-g graphics.cdg] filename.mp3\n"
+      "  -v, -b and -w apply to the null backend, which is the default\n",
+      progname);
+}
+
+static int
+parse_options (struct audio_bench_options *options, int argc, char **argv)
+{
+  int option;
+  char *end;
+
+  options->backend_name = "null";
+  options->audio.is_virtual_clock = 0;
+  options->audio.buffer_frames = DEFAULT_BUFFER_FRAMES;
+  options->audio.wav_filename = NULL;
+  options->tempo = 1;
+  options->semitones = 0;
+  options->vocal_reduction = 0;
+  options->graphics_filename = NULL;
+
+  while ((option = getopt (argc, argv, "a:vb:t:k:r:w:g:")) != -1)
+  {
+    switch (option)
+    {
+      case 'a':
+        options->backend_name = optarg;
+        break;
+      case 'v':
+        options->audio.is_virtual_clock = 1;
+        break;
+      case 'b':
+        options->audio.buffer_frames = strtoul (optarg, &end, 10);
+
+        if (*optarg == '\0' || *end != '\0' || options->audio.buffer_frames == 0
+              || options->audio.buffer_frames > 4096)
+          return 0;
+        break;
+      case 't':
+        options->tempo = strtod (optarg, &end);
+
+        if (*optarg == '\0' || *end != '\0' || !(options->tempo >= 0.5 && options->tempo <= 2))
+          return 0;
+        break;
+      case 'k':
+        options->semitones = strtol (optarg, &end, 10);
+
+        if (*optarg == '\0' || *end != '\0' || options->semitones < -6 || options->semitones > 6)
+          return 0;
+        break;
+      case 'r':
+        options->vocal_reduction = strtod (optarg, &end);
+
+        if (*optarg == '\0' || *end != '\0' || !(options->vocal_reduction >= 0 && options->vocal_reduction <= 1))
+          return 0;
+        break;
+      case 'w':
+        options->audio.wav_filename = optarg;
+        break;
+      case 'g':
+        options->graphics_filename = optarg;
+        break;
+      default:
+        return 0;
+    }
+  }
+
+  if (optind + 1 != argc)
+    return 0;
+
+  options->audio_filename = argv[optind];
+
+  return 1;
+}
+
+static double
+audio_bench_get_time (void)
+{
+  struct timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+int
+main (int argc, char **argv)
+{
+  progname = argv[0];
+
+  struct audio_bench_options options;
+
+  if (!parse_options (&options, argc, argv))
+  {
+    usage ();
+    return 1;
+  }
+
+  struct cdplusg_stream *stream = NULL;
+  struct cdplusg_player *player = NULL;
+
+  if (options.graphics_filename)
+  {
+    FILE *file = fopen (options.graphics_filename, "r");
+
+    if (file == NULL)
+    {
+      fprintf (stderr, "%s: error opening file '%s': %s\n", progname, options.graphics_filename, strerror (errno));
+      return 1;
+    }
+
+    stream = cdplusg_stream_new_from_file (file);
+    fclose (file);
+
+    if (stream == NULL)
+    {
+      fprintf (stderr, "%s: error reading file '%s'\n", progname, options.graphics_filename);
+      return 1;
+    }
+  }
+
+  const struct cdplusg_audio_backend *backend = cdplusg_audio_backend_find (options.backend_name);
+  int is_null_backend = backend == &cdplusg_null_audio_backend;
+
+  struct cdplusg_audio audio;
+  double start_time = audio_bench_get_time ();
+
+  if (!cdplusg_audio_open (&audio, options.backend_name, options.audio_filename, options.tempo, options.semitones,
+          is_null_backend ? &options.audio : NULL))
+  {
+    fprintf (stderr, "%s: error playing file '%s'\n", progname, options.audio_filename);
+    cdplusg_stream_free (stream);
+    return 1;
+  }
+
+  // applies from the next chunk decoded, after the audio buffered at open
+  if (options.vocal_reduction > 0)
+    audio.backend->set_vocal_reduction (audio.context, options.vocal_reduction);
+
+  if (stream)
+    player = cdplusg_player_new (stream, cdplusg_audio_clock, &audio);
+
+  // the graphics may outlast the audio, but with nothing left to hear the run is over
+  while (!audio.backend->is_finished (audio.context))
+  {
+    if (player)
+      cdplusg_player_update (player);
+
+    usleep (UPDATE_INTERVAL_US);
+  }
+
+  double elapsed_seconds = audio_bench_get_time () - start_time;
+  double audio_seconds = cdplusg_audio_clock (&audio);
+
+  printf ("audio: %s, %.2f s of audio in %.2f s, %.1fx real time\n", audio.backend->name, audio_seconds,
+      elapsed_seconds, audio_seconds / elapsed_seconds);
+
+  if (is_null_backend)
+  {
+    struct cdplusg_null_audio_statistics statistics;
+    cdplusg_null_audio_context_get_statistics (audio.context, &statistics);
+
+    printf ("decoder: %.2f s waited for it\n", statistics.stall_seconds);
+    printf ("callbacks: %lu of %u frames, %.1f us mean, %.1f us max, woken up to %.1f us late, %lu late\n",
+        statistics.callback_count, options.audio.buffer_frames, statistics.mean_callback_us,
+        statistics.max_callback_us, statistics.max_lateness_us, statistics.late_count);
+    printf ("underruns: %lu, %lu frames of silence\n", statistics.underrun_count, statistics.silent_frame_count);
+  }
+
+  if (player)
+  {
+    struct cdplusg_player_statistics player_statistics;
+    cdplusg_player_get_statistics (player, &player_statistics);
+
+    printf ("graphics: %lu updates, %lu packets, %lu resyncs, drift mean %.2f ms, max %.2f ms\n",
+        player_statistics.update_count, player_statistics.packet_count, player_statistics.resync_count,
+        player_statistics.mean_drift_ms, player_statistics.max_drift_ms);
+  }
+
+  cdplusg_player_free (player);
+  cdplusg_stream_free (stream);
+  cdplusg_audio_close (&audio);
+
+  return 0;
+}
@@ -0,0 +1,402 @@
+#define _DEFAULT_SOURCE
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <alsa/asoundlib.h>
+
+#include <cdplusg/alsa.h>
+
+#include "playback.h"
+
+#ifdef __GLIBC__
+extern char *program_invocation_short_name;
+#define PROGNAME() program_invocation_short_name
+#else
+#define PROGNAME() getprogname ()
+#endif
+
+#define CDPLUSG_ALSA_DEVICE "default"
+
+// what is asked of the device, ALSA picks the period size to match
+#define CDPLUSG_ALSA_LATENCY_US 20000
+
+// how long the device thread waits for room at a time, so that it notices a pause
+#define CDPLUSG_ALSA_WAIT_MS 100
+
+struct cdplusg_alsa_context
+{
+  snd_pcm_t *pcm;
+  struct cdplusg_playback playback;
+
+  unsigned int stream_rate;
+  snd_pcm_uframes_t period_frames;
+  short *buffer;
+
+  // There is no callback in ALSA's plain API, so a thread of our own writes a period at a
+  // time whenever there is room; it sleeps on the condition while paused or once the song
+  // is over.
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t condition;
+  int is_playing;
+  int is_active;
+  int is_shutting_down;
+};
+
+static double
+cdplusg_alsa_get_stream_time (void)
+{
+  struct timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Writes one period once there is room for it and returns how many of its frames came from
+// the decoder, or the period size when there was nothing to do.
+static snd_pcm_uframes_t
+cdplusg_alsa_write_period (struct cdplusg_alsa_context *context)
+{
+  snd_pcm_sframes_t available;
+  snd_pcm_sframes_t delay;
+
+  int error = snd_pcm_wait (context->pcm, CDPLUSG_ALSA_WAIT_MS);
+
+  if (error >= 0)
+    error = snd_pcm_avail_delay (context->pcm, &available, &delay);
+
+  if (error < 0)
+  {
+    // an underrun, or a suspend, from which the device has to be brought back
+    snd_pcm_recover (context->pcm, error, 1);
+    return context->period_frames;
+  }
+
+  if ((snd_pcm_uframes_t) available < context->period_frames)
+    return context->period_frames;
+
+  // the new period starts after everything still queued, delay frames from now
+  double dac_time = cdplusg_alsa_get_stream_time () + (double) delay / context->stream_rate;
+
+  size_t read_count = cdplusg_playback_fill (&context->playback, context->buffer, context->period_frames, dac_time);
+  snd_pcm_sframes_t written = snd_pcm_writei (context->pcm, context->buffer, context->period_frames);
+
+  if (written < 0)
+    snd_pcm_recover (context->pcm, written, 1);
+
+  return read_count;
+}
+
+static void *
+cdplusg_alsa_main (void *user_data)
+{
+  struct cdplusg_alsa_context *context = (struct cdplusg_alsa_context *) user_data;
+  int is_running = 1;
+
+  pthread_mutex_lock (&context->mutex);
+
+  while (!context->is_shutting_down)
+  {
+    if (!context->is_playing || !context->is_active)
+    {
+      // like stopping a PortAudio stream, the queued audio is played out first
+      if (is_running)
+      {
+        is_running = 0;
+
+        pthread_mutex_unlock (&context->mutex);
+        snd_pcm_drain (context->pcm);
+        snd_pcm_prepare (context->pcm);
+        pthread_mutex_lock (&context->mutex);
+      }
+      else
+      {
+        pthread_cond_wait (&context->condition, &context->mutex);
+      }
+
+      continue;
+    }
+
+    is_running = 1;
+    pthread_mutex_unlock (&context->mutex);
+
+    snd_pcm_uframes_t read_count = cdplusg_alsa_write_period (context);
+    int is_finished = read_count < context->period_frames && cdplusg_decoder_is_finished (context->playback.decoder);
+
+    pthread_mutex_lock (&context->mutex);
+
+    if (is_finished)
+      context->is_active = 0;
+  }
+
+  pthread_mutex_unlock (&context->mutex);
+
+  snd_pcm_drop (context->pcm);
+
+  return NULL;
+}
+
+struct cdplusg_alsa_context *
+cdplusg_alsa_context_initialize (const char *audio_filename, double tempo, int semitones)
+{
+  struct cdplusg_alsa_context *context =
+    (struct cdplusg_alsa_context *) calloc (1, sizeof (struct cdplusg_alsa_context));
+
+  if (context == NULL)
+    return NULL;
+
+  if (!cdplusg_playback_initialize (&context->playback, audio_filename, tempo, semitones))
+  {
+    free (context);
+    return NULL;
+  }
+
+  context->stream_rate = context->playback.sample_rate;
+
+  snd_pcm_uframes_t buffer_frames;
+  int error = snd_pcm_open (&context->pcm, CDPLUSG_ALSA_DEVICE, SND_PCM_STREAM_PLAYBACK, 0);
+
+  if (error < 0)
+    goto error_pre_open;
+
+  error = snd_pcm_set_params (context->pcm, SND_PCM_FORMAT_S16, SND_PCM_ACCESS_RW_INTERLEAVED, 2,
+            context->stream_rate, 1, CDPLUSG_ALSA_LATENCY_US);
+
+  if (error >= 0)
+    error = snd_pcm_get_params (context->pcm, &buffer_frames, &context->period_frames);
+
+  if (error < 0)
+    goto error_post_open;
+
+  context->buffer = (short *) malloc (2 * sizeof (short) * context->period_frames);
+
+  if (context->buffer == NULL)
+    goto error_post_open;
+
+  pthread_mutex_init (&context->mutex, NULL);
+  pthread_cond_init (&context->condition, NULL);
+
+  context->is_playing = 1;
+  context->is_active = 1;
+
+  if (pthread_create (&context->thread, NULL, cdplusg_alsa_main, context) == 0)
+    return context;
+
+  pthread_cond_destroy (&context->condition);
+  pthread_mutex_destroy (&context->mutex);
+  free (context->buffer);
+
+error_post_open:
+  snd_pcm_close (context->pcm);
+error_pre_open:
+  fprintf (stderr, "%s: error: error initializing alsa backend: %s\n", PROGNAME (),
+      error < 0 ? snd_strerror (error) : "out of resources");
+  fprintf (stderr, "%s: debug: continuing with no audio\n", PROGNAME ());
+  cdplusg_playback_finalize (&context->playback);
+  free (context);
+  return NULL;
+}
+
+unsigned int
+cdplusg_alsa_context_get_elapsed_time_ms (struct cdplusg_alsa_context *context)
+{
+  return (unsigned int) (cdplusg_alsa_context_get_position (context) * 1000);
+}
+
+double
+cdplusg_alsa_context_get_position (struct cdplusg_alsa_context *context)
+{
+  pthread_mutex_lock (&context->mutex);
+  int is_running_on = context->is_playing && !context->is_active;
+  pthread_mutex_unlock (&context->mutex);
+
+  // as with PortAudio, time goes on once the song is over
+  return cdplusg_playback_get_position (&context->playback, cdplusg_alsa_get_stream_time (), is_running_on);
+}
+
+void
+cdplusg_alsa_context_seek (struct cdplusg_alsa_context *context, unsigned int ms)
+{
+  cdplusg_playback_seek (&context->playback, ms);
+
+  // a device that completed at the end of the song has to be started again
+  pthread_mutex_lock (&context->mutex);
+
+  if (!context->is_active)
+  {
+    context->is_active = 1;
+    pthread_cond_signal (&context->condition);
+  }
+
+  pthread_mutex_unlock (&context->mutex);
+}
+
+void
+cdplusg_alsa_context_set_tempo (struct cdplusg_alsa_context *context, double tempo)
+{
+  double position = cdplusg_alsa_context_get_position (context);
+
+  cdplusg_decoder_set_tempo (context->playback.decoder, tempo);
+  cdplusg_alsa_context_seek (context, (unsigned int) (position * 1000 + 0.5));
+}
+
+void
+cdplusg_alsa_context_set_pitch (struct cdplusg_alsa_context *context, int semitones)
+{
+  double position = cdplusg_alsa_context_get_position (context);
+
+  cdplusg_decoder_set_pitch (context->playback.decoder, semitones);
+  cdplusg_alsa_context_seek (context, (unsigned int) (position * 1000 + 0.5));
+}
+
+void
+cdplusg_alsa_context_set_vocal_reduction (struct cdplusg_alsa_context *context, double amount)
+{
+  cdplusg_decoder_set_vocal_reduction (context->playback.decoder, amount);
+}
+
+void
+cdplusg_alsa_context_restart (struct cdplusg_alsa_context *context)
+{
+  cdplusg_alsa_context_seek (context, 0);
+}
+
+void
+cdplusg_alsa_context_pause (struct cdplusg_alsa_context *context)
+{
+  pthread_mutex_lock (&context->mutex);
+  context->is_playing = 0;
+  pthread_mutex_unlock (&context->mutex);
+}
+
+void
+cdplusg_alsa_context_resume (struct cdplusg_alsa_context *context)
+{
+  pthread_mutex_lock (&context->mutex);
+  context->is_playing = 1;
+  pthread_cond_signal (&context->condition);
+  pthread_mutex_unlock (&context->mutex);
+}
+
+void
+cdplusg_alsa_context_toggle_playback (struct cdplusg_alsa_context *context)
+{
+  pthread_mutex_lock (&context->mutex);
+  context->is_playing = !context->is_playing;
+  pthread_cond_signal (&context->condition);
+  pthread_mutex_unlock (&context->mutex);
+}
+
+int
+cdplusg_alsa_context_is_finished (struct cdplusg_alsa_context *context)
+{
+  pthread_mutex_lock (&context->mutex);
+  int is_finished = !context->is_active;
+  pthread_mutex_unlock (&context->mutex);
+
+  return is_finished;
+}
+
+void
+cdplusg_alsa_context_destroy (struct cdplusg_alsa_context *context)
+{
+  if (context == NULL)
+    return;
+
+  pthread_mutex_lock (&context->mutex);
+  context->is_shutting_down = 1;
+  pthread_cond_signal (&context->condition);
+  pthread_mutex_unlock (&context->mutex);
+
+  pthread_join (context->thread, NULL);
+
+  pthread_cond_destroy (&context->condition);
+  pthread_mutex_destroy (&context->mutex);
+
+  snd_pcm_close (context->pcm);
+  free (context->buffer);
+  cdplusg_playback_finalize (&context->playback);
+  free (context);
+}
+
+static void *
+cdplusg_alsa_backend_open (const char *audio_filename, double tempo, int semitones, const void *options)
+{
+  (void) options;
+
+  return cdplusg_alsa_context_initialize (audio_filename, tempo, semitones);
+}
+
+static void
+cdplusg_alsa_backend_start (void *context)
+{
+  cdplusg_alsa_context_resume ((struct cdplusg_alsa_context *) context);
+}
+
+static void
+cdplusg_alsa_backend_pause (void *context)
+{
+  cdplusg_alsa_context_pause ((struct cdplusg_alsa_context *) context);
+}
+
+static double
+cdplusg_alsa_backend_get_position (void *context)
+{
+  return cdplusg_alsa_context_get_position ((struct cdplusg_alsa_context *) context);
+}
+
+static void
+cdplusg_alsa_backend_seek (void *context, unsigned int ms)
+{
+  cdplusg_alsa_context_seek ((struct cdplusg_alsa_context *) context, ms);
+}
+
+static void
+cdplusg_alsa_backend_set_tempo (void *context, double tempo)
+{
+  cdplusg_alsa_context_set_tempo ((struct cdplusg_alsa_context *) context, tempo);
+}
+
+static void
+cdplusg_alsa_backend_set_pitch (void *context, int semitones)
+{
+  cdplusg_alsa_context_set_pitch ((struct cdplusg_alsa_context *) context, semitones);
+}
+
+static void
+cdplusg_alsa_backend_set_vocal_reduction (void *context, double amount)
+{
+  cdplusg_alsa_context_set_vocal_reduction ((struct cdplusg_alsa_context *) context, amount);
+}
+
+static int
+cdplusg_alsa_backend_is_finished (void *context)
+{
+  return cdplusg_alsa_context_is_finished ((struct cdplusg_alsa_context *) context);
+}
+
+static void
+cdplusg_alsa_backend_destroy (void *context)
+{
+  cdplusg_alsa_context_destroy ((struct cdplusg_alsa_context *) context);
+}
+
+const struct cdplusg_audio_backend cdplusg_alsa_backend =
+{
+  "alsa",
+  cdplusg_alsa_backend_open,
+  cdplusg_alsa_backend_start,
+  cdplusg_alsa_backend_pause,
+  cdplusg_alsa_backend_get_position,
+  cdplusg_alsa_backend_seek,
+  cdplusg_alsa_backend_set_tempo,
+  cdplusg_alsa_backend_set_pitch,
+  cdplusg_alsa_backend_set_vocal_reduction,
+  cdplusg_alsa_backend_is_finished,
+  cdplusg_alsa_backend_destroy
+};
@@ -0,0 +1,102 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <cdplusg/audio.h>
+#include <cdplusg/null_audio.h>
+
+#ifdef CDPLUSG_HAVE_ALSA
+#include <cdplusg/alsa.h>
+#endif
+
+#ifdef CDPLUSG_HAVE_PORTAUDIO
+#include <cdplusg/portaudio.h>
+#endif
+
+#ifdef __GLIBC__
+extern char *program_invocation_short_name;
+#define PROGNAME() program_invocation_short_name
+#else
+#define PROGNAME() getprogname ()
+#endif
+
+const struct cdplusg_audio_backend *const cdplusg_audio_backends [] =
+{
+#ifdef CDPLUSG_HAVE_ALSA
+  &cdplusg_alsa_backend,
+#endif
+#ifdef CDPLUSG_HAVE_PORTAUDIO
+  &cdplusg_portaudio_backend,
+#endif
+  &cdplusg_null_audio_backend,
+  NULL
+};
+
+const struct cdplusg_audio_backend *
+cdplusg_audio_backend_find (const char *name)
+{
+  for (size_t i = 0; cdplusg_audio_backends[i] != NULL; i++)
+  {
+    if (strcmp (cdplusg_audio_backends[i]->name, name) == 0)
+      return cdplusg_audio_backends[i];
+  }
+
+  return NULL;
+}
+
+int
+cdplusg_audio_open (struct cdplusg_audio *audio, const char *name, const char *audio_filename, double tempo,
+    int semitones, const void *options)
+{
+  audio->backend = NULL;
+  audio->context = NULL;
+
+  if (name)
+  {
+    const struct cdplusg_audio_backend *backend = cdplusg_audio_backend_find (name);
+
+    if (backend == NULL)
+    {
+      fprintf (stderr, "%s: error: no audio backend named '%s'\n", PROGNAME (), name);
+      return 0;
+    }
+
+    audio->context = backend->open (audio_filename, tempo, semitones, options);
+    audio->backend = audio->context ? backend : NULL;
+
+    return audio->context != NULL;
+  }
+
+  // playing silence in place of a missing sound card is only ever done on request
+  for (size_t i = 0; cdplusg_audio_backends[i] != &cdplusg_null_audio_backend; i++)
+  {
+    audio->context = cdplusg_audio_backends[i]->open (audio_filename, tempo, semitones, NULL);
+
+    if (audio->context)
+    {
+      fprintf (stderr, "%s: debug: playing through %s\n", PROGNAME (), cdplusg_audio_backends[i]->name);
+      audio->backend = cdplusg_audio_backends[i];
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+void
+cdplusg_audio_close (struct cdplusg_audio *audio)
+{
+  if (audio->backend)
+    audio->backend->destroy (audio->context);
+
+  audio->backend = NULL;
+  audio->context = NULL;
+}
+
+double
+cdplusg_audio_clock (void *user_data)
+{
+  const struct cdplusg_audio *audio = (const struct cdplusg_audio *) user_data;
+
+  return audio->backend->get_position (audio->context);
+}
@@ -0,0 +1,644 @@
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MINIMP3_IMPLEMENTATION
+#include <minimp3_ex.h>
+
+#include <cdplusg/loudness.h>
+
+#include "decoder.h"
+#include "mp3_cache.h"
+#include "resampler.h"
+#include "ring_buffer.h"
+#include "time_stretch.h"
+#include "vocal_filter.h"
+
+#ifdef __GLIBC__
+extern char *program_invocation_short_name;
+#define PROGNAME() program_invocation_short_name
+#else
+#define PROGNAME() getprogname ()
+#endif
+
+// about three quarters of a second at 44.1 kHz, 128 KiB of PCM; a power of two for the ring
+#define CDPLUSG_DECODER_RING_FRAMES 32768
+
+// frames decoded per step, a few mp3 frames, small enough to keep seeking responsive
+#define CDPLUSG_DECODER_CHUNK_FRAMES 4096
+
+// frames buffered before playback is allowed to start
+#define CDPLUSG_DECODER_PREBUFFER_FRAMES 8192
+
+// how long the decoder thread sleeps while the ring is full, well under the ring's length
+#define CDPLUSG_DECODER_IDLE_NS 5000000
+
+// Frame positions are kept in 32 bits so that a position can be packed with a counter or a
+// ring index into a single atomic; that is over a day of audio at 48 kHz.
+#define CDPLUSG_DECODER_PACK(high, low) (((uint64_t) (high) << 32) | (uint32_t) (low))
+#define CDPLUSG_DECODER_HIGH(packed) ((uint32_t) ((packed) >> 32))
+#define CDPLUSG_DECODER_LOW(packed) ((uint32_t) (packed))
+
+struct cdplusg_decoder
+{
+  mp3dec_ex_t mp3;
+  int channels;
+  int sample_rate;
+
+  // decoded audio from the cache, played instead of decoding when present
+  const short *pcm;
+  uint64_t pcm_frame_count;
+  uint64_t pcm_position;
+  size_t pcm_mapping_size;
+
+  // fills the cache during a first uninterrupted play, if asked to
+  struct cdplusg_mp3_cache_key cache_key;
+  struct cdplusg_mp3_cache_writer *cache_writer;
+
+  // brings the song to a common loudness, once the cache has an analysis of it
+  double gain;
+
+  // Changes the tempo and the key of what goes into the ring: the audio is stretched to the
+  // tempo divided by the pitch ratio and then resampled by that ratio, each skipped when it
+  // would do nothing. Only touched by the decoder thread, which takes the tempo and the key
+  // asked for at every seek.
+  struct cdplusg_time_stretch *stretch;
+  struct cdplusg_resampler *resampler;
+  double stretch_tempo;
+  double pitch_ratio;
+  int is_input_finished;
+  int is_stretch_finished;
+  _Atomic double tempo;
+  _Atomic int semitones;
+
+  // Takes the vocals out of what goes into the ring, by as much as asked for at the time of
+  // each chunk; only touched by the decoder thread.
+  struct cdplusg_vocal_filter *vocal_filter;
+  _Atomic float vocal_reduction;
+
+  pthread_t thread;
+  struct cdplusg_ring_buffer *ring;
+
+  // A seek goes through three hands without anyone waiting on a lock: the caller packs a
+  // request counter with the target frame, the decoder thread seeks and publishes the ring
+  // index the new audio starts at together with that frame, and the reader skips to that
+  // index and acknowledges the counter. Anything still in the ring before it is stale.
+  _Atomic uint64_t seek_request;      // request counter, target frame
+  _Atomic uint32_t seek_completed;    // request counter handled by the decoder thread
+  _Atomic uint64_t seek_flush;        // ring index, frame at that index
+  _Atomic double seek_tempo;          // tempo of what follows that index
+  _Atomic uint32_t seek_acknowledged; // request counter handled by the reader
+
+  // published by the reader after every read
+  _Atomic uint32_t position;
+
+  _Atomic int end_of_file;
+  _Atomic int is_shutting_down;
+
+  // only touched by the reader
+  uint32_t flush_index;
+  uint32_t flush_position;
+  double flush_tempo;
+  uint32_t acknowledged;
+  uint64_t read_start_frame;
+  uint64_t read_end_frame;
+};
+
+static void
+cdplusg_decoder_sleep (long nanoseconds)
+{
+  struct timespec duration = { 0, nanoseconds };
+  nanosleep (&duration, NULL);
+}
+
+static size_t
+cdplusg_decoder_decode_chunk (struct cdplusg_decoder *decoder, short *chunk)
+{
+  if (decoder->pcm)
+  {
+    uint64_t remaining = decoder->pcm_frame_count - decoder->pcm_position;
+    size_t frame_count = remaining < CDPLUSG_DECODER_CHUNK_FRAMES ? remaining : CDPLUSG_DECODER_CHUNK_FRAMES;
+
+    memcpy (chunk, &decoder->pcm[2 * decoder->pcm_position], 2 * sizeof (short) * frame_count);
+    decoder->pcm_position += frame_count;
+
+    return frame_count;
+  }
+
+  size_t sample_count = mp3dec_ex_read (&decoder->mp3, chunk, CDPLUSG_DECODER_CHUNK_FRAMES * decoder->channels);
+  size_t frame_count = sample_count / decoder->channels;
+
+  if (sample_count < (size_t) CDPLUSG_DECODER_CHUNK_FRAMES * decoder->channels && decoder->mp3.last_error)
+  {
+    fprintf (stderr, "%s: debug: error %d decoding audio, stopping early\n", PROGNAME (),
+        decoder->mp3.last_error);
+  }
+
+  // duplicate mono to both channels, back to front so it can be done in place
+  if (decoder->channels == 1)
+  {
+    for (size_t i = frame_count; i > 0; i--)
+    {
+      chunk[2 * (i - 1) + 1] = chunk[i - 1];
+      chunk[2 * (i - 1) + 0] = chunk[i - 1];
+    }
+  }
+
+  if (decoder->cache_writer && !cdplusg_mp3_cache_writer_write (decoder->cache_writer, chunk, frame_count))
+  {
+    cdplusg_mp3_cache_writer_free (decoder->cache_writer, 0);
+    decoder->cache_writer = NULL;
+  }
+
+  if (frame_count < CDPLUSG_DECODER_CHUNK_FRAMES)
+  {
+    // a file cut short by a decoding error is not worth keeping
+    cdplusg_mp3_cache_writer_free (decoder->cache_writer, !decoder->mp3.last_error);
+    decoder->cache_writer = NULL;
+  }
+
+  return frame_count;
+}
+
+// Fills a chunk stretched to the tempo of the stretcher, decoding as much as that takes;
+// fewer frames than a chunk means the end of the file.
+static size_t
+cdplusg_decoder_stretch_chunk (struct cdplusg_decoder *decoder, short *chunk)
+{
+  if (decoder->stretch_tempo == 1)
+    return cdplusg_decoder_decode_chunk (decoder, chunk);
+
+  short input [2 * CDPLUSG_DECODER_CHUNK_FRAMES];
+  size_t frame_count = 0;
+
+  while (1)
+  {
+    frame_count += cdplusg_time_stretch_read (decoder->stretch, &chunk[2 * frame_count],
+                     CDPLUSG_DECODER_CHUNK_FRAMES - frame_count);
+
+    if (frame_count == CDPLUSG_DECODER_CHUNK_FRAMES || decoder->is_input_finished)
+      return frame_count;
+
+    size_t input_count = cdplusg_decoder_decode_chunk (decoder, input);
+
+    if (!cdplusg_time_stretch_write (decoder->stretch, input, input_count))
+    {
+      fprintf (stderr, "%s: debug: out of memory changing the tempo, stopping early\n", PROGNAME ());
+      input_count = 0;
+    }
+
+    if (input_count < CDPLUSG_DECODER_CHUNK_FRAMES)
+    {
+      cdplusg_time_stretch_finish (decoder->stretch);
+      decoder->is_input_finished = 1;
+    }
+  }
+}
+
+// Fills a chunk at the tempo and in the key asked for, stretching as much as that takes.
+static size_t
+cdplusg_decoder_shift_chunk (struct cdplusg_decoder *decoder, short *chunk)
+{
+  if (decoder->pitch_ratio == 1)
+    return cdplusg_decoder_stretch_chunk (decoder, chunk);
+
+  short input [2 * CDPLUSG_DECODER_CHUNK_FRAMES];
+  size_t frame_count = 0;
+
+  while (1)
+  {
+    frame_count += cdplusg_resampler_read (decoder->resampler, &chunk[2 * frame_count],
+                     CDPLUSG_DECODER_CHUNK_FRAMES - frame_count);
+
+    if (frame_count == CDPLUSG_DECODER_CHUNK_FRAMES || decoder->is_stretch_finished)
+      return frame_count;
+
+    size_t input_count = cdplusg_decoder_stretch_chunk (decoder, input);
+
+    if (!cdplusg_resampler_write (decoder->resampler, input, input_count))
+    {
+      fprintf (stderr, "%s: debug: out of memory changing the key, stopping early\n", PROGNAME ());
+      input_count = 0;
+    }
+
+    if (input_count < CDPLUSG_DECODER_CHUNK_FRAMES)
+    {
+      cdplusg_resampler_finish (decoder->resampler);
+      decoder->is_stretch_finished = 1;
+    }
+  }
+}
+
+// Starts the stretcher and the resampler over at the tempo and in the key last asked for,
+// returning the tempo.
+static double
+cdplusg_decoder_reset_pipeline (struct cdplusg_decoder *decoder)
+{
+  double tempo = atomic_load_explicit (&decoder->tempo, memory_order_relaxed);
+  int semitones = atomic_load_explicit (&decoder->semitones, memory_order_relaxed);
+
+  decoder->pitch_ratio = semitones == 0 ? 1 : pow (2, semitones / 12.0);
+  decoder->stretch_tempo = tempo / decoder->pitch_ratio;
+  decoder->is_input_finished = 0;
+  decoder->is_stretch_finished = 0;
+
+  cdplusg_time_stretch_reset (decoder->stretch, decoder->stretch_tempo);
+  cdplusg_resampler_reset (decoder->resampler, decoder->pitch_ratio);
+  cdplusg_vocal_filter_reset (decoder->vocal_filter);
+
+  return tempo;
+}
+
+static void *
+cdplusg_decoder_main (void *user_data)
+{
+  struct cdplusg_decoder *decoder = (struct cdplusg_decoder *) user_data;
+  short chunk [2 * CDPLUSG_DECODER_CHUNK_FRAMES];
+  uint32_t completed = 0;
+
+  while (!atomic_load_explicit (&decoder->is_shutting_down, memory_order_acquire))
+  {
+    uint64_t request = atomic_load_explicit (&decoder->seek_request, memory_order_acquire);
+
+    if (CDPLUSG_DECODER_HIGH (request) != completed)
+    {
+      uint32_t frame = CDPLUSG_DECODER_LOW (request);
+      uint32_t flush_index = cdplusg_ring_buffer_get_write_index (decoder->ring);
+
+      if (decoder->pcm)
+        decoder->pcm_position = frame < decoder->pcm_frame_count ? frame : decoder->pcm_frame_count;
+      else
+        mp3dec_ex_seek (&decoder->mp3, (uint64_t) frame * decoder->channels);
+
+      // only a play straight through is known to produce the whole file
+      cdplusg_mp3_cache_writer_free (decoder->cache_writer, 0);
+      decoder->cache_writer = NULL;
+
+      double tempo = cdplusg_decoder_reset_pipeline (decoder);
+
+      completed = CDPLUSG_DECODER_HIGH (request);
+      atomic_store_explicit (&decoder->end_of_file, 0, memory_order_relaxed);
+      atomic_store_explicit (&decoder->seek_tempo, tempo, memory_order_relaxed);
+      atomic_store_explicit (&decoder->seek_flush, CDPLUSG_DECODER_PACK (flush_index, frame), memory_order_release);
+      atomic_store_explicit (&decoder->seek_completed, completed, memory_order_release);
+    }
+
+    if (atomic_load_explicit (&decoder->end_of_file, memory_order_relaxed)
+          || cdplusg_ring_buffer_get_free (decoder->ring) < CDPLUSG_DECODER_CHUNK_FRAMES)
+    {
+      cdplusg_decoder_sleep (CDPLUSG_DECODER_IDLE_NS);
+      continue;
+    }
+
+    // always fits, only this thread ever fills the ring
+    size_t frame_count = cdplusg_decoder_shift_chunk (decoder, chunk);
+
+    cdplusg_loudness_apply_gain (chunk, frame_count, decoder->gain);
+    cdplusg_vocal_filter_process (decoder->vocal_filter, chunk, frame_count,
+        atomic_load_explicit (&decoder->vocal_reduction, memory_order_relaxed));
+    cdplusg_ring_buffer_write (decoder->ring, chunk, frame_count);
+
+    if (frame_count < CDPLUSG_DECODER_CHUNK_FRAMES)
+      atomic_store_explicit (&decoder->end_of_file, 1, memory_order_release);
+  }
+
+  return NULL;
+}
+
+// Sets the decoder up from the cache: either cached PCM to play as is, or a frame index for
+// seeking, which on a miss is built right away, as a full scan at open would have, and stored.
+// A loudness analysis found there sets the gain.
+static void
+cdplusg_decoder_open_cache (struct cdplusg_decoder *decoder, const char *filename)
+{
+  mp3dec_ex_t *mp3 = &decoder->mp3;
+
+  if (!cdplusg_mp3_cache_get_key (&decoder->cache_key, filename, mp3->file.buffer, mp3->file.size))
+  {
+    // no cache to speak of, but seeking still needs the index
+    cdplusg_mp3_cache_prepare_index (NULL, mp3);
+    return;
+  }
+
+  struct cdplusg_loudness loudness;
+
+  if (cdplusg_mp3_cache_load_loudness (&decoder->cache_key, &loudness))
+    decoder->gain = cdplusg_loudness_get_gain (&loudness);
+
+  if (cdplusg_mp3_cache_is_pcm_enabled ())
+  {
+    int sample_rate;
+
+    decoder->pcm = cdplusg_mp3_cache_map_pcm (&decoder->cache_key, &sample_rate, &decoder->pcm_frame_count,
+                     &decoder->pcm_mapping_size);
+
+    if (decoder->pcm && sample_rate == decoder->sample_rate)
+      return;
+
+    cdplusg_mp3_cache_unmap_pcm (decoder->pcm, decoder->pcm_mapping_size);
+    decoder->pcm = NULL;
+    decoder->cache_writer = cdplusg_mp3_cache_writer_new (&decoder->cache_key, decoder->sample_rate);
+  }
+
+  cdplusg_mp3_cache_prepare_index (&decoder->cache_key, mp3);
+}
+
+struct cdplusg_decoder *
+cdplusg_decoder_new (const char *filename, double tempo, int semitones)
+{
+  struct cdplusg_decoder *decoder = (struct cdplusg_decoder *) calloc (1, sizeof (struct cdplusg_decoder));
+
+  if (decoder == NULL)
+    return NULL;
+
+  // the frame index is taken from the cache or built below, not scanned here
+  int error = mp3dec_ex_open (&decoder->mp3, filename, MP3D_SEEK_TO_SAMPLE | MP3D_DO_NOT_SCAN);
+
+  if (error == MP3D_E_IOERROR)
+  {
+    fprintf (stderr, "%s: debug: could not open file '%s': %s\n", PROGNAME (), filename, strerror (errno));
+    free (decoder);
+    return NULL;
+  }
+  else if (error || decoder->mp3.info.channels < 1 || decoder->mp3.info.channels > 2)
+  {
+    fprintf (stderr, "%s: debug: something went wrong decoding the audio file '%s'\n", PROGNAME (), filename);
+
+    if (!error)
+      mp3dec_ex_close (&decoder->mp3);
+
+    free (decoder);
+    return NULL;
+  }
+
+  decoder->channels = decoder->mp3.info.channels;
+  decoder->sample_rate = decoder->mp3.info.hz;
+  decoder->gain = 1;
+
+  cdplusg_decoder_open_cache (decoder, filename);
+
+  if (tempo < CDPLUSG_DECODER_MIN_TEMPO)
+    tempo = CDPLUSG_DECODER_MIN_TEMPO;
+  else if (tempo > CDPLUSG_DECODER_MAX_TEMPO)
+    tempo = CDPLUSG_DECODER_MAX_TEMPO;
+
+  if (semitones < -CDPLUSG_DECODER_MAX_SEMITONES)
+    semitones = -CDPLUSG_DECODER_MAX_SEMITONES;
+  else if (semitones > CDPLUSG_DECODER_MAX_SEMITONES)
+    semitones = CDPLUSG_DECODER_MAX_SEMITONES;
+
+  decoder->stretch = cdplusg_time_stretch_new (decoder->sample_rate);
+  decoder->resampler = cdplusg_resampler_new ();
+  decoder->vocal_filter = cdplusg_vocal_filter_new (decoder->sample_rate);
+  decoder->ring = cdplusg_ring_buffer_new (CDPLUSG_DECODER_RING_FRAMES);
+
+  if (decoder->stretch == NULL || decoder->resampler == NULL || decoder->vocal_filter == NULL
+        || decoder->ring == NULL)
+    goto error_post_open;
+
+  atomic_init (&decoder->seek_request, 0);
+  atomic_init (&decoder->seek_completed, 0);
+  atomic_init (&decoder->seek_flush, 0);
+  atomic_init (&decoder->seek_tempo, tempo);
+  atomic_init (&decoder->seek_acknowledged, 0);
+  atomic_init (&decoder->tempo, tempo);
+  atomic_init (&decoder->semitones, semitones);
+  atomic_init (&decoder->vocal_reduction, 0);
+  atomic_init (&decoder->position, 0);
+  atomic_init (&decoder->end_of_file, 0);
+  atomic_init (&decoder->is_shutting_down, 0);
+
+  decoder->flush_tempo = cdplusg_decoder_reset_pipeline (decoder);
+
+  if (pthread_create (&decoder->thread, NULL, cdplusg_decoder_main, decoder) != 0)
+  {
+    fprintf (stderr, "%s: debug: could not start decoding the audio file '%s'\n", PROGNAME (), filename);
+    goto error_post_open;
+  }
+
+  // hold back until there is enough to play without an immediate underrun
+  while (!atomic_load_explicit (&decoder->end_of_file, memory_order_acquire)
+           && cdplusg_ring_buffer_get_available (decoder->ring) < CDPLUSG_DECODER_PREBUFFER_FRAMES)
+    cdplusg_decoder_sleep (CDPLUSG_DECODER_IDLE_NS / 5);
+
+  return decoder;
+
+error_post_open:
+  cdplusg_time_stretch_free (decoder->stretch);
+  cdplusg_resampler_free (decoder->resampler);
+  cdplusg_vocal_filter_free (decoder->vocal_filter);
+  cdplusg_ring_buffer_free (decoder->ring);
+  cdplusg_mp3_cache_writer_free (decoder->cache_writer, 0);
+  cdplusg_mp3_cache_unmap_pcm (decoder->pcm, decoder->pcm_mapping_size);
+  mp3dec_ex_close (&decoder->mp3);
+  free (decoder);
+  return NULL;
+}
+
+void
+cdplusg_decoder_free (struct cdplusg_decoder *decoder)
+{
+  if (decoder == NULL)
+    return;
+
+  atomic_store_explicit (&decoder->is_shutting_down, 1, memory_order_release);
+  pthread_join (decoder->thread, NULL);
+
+  cdplusg_mp3_cache_writer_free (decoder->cache_writer, 0);
+  cdplusg_mp3_cache_unmap_pcm (decoder->pcm, decoder->pcm_mapping_size);
+  mp3dec_ex_close (&decoder->mp3);
+  cdplusg_ring_buffer_free (decoder->ring);
+  cdplusg_time_stretch_free (decoder->stretch);
+  cdplusg_resampler_free (decoder->resampler);
+  cdplusg_vocal_filter_free (decoder->vocal_filter);
+  free (decoder);
+}
+
+int
+cdplusg_decoder_get_sample_rate (const struct cdplusg_decoder *decoder)
+{
+  return decoder->sample_rate;
+}
+
+// Returns 1 once the reader is past the last seek request, 0 while that seek is still
+// being carried out, which the reader sits out with silence rather than waiting.
+static int
+cdplusg_decoder_acknowledge_seek (struct cdplusg_decoder *decoder)
+{
+  uint64_t request = atomic_load_explicit (&decoder->seek_request, memory_order_acquire);
+  uint32_t counter = CDPLUSG_DECODER_HIGH (request);
+
+  if (counter == decoder->acknowledged)
+    return 1;
+
+  if (atomic_load_explicit (&decoder->seek_completed, memory_order_acquire) != counter)
+    return 0;
+
+  uint64_t flush = atomic_load_explicit (&decoder->seek_flush, memory_order_acquire);
+  double tempo = atomic_load_explicit (&decoder->seek_tempo, memory_order_relaxed);
+
+  // a newer request may have been carried out in between, and its flush read instead
+  if (atomic_load_explicit (&decoder->seek_request, memory_order_acquire) != request)
+    return 0;
+
+  decoder->flush_index = CDPLUSG_DECODER_HIGH (flush);
+  decoder->flush_position = CDPLUSG_DECODER_LOW (flush);
+  decoder->flush_tempo = tempo;
+  decoder->acknowledged = counter;
+
+  cdplusg_ring_buffer_skip_to (decoder->ring, decoder->flush_index);
+  atomic_store_explicit (&decoder->position, decoder->flush_position, memory_order_relaxed);
+  atomic_store_explicit (&decoder->seek_acknowledged, counter, memory_order_release);
+
+  return 1;
+}
+
+// Frame of the file behind the frame at the ring index, which is a frame of the file for
+// every frame of the ring at the original tempo.
+static uint64_t
+cdplusg_decoder_get_frame_at (struct cdplusg_decoder *decoder, uint32_t index)
+{
+  uint32_t frame_count = index - decoder->flush_index;
+
+  if (decoder->flush_tempo == 1)
+    return decoder->flush_position + frame_count;
+
+  return decoder->flush_position + (uint64_t) (frame_count * decoder->flush_tempo + 0.5);
+}
+
+size_t
+cdplusg_decoder_read (struct cdplusg_decoder *decoder, short *samples, size_t frame_count)
+{
+  if (!cdplusg_decoder_acknowledge_seek (decoder))
+  {
+    decoder->read_start_frame = cdplusg_decoder_get_position (decoder);
+    decoder->read_end_frame = decoder->read_start_frame;
+    return 0;
+  }
+
+  decoder->read_start_frame = cdplusg_decoder_get_frame_at (decoder,
+                                cdplusg_ring_buffer_get_read_index (decoder->ring));
+
+  frame_count = cdplusg_ring_buffer_read (decoder->ring, samples, frame_count);
+
+  decoder->read_end_frame = cdplusg_decoder_get_frame_at (decoder,
+                              cdplusg_ring_buffer_get_read_index (decoder->ring));
+  atomic_store_explicit (&decoder->position, decoder->read_end_frame, memory_order_release);
+
+  return frame_count;
+}
+
+void
+cdplusg_decoder_get_read_frames (struct cdplusg_decoder *decoder, uint64_t *start_frame, uint64_t *end_frame,
+    double *tempo)
+{
+  *start_frame = decoder->read_start_frame;
+  *end_frame = decoder->read_end_frame;
+  *tempo = decoder->flush_tempo;
+}
+
+int
+cdplusg_decoder_is_ready (struct cdplusg_decoder *decoder, size_t frame_count)
+{
+  if (!cdplusg_decoder_acknowledge_seek (decoder))
+    return 0;
+
+  // as below, frames written before the end was flagged are visible once it is seen
+  return atomic_load_explicit (&decoder->end_of_file, memory_order_acquire)
+    || cdplusg_ring_buffer_get_available (decoder->ring) >= frame_count;
+}
+
+int
+cdplusg_decoder_is_finished (struct cdplusg_decoder *decoder)
+{
+  uint64_t request = atomic_load_explicit (&decoder->seek_request, memory_order_acquire);
+
+  if (atomic_load_explicit (&decoder->seek_acknowledged, memory_order_acquire) != CDPLUSG_DECODER_HIGH (request))
+    return 0;
+
+  // the end is flagged after the last frames are written, so if it is seen they are too
+  return atomic_load_explicit (&decoder->end_of_file, memory_order_acquire)
+    && cdplusg_ring_buffer_get_available (decoder->ring) == 0;
+}
+
+uint64_t
+cdplusg_decoder_get_position (struct cdplusg_decoder *decoder)
+{
+  uint64_t request = atomic_load_explicit (&decoder->seek_request, memory_order_acquire);
+
+  // until the reader has caught up with a seek, the position is where it is headed
+  if (atomic_load_explicit (&decoder->seek_acknowledged, memory_order_acquire) != CDPLUSG_DECODER_HIGH (request))
+    return CDPLUSG_DECODER_LOW (request);
+
+  return atomic_load_explicit (&decoder->position, memory_order_acquire);
+}
+
+void
+cdplusg_decoder_seek (struct cdplusg_decoder *decoder, uint64_t frame)
+{
+  if (frame > UINT32_MAX)
+    frame = UINT32_MAX;
+
+  uint64_t request = atomic_load_explicit (&decoder->seek_request, memory_order_relaxed);
+  uint64_t next_request = CDPLUSG_DECODER_PACK (CDPLUSG_DECODER_HIGH (request) + 1, frame);
+
+  atomic_store_explicit (&decoder->seek_request, next_request, memory_order_release);
+}
+
+void
+cdplusg_decoder_set_tempo (struct cdplusg_decoder *decoder, double tempo)
+{
+  if (tempo < CDPLUSG_DECODER_MIN_TEMPO)
+    tempo = CDPLUSG_DECODER_MIN_TEMPO;
+  else if (tempo > CDPLUSG_DECODER_MAX_TEMPO)
+    tempo = CDPLUSG_DECODER_MAX_TEMPO;
+
+  atomic_store_explicit (&decoder->tempo, tempo, memory_order_relaxed);
+}
+
+double
+cdplusg_decoder_get_tempo (struct cdplusg_decoder *decoder)
+{
+  return atomic_load_explicit (&decoder->tempo, memory_order_relaxed);
+}
+
+void
+cdplusg_decoder_set_pitch (struct cdplusg_decoder *decoder, int semitones)
+{
+  if (semitones < -CDPLUSG_DECODER_MAX_SEMITONES)
+    semitones = -CDPLUSG_DECODER_MAX_SEMITONES;
+  else if (semitones > CDPLUSG_DECODER_MAX_SEMITONES)
+    semitones = CDPLUSG_DECODER_MAX_SEMITONES;
+
+  atomic_store_explicit (&decoder->semitones, semitones, memory_order_relaxed);
+}
+
+int
+cdplusg_decoder_get_pitch (struct cdplusg_decoder *decoder)
+{
+  return atomic_load_explicit (&decoder->semitones, memory_order_relaxed);
+}
+
+void
+cdplusg_decoder_set_vocal_reduction (struct cdplusg_decoder *decoder, double amount)
+{
+  if (amount < 0)
+    amount = 0;
+  else if (amount > 1)
+    amount = 1;
+
+  atomic_store_explicit (&decoder->vocal_reduction, (float) amount, memory_order_relaxed);
+}
+
+double
+cdplusg_decoder_get_vocal_reduction (struct cdplusg_decoder *decoder)
+{
+  return atomic_load_explicit (&decoder->vocal_reduction, memory_order_relaxed);
+}
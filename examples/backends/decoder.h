@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Decodes an mp3 file on its own thread into a bounded ring of interleaved 16-bit stereo
+ * frames, so that playback can start after the first few mp3 frames and only a fraction of
+ * a second of PCM is ever held in memory. Mono files are duplicated to both channels.
+ * Away from a tempo of 1 the audio is time-stretched on the way into the ring, so that it
+ * plays faster or slower at the same pitch, and out of its key it is resampled too, so
+ * that the pitch moves by some semitones at the same tempo. The vocals can be taken out on
+ * the way in as well, and a song analyzed by cdplusg_loudness_analyze is brought to the
+ * common level.
+ *
+ * cdplusg_decoder_read belongs to a single reader thread, typically the audio callback,
+ * and never blocks; the rest is safe from other threads, seeking from one at a time.
+ **/
+struct cdplusg_decoder;
+
+#define CDPLUSG_DECODER_MIN_TEMPO 0.5
+#define CDPLUSG_DECODER_MAX_TEMPO 2.0
+#define CDPLUSG_DECODER_MAX_SEMITONES 6
+
+/** The tempo is a factor of the original, between the two above, and the key is a number of
+ * semitones from the original, up to 6 either way.
+ **/
+struct cdplusg_decoder *cdplusg_decoder_new (const char *filename, double tempo, int semitones);
+void cdplusg_decoder_free (struct cdplusg_decoder *decoder);
+int cdplusg_decoder_get_sample_rate (const struct cdplusg_decoder *decoder);
+
+/** Copies up to frame_count decoded stereo frames into samples and returns how many were
+ * copied; fewer than asked for means the decoder has fallen behind or the file has ended.
+ **/
+size_t cdplusg_decoder_read (struct cdplusg_decoder *decoder, short *samples, size_t frame_count);
+
+/** The frames of the file the last read covered, start_frame to end_frame, and the tempo
+ * they were stretched at, which is what the position of any frame in between comes from.
+ * Like reading, this belongs to the reader thread.
+ **/
+void cdplusg_decoder_get_read_frames (struct cdplusg_decoder *decoder, uint64_t *start_frame, uint64_t *end_frame, double *tempo);
+
+/** Returns 1 once a read of frame_count frames would return all of them, or all that is
+ * left of the file. Like reading, this belongs to the reader thread.
+ **/
+int cdplusg_decoder_is_ready (struct cdplusg_decoder *decoder, size_t frame_count);
+
+/** Returns 1 once every frame of the file has been read. **/
+int cdplusg_decoder_is_finished (struct cdplusg_decoder *decoder);
+
+/** Frame of the file the next frame cdplusg_decoder_read returns starts at. **/
+uint64_t cdplusg_decoder_get_position (struct cdplusg_decoder *decoder);
+
+/** Discards everything buffered and continues decoding from the given frame. The reader
+ * gets nothing until the decoder has caught up.
+ **/
+void cdplusg_decoder_seek (struct cdplusg_decoder *decoder, uint64_t frame);
+
+/** Sets the tempo the next seek continues at; what is already buffered keeps its own. **/
+void cdplusg_decoder_set_tempo (struct cdplusg_decoder *decoder, double tempo);
+double cdplusg_decoder_get_tempo (struct cdplusg_decoder *decoder);
+
+/** Sets the key the next seek continues in. The formants move along with the pitch, which
+ * stays natural enough over 6 semitones.
+ **/
+void cdplusg_decoder_set_pitch (struct cdplusg_decoder *decoder, int semitones);
+int cdplusg_decoder_get_pitch (struct cdplusg_decoder *decoder);
+
+/** Sets how much of the vocals to take out, from 0 for none to 1 for as much as possible.
+ * Unlike the tempo and the key this needs no seek: it fades in or out over the next chunk
+ * decoded, so it is heard once what is already buffered has played, well under a second.
+ **/
+void cdplusg_decoder_set_vocal_reduction (struct cdplusg_decoder *decoder, double amount);
+double cdplusg_decoder_get_vocal_reduction (struct cdplusg_decoder *decoder);
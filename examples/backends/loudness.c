@@ -0,0 +1,661 @@
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <minimp3_ex.h>
+
+#include <cdplusg/loudness.h>
+
+#include "mp3_cache.h"
+
+#ifdef __GLIBC__
+extern char *program_invocation_short_name;
+#define PROGNAME() program_invocation_short_name
+#else
+#define PROGNAME() getprogname ()
+#endif
+
+// mp3 frames per chunk of work, about 7 s at 44.1 kHz: plenty of chunks to share out between
+// the threads, each long enough that the frames decoded ahead of it do not add up
+#define CDPLUSG_LOUDNESS_CHUNK_MP3_FRAMES 256
+
+// mp3 frames decoded but not measured ahead of every chunk but the first, 50 ms or so for
+// the K-weighting filters to settle; minimp3 seeks further back for its bit reservoir
+#define CDPLUSG_LOUDNESS_WARMUP_MP3_FRAMES 2
+
+// frames decoded at a time
+#define CDPLUSG_LOUDNESS_READ_FRAMES 4096
+
+// The mean square is summed in 100 ms steps, four of which make a gating block that
+// overlaps the next by three; peaks are kept every 10 ms for the overview.
+#define CDPLUSG_LOUDNESS_STEPS_PER_SECOND 10
+#define CDPLUSG_LOUDNESS_STEPS_PER_BLOCK 4
+#define CDPLUSG_LOUDNESS_PEAKS_PER_SECOND 100
+
+#define CDPLUSG_LOUDNESS_ABSOLUTE_GATE_LUFS -70.0
+#define CDPLUSG_LOUDNESS_RELATIVE_GATE_LU -10.0
+
+// gains are applied in Q12, which leaves room for the largest boost
+#define CDPLUSG_LOUDNESS_GAIN_BITS 12
+
+// the K-weighting: a high shelf for the head, then a high-pass, both biquads in direct
+// form II transposed, with the delays of the left and right channels side by side
+struct cdplusg_loudness_filter
+{
+  double b [2][3];
+  double a [2][3];
+  double z [2][2][2];
+};
+
+struct cdplusg_loudness_chunk
+{
+  // decoding starts at warmup_frame, measuring at start_frame, and both stop at end_frame,
+  // which for the last chunk is only a bound until it is done
+  uint64_t warmup_frame;
+  uint64_t start_frame;
+  uint64_t end_frame;
+
+  // sums of K-weighted squares by step, and peaks, from the step and peak start_frame is in
+  double *steps;
+  uint16_t *peaks;
+  uint64_t first_step;
+  uint64_t first_peak;
+  size_t step_count;
+  size_t peak_count;
+};
+
+struct cdplusg_loudness_job
+{
+  // shared by the workers, which each seek and decode a copy
+  const mp3dec_ex_t *mp3;
+  int channels;
+  int sample_rate;
+  struct cdplusg_loudness_filter filter;
+
+  struct cdplusg_loudness_chunk *chunks;
+  size_t chunk_count;
+  _Atomic size_t next_chunk;
+  _Atomic int has_failed;
+};
+
+// The filters of BS.1770 are specified at 48 kHz; these are their analog prototypes,
+// brought to any sample rate by the bilinear transform.
+static void
+cdplusg_loudness_filter_initialize (struct cdplusg_loudness_filter *filter, int sample_rate)
+{
+  double k = tan (M_PI * 1681.974450955533 / sample_rate);
+  double q = 0.7071752369554196;
+  double high_gain = pow (10, 3.999843853973347 / 20);
+  double band_gain = pow (high_gain, 0.4996667741545416);
+  double a0 = 1 + k / q + k * k;
+
+  filter->b[0][0] = (high_gain + band_gain * k / q + k * k) / a0;
+  filter->b[0][1] = 2 * (k * k - high_gain) / a0;
+  filter->b[0][2] = (high_gain - band_gain * k / q + k * k) / a0;
+  filter->a[0][0] = 1;
+  filter->a[0][1] = 2 * (k * k - 1) / a0;
+  filter->a[0][2] = (1 - k / q + k * k) / a0;
+
+  k = tan (M_PI * 38.13547087602444 / sample_rate);
+  q = 0.5003270373238773;
+  a0 = 1 + k / q + k * k;
+
+  filter->b[1][0] = 1;
+  filter->b[1][1] = -2;
+  filter->b[1][2] = 1;
+  filter->a[1][0] = 1;
+  filter->a[1][1] = 2 * (k * k - 1) / a0;
+  filter->a[1][2] = (1 - k / q + k * k) / a0;
+
+  memset (filter->z, 0x00, sizeof (filter->z));
+}
+
+// Returns the sum of the K-weighted squares of both channels, and raises peak to the highest
+// sample.
+static double
+cdplusg_loudness_filter_run (struct cdplusg_loudness_filter *filter, const short *samples, size_t frame_count,
+    int *peak)
+{
+  int highest = *peak;
+
+#if defined(__SSE2__)
+  // left and right in the two lanes
+  __m128d z [2][2];
+  __m128d b [2][3];
+  __m128d a [2][3];
+  __m128d sums = _mm_setzero_pd ();
+
+  for (int stage = 0; stage < 2; stage++)
+  {
+    z[stage][0] = _mm_loadu_pd (filter->z[stage][0]);
+    z[stage][1] = _mm_loadu_pd (filter->z[stage][1]);
+
+    for (int i = 0; i < 3; i++)
+    {
+      b[stage][i] = _mm_set1_pd (filter->b[stage][i]);
+      a[stage][i] = _mm_set1_pd (filter->a[stage][i]);
+    }
+  }
+
+  for (size_t i = 0; i < frame_count; i++)
+  {
+    int left = samples[2 * i + 0];
+    int right = samples[2 * i + 1];
+    __m128d x = _mm_set_pd (right, left);
+
+    for (int stage = 0; stage < 2; stage++)
+    {
+      __m128d y = _mm_add_pd (_mm_mul_pd (b[stage][0], x), z[stage][0]);
+
+      z[stage][0] = _mm_add_pd (_mm_sub_pd (_mm_mul_pd (b[stage][1], x), _mm_mul_pd (a[stage][1], y)), z[stage][1]);
+      z[stage][1] = _mm_sub_pd (_mm_mul_pd (b[stage][2], x), _mm_mul_pd (a[stage][2], y));
+      x = y;
+    }
+
+    sums = _mm_add_pd (sums, _mm_mul_pd (x, x));
+
+    left = left < 0 ? -left : left;
+    right = right < 0 ? -right : right;
+    highest = left > highest ? left : highest;
+    highest = right > highest ? right : highest;
+  }
+
+  for (int stage = 0; stage < 2; stage++)
+  {
+    _mm_storeu_pd (filter->z[stage][0], z[stage][0]);
+    _mm_storeu_pd (filter->z[stage][1], z[stage][1]);
+  }
+
+  double channel_sums [2];
+  _mm_storeu_pd (channel_sums, sums);
+#else
+  double channel_sums [2] = { 0, 0 };
+
+  for (size_t i = 0; i < frame_count; i++)
+  {
+    for (int channel = 0; channel < 2; channel++)
+    {
+      int sample = samples[2 * i + channel];
+      double x = sample;
+
+      for (int stage = 0; stage < 2; stage++)
+      {
+        double *z = filter->z[stage][0];
+        double *next_z = filter->z[stage][1];
+        double y = filter->b[stage][0] * x + z[channel];
+
+        z[channel] = filter->b[stage][1] * x - filter->a[stage][1] * y + next_z[channel];
+        next_z[channel] = filter->b[stage][2] * x - filter->a[stage][2] * y;
+        x = y;
+      }
+
+      channel_sums[channel] += x * x;
+
+      sample = sample < 0 ? -sample : sample;
+      highest = sample > highest ? sample : highest;
+    }
+  }
+#endif
+
+  *peak = highest;
+
+  return channel_sums[0] + channel_sums[1];
+}
+
+// Measures frames of the chunk, one 10 ms peak at a time, so that steps fill up whole.
+static void
+cdplusg_loudness_measure (const struct cdplusg_loudness_job *job, struct cdplusg_loudness_chunk *chunk,
+    struct cdplusg_loudness_filter *filter, const short *samples, uint64_t first_frame, size_t frame_count)
+{
+  uint64_t sample_rate = job->sample_rate;
+  size_t i = 0;
+
+  while (i < frame_count)
+  {
+    uint64_t frame = first_frame + i;
+    uint64_t peak = frame * CDPLUSG_LOUDNESS_PEAKS_PER_SECOND / sample_rate;
+    uint64_t next_peak_frame = ((peak + 1) * sample_rate + CDPLUSG_LOUDNESS_PEAKS_PER_SECOND - 1)
+                                 / CDPLUSG_LOUDNESS_PEAKS_PER_SECOND;
+    size_t count = next_peak_frame - frame < frame_count - i ? next_peak_frame - frame : frame_count - i;
+
+    int highest = 0;
+    double sum = cdplusg_loudness_filter_run (filter, &samples[2 * i], count, &highest);
+
+    uint64_t step = frame * CDPLUSG_LOUDNESS_STEPS_PER_SECOND / sample_rate;
+
+    if (step - chunk->first_step < chunk->step_count)
+      chunk->steps[step - chunk->first_step] += sum;
+
+    if (peak - chunk->first_peak < chunk->peak_count && highest > chunk->peaks[peak - chunk->first_peak])
+      chunk->peaks[peak - chunk->first_peak] = (uint16_t) highest;
+
+    i += count;
+  }
+}
+
+static int
+cdplusg_loudness_analyze_chunk (const struct cdplusg_loudness_job *job, struct cdplusg_loudness_chunk *chunk,
+    mp3dec_ex_t *mp3, short *buffer)
+{
+  uint64_t sample_rate = job->sample_rate;
+  int channels = job->channels;
+
+  chunk->first_step = chunk->start_frame * CDPLUSG_LOUDNESS_STEPS_PER_SECOND / sample_rate;
+  chunk->first_peak = chunk->start_frame * CDPLUSG_LOUDNESS_PEAKS_PER_SECOND / sample_rate;
+  chunk->step_count = (chunk->end_frame - 1) * CDPLUSG_LOUDNESS_STEPS_PER_SECOND / sample_rate - chunk->first_step + 1;
+  chunk->peak_count = (chunk->end_frame - 1) * CDPLUSG_LOUDNESS_PEAKS_PER_SECOND / sample_rate - chunk->first_peak + 1;
+  chunk->steps = (double *) calloc (chunk->step_count, sizeof (double));
+  chunk->peaks = (uint16_t *) calloc (chunk->peak_count, sizeof (uint16_t));
+
+  if (chunk->steps == NULL || chunk->peaks == NULL)
+    return 0;
+
+  // a copy of the decoder that seeks on its own, reading the shared file and index
+  *mp3 = *job->mp3;
+
+  if (mp3dec_ex_seek (mp3, chunk->warmup_frame * channels) != 0)
+    return 0;
+
+  struct cdplusg_loudness_filter filter = job->filter;
+  uint64_t frame = chunk->warmup_frame;
+
+  while (frame < chunk->end_frame)
+  {
+    uint64_t remaining = chunk->end_frame - frame;
+    size_t wanted_count = remaining < CDPLUSG_LOUDNESS_READ_FRAMES ? remaining : CDPLUSG_LOUDNESS_READ_FRAMES;
+    size_t frame_count = mp3dec_ex_read (mp3, buffer, wanted_count * channels) / channels;
+
+    // duplicate mono to both channels, as the decoder does for playback
+    if (channels == 1)
+    {
+      for (size_t i = frame_count; i > 0; i--)
+      {
+        buffer[2 * (i - 1) + 1] = buffer[i - 1];
+        buffer[2 * (i - 1) + 0] = buffer[i - 1];
+      }
+    }
+
+    size_t warmup_count = 0;
+
+    if (frame < chunk->start_frame)
+    {
+      int peak = 0;
+
+      warmup_count = chunk->start_frame - frame < frame_count ? chunk->start_frame - frame : frame_count;
+      cdplusg_loudness_filter_run (&filter, buffer, warmup_count, &peak);
+    }
+
+    cdplusg_loudness_measure (job, chunk, &filter, &buffer[2 * warmup_count], frame + warmup_count,
+        frame_count - warmup_count);
+
+    frame += frame_count;
+
+    if (frame_count < wanted_count)
+      break;
+  }
+
+  if (mp3->last_error)
+    return 0;
+
+  chunk->end_frame = frame;
+
+  return 1;
+}
+
+static void *
+cdplusg_loudness_worker_main (void *user_data)
+{
+  struct cdplusg_loudness_job *job = (struct cdplusg_loudness_job *) user_data;
+  mp3dec_ex_t *mp3 = (mp3dec_ex_t *) malloc (sizeof (mp3dec_ex_t));
+  short *buffer = (short *) malloc (2 * sizeof (short) * CDPLUSG_LOUDNESS_READ_FRAMES);
+
+  if (mp3 == NULL || buffer == NULL)
+  {
+    atomic_store_explicit (&job->has_failed, 1, memory_order_relaxed);
+  }
+  else
+  {
+    size_t next;
+
+    // chunks are taken in order as each worker becomes free
+    while ((next = atomic_fetch_add_explicit (&job->next_chunk, 1, memory_order_relaxed)) < job->chunk_count)
+    {
+      if (!cdplusg_loudness_analyze_chunk (job, &job->chunks[next], mp3, buffer))
+        atomic_store_explicit (&job->has_failed, 1, memory_order_relaxed);
+    }
+  }
+
+  free (mp3);
+  free (buffer);
+
+  return NULL;
+}
+
+static double
+cdplusg_loudness_to_lufs (double mean_square)
+{
+  return -0.691 + 10 * log10 (mean_square);
+}
+
+// Gates the blocks and integrates what passes, out of the K-weighted sums by step.
+static double
+cdplusg_loudness_integrate (const double *steps, uint64_t step_count, uint64_t frame_count, uint64_t sample_rate)
+{
+  double scale = 1.0 / (32768.0 * 32768.0);
+  double threshold = CDPLUSG_LOUDNESS_ABSOLUTE_GATE_LUFS;
+  double result = -INFINITY;
+
+  // an absolute pass for the relative threshold, then a relative one for the result
+  for (int pass = 0; pass < 2; pass++)
+  {
+    double power = 0;
+    uint64_t block_count = 0;
+
+    for (uint64_t step = 0; step + CDPLUSG_LOUDNESS_STEPS_PER_BLOCK <= step_count; step++)
+    {
+      uint64_t start_frame = (step * sample_rate + CDPLUSG_LOUDNESS_STEPS_PER_SECOND - 1) / CDPLUSG_LOUDNESS_STEPS_PER_SECOND;
+      uint64_t end_frame = ((step + CDPLUSG_LOUDNESS_STEPS_PER_BLOCK) * sample_rate + CDPLUSG_LOUDNESS_STEPS_PER_SECOND - 1)
+                             / CDPLUSG_LOUDNESS_STEPS_PER_SECOND;
+
+      // only whole blocks count
+      if (end_frame > frame_count)
+        break;
+
+      double sum = 0;
+
+      for (int i = 0; i < CDPLUSG_LOUDNESS_STEPS_PER_BLOCK; i++)
+        sum += steps[step + i];
+
+      double block_power = sum * scale / (end_frame - start_frame);
+
+      if (block_power > 0 && cdplusg_loudness_to_lufs (block_power) > threshold)
+      {
+        power += block_power;
+        block_count++;
+      }
+    }
+
+    if (block_count == 0)
+      return -INFINITY;
+
+    result = cdplusg_loudness_to_lufs (power / block_count);
+    threshold = result + CDPLUSG_LOUDNESS_RELATIVE_GATE_LU;
+
+    if (threshold < CDPLUSG_LOUDNESS_ABSOLUTE_GATE_LUFS)
+      threshold = CDPLUSG_LOUDNESS_ABSOLUTE_GATE_LUFS;
+  }
+
+  return result;
+}
+
+// Puts the chunks' measurements together into the analysis of the whole file.
+static int
+cdplusg_loudness_merge (const struct cdplusg_loudness_job *job, struct cdplusg_loudness *loudness)
+{
+  uint64_t sample_rate = job->sample_rate;
+  uint64_t frame_count = job->chunks[job->chunk_count - 1].end_frame;
+
+  memset (loudness, 0x00, sizeof (*loudness));
+  loudness->frame_count = frame_count;
+  loudness->integrated_lufs = -INFINITY;
+
+  if (frame_count == 0)
+    return 1;
+
+  uint64_t step_count = (frame_count - 1) * CDPLUSG_LOUDNESS_STEPS_PER_SECOND / sample_rate + 1;
+  uint64_t peak_count = (frame_count - 1) * CDPLUSG_LOUDNESS_PEAKS_PER_SECOND / sample_rate + 1;
+  double *steps = (double *) calloc (step_count, sizeof (double));
+  uint16_t *peaks = (uint16_t *) calloc (peak_count, sizeof (uint16_t));
+
+  if (steps == NULL || peaks == NULL)
+  {
+    free (steps);
+    free (peaks);
+    return 0;
+  }
+
+  for (size_t i = 0; i < job->chunk_count; i++)
+  {
+    const struct cdplusg_loudness_chunk *chunk = &job->chunks[i];
+
+    for (size_t j = 0; j < chunk->step_count && chunk->first_step + j < step_count; j++)
+      steps[chunk->first_step + j] += chunk->steps[j];
+
+    for (size_t j = 0; j < chunk->peak_count && chunk->first_peak + j < peak_count; j++)
+    {
+      if (chunk->peaks[j] > peaks[chunk->first_peak + j])
+        peaks[chunk->first_peak + j] = chunk->peaks[j];
+    }
+  }
+
+  loudness->integrated_lufs = cdplusg_loudness_integrate (steps, step_count, frame_count, sample_rate);
+
+  // each point of the overview the highest of its share of the peaks, a shorter song than
+  // there are points repeating some
+  int highest = 0;
+
+  for (uint64_t point = 0; point < CDPLUSG_LOUDNESS_OVERVIEW_POINTS; point++)
+  {
+    uint64_t first = point * peak_count / CDPLUSG_LOUDNESS_OVERVIEW_POINTS;
+    uint64_t last = (point + 1) * peak_count / CDPLUSG_LOUDNESS_OVERVIEW_POINTS;
+
+    if (last == first)
+      last = first + 1;
+
+    for (uint64_t i = first; i < last; i++)
+    {
+      if (peaks[i] > loudness->overview[point])
+        loudness->overview[point] = peaks[i];
+    }
+
+    if (loudness->overview[point] > highest)
+      highest = loudness->overview[point];
+  }
+
+  loudness->peak = highest / 32768.0;
+
+  free (steps);
+  free (peaks);
+
+  return 1;
+}
+
+// Splits the file into chunks at frames of its index and measures them in parallel.
+static int
+cdplusg_loudness_measure_file (const mp3dec_ex_t *mp3, unsigned int thread_count, struct cdplusg_loudness *loudness)
+{
+  const mp3dec_index_t *index = &mp3->index;
+
+  if (index->num_frames == 0)
+    return 0;
+
+  struct cdplusg_loudness_job job;
+
+  job.mp3 = mp3;
+  job.channels = mp3->info.channels;
+  job.sample_rate = mp3->info.hz;
+  job.chunk_count = (index->num_frames + CDPLUSG_LOUDNESS_CHUNK_MP3_FRAMES - 1) / CDPLUSG_LOUDNESS_CHUNK_MP3_FRAMES;
+  job.chunks = (struct cdplusg_loudness_chunk *) calloc (job.chunk_count, sizeof (struct cdplusg_loudness_chunk));
+  atomic_init (&job.next_chunk, 0);
+  atomic_init (&job.has_failed, 0);
+
+  if (job.chunks == NULL)
+    return 0;
+
+  cdplusg_loudness_filter_initialize (&job.filter, job.sample_rate);
+
+  // Index samples count every channel from the first audio frame, seeking skips the
+  // encoder delay; the last chunk goes on to the end of the file, however far that is.
+  for (size_t i = 0; i < job.chunk_count; i++)
+  {
+    size_t first = i * CDPLUSG_LOUDNESS_CHUNK_MP3_FRAMES;
+    size_t warmup = first - (first < CDPLUSG_LOUDNESS_WARMUP_MP3_FRAMES ? first : CDPLUSG_LOUDNESS_WARMUP_MP3_FRAMES);
+    uint64_t delay = mp3->start_delay;
+    uint64_t sample = index->frames[first].sample;
+    uint64_t warmup_sample = index->frames[warmup].sample;
+    uint64_t end_sample = i + 1 < job.chunk_count
+      ? index->frames[first + CDPLUSG_LOUDNESS_CHUNK_MP3_FRAMES].sample
+      : index->frames[index->num_frames - 1].sample + MINIMP3_MAX_SAMPLES_PER_FRAME;
+
+    job.chunks[i].start_frame = i == 0 || sample < delay ? 0 : (sample - delay) / job.channels;
+    job.chunks[i].warmup_frame = i == 0 || warmup_sample < delay ? 0 : (warmup_sample - delay) / job.channels;
+    job.chunks[i].end_frame = end_sample < delay ? 0 : (end_sample - delay) / job.channels;
+
+    // nothing would be left of a chunk inside the delay
+    if (job.chunks[i].end_frame <= job.chunks[i].start_frame)
+      job.chunks[i].end_frame = job.chunks[i].start_frame + 1;
+  }
+
+  if (thread_count == 0)
+  {
+    long processor_count = sysconf (_SC_NPROCESSORS_ONLN);
+    thread_count = processor_count > 0 ? (unsigned int) processor_count : 1;
+  }
+
+  if (thread_count > job.chunk_count)
+    thread_count = job.chunk_count;
+
+  pthread_t *threads = (pthread_t *) calloc (thread_count, sizeof (pthread_t));
+  unsigned int started_count = 0;
+
+  // the calling thread is one of the workers, and any that cannot be started leave more
+  // chunks to the others
+  for (unsigned int i = 1; threads && i < thread_count; i++)
+  {
+    if (pthread_create (&threads[started_count], NULL, cdplusg_loudness_worker_main, &job) == 0)
+      started_count++;
+  }
+
+  cdplusg_loudness_worker_main (&job);
+
+  for (unsigned int i = 0; i < started_count; i++)
+    pthread_join (threads[i], NULL);
+
+  int success = !atomic_load_explicit (&job.has_failed, memory_order_relaxed) && cdplusg_loudness_merge (&job, loudness);
+
+  for (size_t i = 0; i < job.chunk_count; i++)
+  {
+    free (job.chunks[i].steps);
+    free (job.chunks[i].peaks);
+  }
+
+  free (job.chunks);
+  free (threads);
+
+  return success;
+}
+
+int
+cdplusg_loudness_analyze (const char *filename, unsigned int thread_count, struct cdplusg_loudness *loudness)
+{
+  mp3dec_ex_t mp3;
+
+  // the frame index is taken from the cache or built below, not scanned here
+  int error = mp3dec_ex_open (&mp3, filename, MP3D_SEEK_TO_SAMPLE | MP3D_DO_NOT_SCAN);
+
+  if (error == MP3D_E_IOERROR)
+  {
+    fprintf (stderr, "%s: debug: could not open file '%s': %s\n", PROGNAME (), filename, strerror (errno));
+    return 0;
+  }
+  else if (error || mp3.info.channels < 1 || mp3.info.channels > 2)
+  {
+    fprintf (stderr, "%s: debug: something went wrong decoding the audio file '%s'\n", PROGNAME (), filename);
+
+    if (!error)
+      mp3dec_ex_close (&mp3);
+
+    return 0;
+  }
+
+  struct cdplusg_mp3_cache_key key;
+  int has_key = cdplusg_mp3_cache_get_key (&key, filename, mp3.file.buffer, mp3.file.size);
+
+  if (has_key && cdplusg_mp3_cache_load_loudness (&key, loudness))
+  {
+    mp3dec_ex_close (&mp3);
+    return 1;
+  }
+
+  cdplusg_mp3_cache_prepare_index (has_key ? &key : NULL, &mp3);
+
+  int success = cdplusg_loudness_measure_file (&mp3, thread_count, loudness);
+
+  if (!success)
+    fprintf (stderr, "%s: debug: something went wrong analyzing the audio file '%s'\n", PROGNAME (), filename);
+  else if (has_key)
+    cdplusg_mp3_cache_store_loudness (&key, loudness);
+
+  mp3dec_ex_close (&mp3);
+
+  return success;
+}
+
+double
+cdplusg_loudness_get_gain (const struct cdplusg_loudness *loudness)
+{
+  if (!isfinite (loudness->integrated_lufs))
+    return 1;
+
+  double gain_db = CDPLUSG_LOUDNESS_TARGET_LUFS - loudness->integrated_lufs;
+
+  if (gain_db > CDPLUSG_LOUDNESS_MAX_GAIN_DB)
+    gain_db = CDPLUSG_LOUDNESS_MAX_GAIN_DB;
+
+  double gain = pow (10, gain_db / 20);
+
+  if (gain * loudness->peak > 1)
+    gain = 1 / loudness->peak;
+
+  return gain;
+}
+
+void
+cdplusg_loudness_apply_gain (short *samples, size_t frame_count, double gain)
+{
+  int factor = (int) lrint (gain * (1 << CDPLUSG_LOUDNESS_GAIN_BITS));
+
+  if (factor == 1 << CDPLUSG_LOUDNESS_GAIN_BITS)
+    return;
+
+  if (factor > INT16_MAX)
+    factor = INT16_MAX;
+
+  size_t sample_count = 2 * frame_count;
+  size_t i = 0;
+
+#if defined(__SSE2__)
+  __m128i factors = _mm_set1_epi16 ((short) factor);
+  __m128i rounding = _mm_set1_epi32 (1 << (CDPLUSG_LOUDNESS_GAIN_BITS - 1));
+
+  for (; i + 8 <= sample_count; i += 8)
+  {
+    __m128i x = _mm_loadu_si128 ((const __m128i *) &samples[i]);
+    __m128i low = _mm_mullo_epi16 (x, factors);
+    __m128i high = _mm_mulhi_epi16 (x, factors);
+
+    // the full 32-bit products, rounded back down to samples and saturated
+    __m128i first = _mm_srai_epi32 (_mm_add_epi32 (_mm_unpacklo_epi16 (low, high), rounding), CDPLUSG_LOUDNESS_GAIN_BITS);
+    __m128i second = _mm_srai_epi32 (_mm_add_epi32 (_mm_unpackhi_epi16 (low, high), rounding), CDPLUSG_LOUDNESS_GAIN_BITS);
+
+    _mm_storeu_si128 ((__m128i *) &samples[i], _mm_packs_epi32 (first, second));
+  }
+#endif
+
+  for (; i < sample_count; i++)
+  {
+    int32_t sample = (samples[i] * factor + (1 << (CDPLUSG_LOUDNESS_GAIN_BITS - 1))) >> CDPLUSG_LOUDNESS_GAIN_BITS;
+    samples[i] = (short) (sample > INT16_MAX ? INT16_MAX : sample < INT16_MIN ? INT16_MIN : sample);
+  }
+}
@@ -0,0 +1,434 @@
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mp3_cache.h"
+
+#define CDPLUSG_MP3_CACHE_MAGIC "CDGCACH1"
+#define CDPLUSG_MP3_CACHE_BYTE_ORDER 0x01020304
+
+// PCM starts a page into its entry, so that the samples of a mapping are page aligned
+#define CDPLUSG_MP3_CACHE_PCM_OFFSET 4096
+
+// how much of each end of the file goes into the content hash
+#define CDPLUSG_MP3_CACHE_HASHED_SIZE 65536
+
+enum cdplusg_mp3_cache_kind
+{
+  CDPLUSG_MP3_CACHE_INDEX = 1,
+  CDPLUSG_MP3_CACHE_PCM = 2,
+  CDPLUSG_MP3_CACHE_LOUDNESS = 3
+};
+
+struct cdplusg_mp3_cache_header
+{
+  char magic [8];
+  uint32_t byte_order;
+  uint32_t kind;
+
+  uint64_t file_size;
+  int64_t modification_seconds;
+  int64_t modification_nanoseconds;
+  uint64_t content_hash;
+
+  // index frames or PCM frames that follow, or 1 for a loudness analysis
+  uint64_t count;
+  uint32_t sample_rate;
+  uint32_t reserved;
+};
+
+struct cdplusg_mp3_cache_writer
+{
+  FILE *file;
+  char path [PATH_MAX];
+  char temporary_path [PATH_MAX + 32];
+  struct cdplusg_mp3_cache_header header;
+  int failed;
+};
+
+static uint64_t
+cdplusg_mp3_cache_hash (uint64_t hash, const void *data, size_t size)
+{
+  const unsigned char *bytes = (const unsigned char *) data;
+
+  // 64-bit FNV-1a
+  for (size_t i = 0; i < size; i++)
+    hash = (hash ^ bytes[i]) * UINT64_C (0x100000001B3);
+
+  return hash;
+}
+
+// Builds the path of the entry of the given kind, creating the cache directory on the way.
+static int
+cdplusg_mp3_cache_get_path (char *path, size_t path_size, const struct cdplusg_mp3_cache_key *key,
+    enum cdplusg_mp3_cache_kind kind)
+{
+  char directory [PATH_MAX];
+  const char *variable;
+  int length;
+
+  if ((variable = getenv ("CDPLUSG_CACHE_DIR")) != NULL && *variable != '\0')
+    length = snprintf (directory, sizeof (directory), "%s", variable);
+  else if ((variable = getenv ("XDG_CACHE_HOME")) != NULL && *variable != '\0')
+    length = snprintf (directory, sizeof (directory), "%s/cdplusg", variable);
+  else if ((variable = getenv ("HOME")) != NULL && *variable != '\0')
+    length = snprintf (directory, sizeof (directory), "%s/.cache/cdplusg", variable);
+  else
+    return 0;
+
+  if (length < 0 || (size_t) length >= sizeof (directory))
+    return 0;
+
+  // every missing parent too, like mkdir -p
+  for (char *slash = strchr (directory + 1, '/'); ; slash = strchr (slash + 1, '/'))
+  {
+    if (slash)
+      *slash = '\0';
+
+    if (mkdir (directory, 0755) != 0 && errno != EEXIST)
+      return 0;
+
+    if (slash == NULL)
+      break;
+
+    *slash = '/';
+  }
+
+  length = snprintf (path, path_size, "%s/%016llx.%s", directory, (unsigned long long) key->path_hash,
+      kind == CDPLUSG_MP3_CACHE_INDEX ? "idx" : kind == CDPLUSG_MP3_CACHE_PCM ? "pcm" : "lufs");
+
+  return length >= 0 && (size_t) length < path_size;
+}
+
+static void
+cdplusg_mp3_cache_initialize_header (struct cdplusg_mp3_cache_header *header, const struct cdplusg_mp3_cache_key *key,
+    enum cdplusg_mp3_cache_kind kind)
+{
+  memset (header, 0, sizeof (*header));
+  memcpy (header->magic, CDPLUSG_MP3_CACHE_MAGIC, sizeof (header->magic));
+  header->byte_order = CDPLUSG_MP3_CACHE_BYTE_ORDER;
+  header->kind = kind;
+  header->file_size = key->file_size;
+  header->modification_seconds = key->modification_seconds;
+  header->modification_nanoseconds = key->modification_nanoseconds;
+  header->content_hash = key->content_hash;
+}
+
+// An entry only counts when it was written on a machine of the same byte order for this
+// exact version of the file.
+static int
+cdplusg_mp3_cache_is_header_valid (const struct cdplusg_mp3_cache_header *header, const struct cdplusg_mp3_cache_key *key,
+    enum cdplusg_mp3_cache_kind kind)
+{
+  return memcmp (header->magic, CDPLUSG_MP3_CACHE_MAGIC, sizeof (header->magic)) == 0
+    && header->byte_order == CDPLUSG_MP3_CACHE_BYTE_ORDER
+    && header->kind == (uint32_t) kind
+    && header->file_size == key->file_size
+    && header->modification_seconds == key->modification_seconds
+    && header->modification_nanoseconds == key->modification_nanoseconds
+    && header->content_hash == key->content_hash;
+}
+
+int
+cdplusg_mp3_cache_get_key (struct cdplusg_mp3_cache_key *key, const char *filename, const uint8_t *data, size_t size)
+{
+  char resolved_path [PATH_MAX];
+  struct stat file_status;
+
+  if (realpath (filename, resolved_path) == NULL || stat (resolved_path, &file_status) != 0)
+    return 0;
+
+  size_t hashed_size = size < CDPLUSG_MP3_CACHE_HASHED_SIZE ? size : CDPLUSG_MP3_CACHE_HASHED_SIZE;
+  uint64_t hash = UINT64_C (0xCBF29CE484222325);
+
+  hash = cdplusg_mp3_cache_hash (hash, data, hashed_size);
+  hash = cdplusg_mp3_cache_hash (hash, data + size - hashed_size, hashed_size);
+
+  key->path_hash = cdplusg_mp3_cache_hash (UINT64_C (0xCBF29CE484222325), resolved_path, strlen (resolved_path));
+  key->file_size = file_status.st_size;
+  key->modification_seconds = file_status.st_mtim.tv_sec;
+  key->modification_nanoseconds = file_status.st_mtim.tv_nsec;
+  key->content_hash = hash;
+
+  return 1;
+}
+
+int
+cdplusg_mp3_cache_load_index (const struct cdplusg_mp3_cache_key *key, mp3dec_index_t *index)
+{
+  char path [PATH_MAX];
+  struct cdplusg_mp3_cache_header header;
+
+  if (!cdplusg_mp3_cache_get_path (path, sizeof (path), key, CDPLUSG_MP3_CACHE_INDEX))
+    return 0;
+
+  FILE *file = fopen (path, "rb");
+
+  if (file == NULL)
+    return 0;
+
+  int success = fread (&header, sizeof (header), 1, file) == 1
+    && cdplusg_mp3_cache_is_header_valid (&header, key, CDPLUSG_MP3_CACHE_INDEX)
+    && header.count > 0 && header.count <= SIZE_MAX / sizeof (mp3dec_frame_t);
+
+  mp3dec_frame_t *frames = NULL;
+
+  if (success)
+  {
+    frames = (mp3dec_frame_t *) malloc (header.count * sizeof (mp3dec_frame_t));
+    success = frames != NULL && fread (frames, sizeof (mp3dec_frame_t), header.count, file) == header.count;
+  }
+
+  fclose (file);
+
+  if (!success)
+  {
+    free (frames);
+    return 0;
+  }
+
+  index->frames = frames;
+  index->num_frames = header.count;
+  index->capacity = header.count;
+
+  return 1;
+}
+
+// Entries are written under a temporary name and renamed into place, so that readers never
+// see half of one and concurrent writers do not mix theirs.
+static FILE *
+cdplusg_mp3_cache_create (char *path, size_t path_size, char *temporary_path, size_t temporary_path_size,
+    const struct cdplusg_mp3_cache_key *key, enum cdplusg_mp3_cache_kind kind)
+{
+  if (!cdplusg_mp3_cache_get_path (path, path_size, key, kind))
+    return NULL;
+
+  int length = snprintf (temporary_path, temporary_path_size, "%s.%ld.tmp", path, (long) getpid ());
+
+  if (length < 0 || (size_t) length >= temporary_path_size)
+    return NULL;
+
+  return fopen (temporary_path, "wb");
+}
+
+int
+cdplusg_mp3_cache_store_index (const struct cdplusg_mp3_cache_key *key, const mp3dec_index_t *index)
+{
+  char path [PATH_MAX];
+  char temporary_path [PATH_MAX + 32];
+  struct cdplusg_mp3_cache_header header;
+
+  if (index->num_frames == 0)
+    return 0;
+
+  FILE *file = cdplusg_mp3_cache_create (path, sizeof (path), temporary_path, sizeof (temporary_path), key,
+                 CDPLUSG_MP3_CACHE_INDEX);
+
+  if (file == NULL)
+    return 0;
+
+  cdplusg_mp3_cache_initialize_header (&header, key, CDPLUSG_MP3_CACHE_INDEX);
+  header.count = index->num_frames;
+
+  int success = fwrite (&header, sizeof (header), 1, file) == 1
+    && fwrite (index->frames, sizeof (mp3dec_frame_t), index->num_frames, file) == index->num_frames;
+
+  success = fclose (file) == 0 && success && rename (temporary_path, path) == 0;
+
+  if (!success)
+    unlink (temporary_path);
+
+  return success;
+}
+
+void
+cdplusg_mp3_cache_prepare_index (const struct cdplusg_mp3_cache_key *key, mp3dec_ex_t *mp3)
+{
+  if (key && !mp3->indexes_built && cdplusg_mp3_cache_load_index (key, &mp3->index))
+  {
+    // the state minimp3 leaves behind after building the index itself on a first seek
+    mp3->indexes_built = 1;
+    mp3->samples = mp3->detected_samples;
+    return;
+  }
+
+  // seeking anywhere but the start makes minimp3 build the index
+  mp3dec_ex_seek (mp3, 1);
+  mp3dec_ex_seek (mp3, 0);
+
+  if (key && mp3->index.num_frames > 0)
+    cdplusg_mp3_cache_store_index (key, &mp3->index);
+}
+
+int
+cdplusg_mp3_cache_load_loudness (const struct cdplusg_mp3_cache_key *key, struct cdplusg_loudness *loudness)
+{
+  char path [PATH_MAX];
+  struct cdplusg_mp3_cache_header header;
+
+  if (!cdplusg_mp3_cache_get_path (path, sizeof (path), key, CDPLUSG_MP3_CACHE_LOUDNESS))
+    return 0;
+
+  FILE *file = fopen (path, "rb");
+
+  if (file == NULL)
+    return 0;
+
+  int success = fread (&header, sizeof (header), 1, file) == 1
+    && cdplusg_mp3_cache_is_header_valid (&header, key, CDPLUSG_MP3_CACHE_LOUDNESS)
+    && header.count == 1
+    && fread (loudness, sizeof (*loudness), 1, file) == 1;
+
+  fclose (file);
+
+  return success;
+}
+
+int
+cdplusg_mp3_cache_store_loudness (const struct cdplusg_mp3_cache_key *key, const struct cdplusg_loudness *loudness)
+{
+  char path [PATH_MAX];
+  char temporary_path [PATH_MAX + 32];
+  struct cdplusg_mp3_cache_header header;
+
+  FILE *file = cdplusg_mp3_cache_create (path, sizeof (path), temporary_path, sizeof (temporary_path), key,
+                 CDPLUSG_MP3_CACHE_LOUDNESS);
+
+  if (file == NULL)
+    return 0;
+
+  cdplusg_mp3_cache_initialize_header (&header, key, CDPLUSG_MP3_CACHE_LOUDNESS);
+  header.count = 1;
+
+  int success = fwrite (&header, sizeof (header), 1, file) == 1
+    && fwrite (loudness, sizeof (*loudness), 1, file) == 1;
+
+  success = fclose (file) == 0 && success && rename (temporary_path, path) == 0;
+
+  if (!success)
+    unlink (temporary_path);
+
+  return success;
+}
+
+const short *
+cdplusg_mp3_cache_map_pcm (const struct cdplusg_mp3_cache_key *key, int *sample_rate, uint64_t *frame_count,
+    size_t *mapping_size)
+{
+  char path [PATH_MAX];
+  struct cdplusg_mp3_cache_header header;
+
+  if (!cdplusg_mp3_cache_get_path (path, sizeof (path), key, CDPLUSG_MP3_CACHE_PCM))
+    return NULL;
+
+  FILE *file = fopen (path, "rb");
+
+  if (file == NULL)
+    return NULL;
+
+  struct stat file_status;
+
+  int success = fread (&header, sizeof (header), 1, file) == 1
+    && cdplusg_mp3_cache_is_header_valid (&header, key, CDPLUSG_MP3_CACHE_PCM)
+    && fstat (fileno (file), &file_status) == 0
+    && header.count <= (SIZE_MAX - CDPLUSG_MP3_CACHE_PCM_OFFSET) / (2 * sizeof (short))
+    && (uint64_t) file_status.st_size == CDPLUSG_MP3_CACHE_PCM_OFFSET + header.count * 2 * sizeof (short);
+
+  void *mapping = MAP_FAILED;
+
+  if (success)
+  {
+    *mapping_size = file_status.st_size;
+    mapping = mmap (NULL, *mapping_size, PROT_READ, MAP_PRIVATE, fileno (file), 0);
+  }
+
+  fclose (file);
+
+  if (mapping == MAP_FAILED)
+    return NULL;
+
+  *sample_rate = header.sample_rate;
+  *frame_count = header.count;
+
+  return (const short *) ((const char *) mapping + CDPLUSG_MP3_CACHE_PCM_OFFSET);
+}
+
+void
+cdplusg_mp3_cache_unmap_pcm (const short *samples, size_t mapping_size)
+{
+  if (samples)
+    munmap ((char *) samples - CDPLUSG_MP3_CACHE_PCM_OFFSET, mapping_size);
+}
+
+int
+cdplusg_mp3_cache_is_pcm_enabled (void)
+{
+  const char *variable = getenv ("CDPLUSG_CACHE_PCM");
+
+  return variable != NULL && *variable != '\0' && strcmp (variable, "0") != 0;
+}
+
+struct cdplusg_mp3_cache_writer *
+cdplusg_mp3_cache_writer_new (const struct cdplusg_mp3_cache_key *key, int sample_rate)
+{
+  struct cdplusg_mp3_cache_writer *writer =
+    (struct cdplusg_mp3_cache_writer *) calloc (1, sizeof (struct cdplusg_mp3_cache_writer));
+
+  if (writer == NULL)
+    return NULL;
+
+  writer->file = cdplusg_mp3_cache_create (writer->path, sizeof (writer->path), writer->temporary_path,
+                   sizeof (writer->temporary_path), key, CDPLUSG_MP3_CACHE_PCM);
+
+  // the header is written last, once the frame count is known
+  if (writer->file == NULL || fseek (writer->file, CDPLUSG_MP3_CACHE_PCM_OFFSET, SEEK_SET) != 0)
+  {
+    cdplusg_mp3_cache_writer_free (writer, 0);
+    return NULL;
+  }
+
+  cdplusg_mp3_cache_initialize_header (&writer->header, key, CDPLUSG_MP3_CACHE_PCM);
+  writer->header.sample_rate = sample_rate;
+
+  return writer;
+}
+
+int
+cdplusg_mp3_cache_writer_write (struct cdplusg_mp3_cache_writer *writer, const short *samples, size_t frame_count)
+{
+  if (!writer->failed && frame_count > 0 && fwrite (samples, 2 * sizeof (short), frame_count, writer->file) != frame_count)
+    writer->failed = 1;
+
+  writer->header.count += frame_count;
+
+  return !writer->failed;
+}
+
+void
+cdplusg_mp3_cache_writer_free (struct cdplusg_mp3_cache_writer *writer, int finish)
+{
+  if (writer == NULL)
+    return;
+
+  if (writer->file)
+  {
+    int success = finish && !writer->failed
+      && fseek (writer->file, 0, SEEK_SET) == 0
+      && fwrite (&writer->header, sizeof (writer->header), 1, writer->file) == 1;
+
+    success = fclose (writer->file) == 0 && success && rename (writer->temporary_path, writer->path) == 0;
+
+    if (!success)
+      unlink (writer->temporary_path);
+  }
+
+  free (writer);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <minimp3_ex.h>
+
+#include <cdplusg/loudness.h>
+
+/** Keeps what is expensive to recompute about an mp3 file in a cache directory, so that
+ * opening the same file again is instant: the minimp3 frame index used for seeking, its
+ * loudness analysis and, optionally, the decoded PCM in a page-aligned file that can be
+ * mapped and played as is.
+ *
+ * Entries are named after the file's path and validated against its size, modification
+ * time and a hash of its first and last 64 KiB, so a changed file is simply a miss. The
+ * directory is $CDPLUSG_CACHE_DIR, else $XDG_CACHE_HOME/cdplusg, else ~/.cache/cdplusg.
+ **/
+struct cdplusg_mp3_cache_key
+{
+  uint64_t path_hash;
+  uint64_t file_size;
+  int64_t modification_seconds;
+  int64_t modification_nanoseconds;
+  uint64_t content_hash;
+};
+
+/** Writes PCM into a cache entry as it is decoded; the entry only appears once finished. **/
+struct cdplusg_mp3_cache_writer;
+
+/** Fills key for filename, whose contents are mapped at data. Returns 0 on failure. **/
+int cdplusg_mp3_cache_get_key (struct cdplusg_mp3_cache_key *key, const char *filename, const uint8_t *data, size_t size);
+
+/** Returns 1 and a malloc'ed index on a hit. **/
+int cdplusg_mp3_cache_load_index (const struct cdplusg_mp3_cache_key *key, mp3dec_index_t *index);
+int cdplusg_mp3_cache_store_index (const struct cdplusg_mp3_cache_key *key, const mp3dec_index_t *index);
+
+/** Gives mp3, opened with MP3D_DO_NOT_SCAN, its frame index: from the cache on a hit, else
+ * built right away, as a full scan at open would have, and stored. key may be NULL when
+ * there is no cache to use.
+ **/
+void cdplusg_mp3_cache_prepare_index (const struct cdplusg_mp3_cache_key *key, mp3dec_ex_t *mp3);
+
+/** Returns 1 and fills loudness on a hit. **/
+int cdplusg_mp3_cache_load_loudness (const struct cdplusg_mp3_cache_key *key, struct cdplusg_loudness *loudness);
+int cdplusg_mp3_cache_store_loudness (const struct cdplusg_mp3_cache_key *key, const struct cdplusg_loudness *loudness);
+
+/** Maps cached interleaved 16-bit stereo PCM, or returns NULL on a miss. **/
+const short *cdplusg_mp3_cache_map_pcm (const struct cdplusg_mp3_cache_key *key, int *sample_rate, uint64_t *frame_count, size_t *mapping_size);
+void cdplusg_mp3_cache_unmap_pcm (const short *samples, size_t mapping_size);
+
+/** Returns 1 when $CDPLUSG_CACHE_PCM asks for decoded PCM to be cached. **/
+int cdplusg_mp3_cache_is_pcm_enabled (void);
+
+struct cdplusg_mp3_cache_writer *cdplusg_mp3_cache_writer_new (const struct cdplusg_mp3_cache_key *key, int sample_rate);
+int cdplusg_mp3_cache_writer_write (struct cdplusg_mp3_cache_writer *writer, const short *samples, size_t frame_count);
+
+/** Completes the entry when finish is set, otherwise throws away what was written. **/
+void cdplusg_mp3_cache_writer_free (struct cdplusg_mp3_cache_writer *writer, int finish);
@@ -0,0 +1,567 @@
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <cdplusg/null_audio.h>
+
+#include "playback.h"
+
+#ifdef __GLIBC__
+extern char *program_invocation_short_name;
+#define PROGNAME() program_invocation_short_name
+#else
+#define PROGNAME() getprogname ()
+#endif
+
+#define CDPLUSG_NULL_AUDIO_DEFAULT_BUFFER_FRAMES 512
+
+// well inside what the decoder keeps buffered, so that a virtual buffer can always be filled
+#define CDPLUSG_NULL_AUDIO_MAX_BUFFER_FRAMES 4096
+
+// how long the virtual clock waits before looking at the decoder again
+#define CDPLUSG_NULL_AUDIO_STALL_NS 100000
+
+#define CDPLUSG_NULL_AUDIO_WAV_HEADER_SIZE 44
+
+struct cdplusg_null_audio_context
+{
+  struct cdplusg_playback playback;
+
+  int is_virtual_clock;
+  unsigned int buffer_frames;
+  double buffer_duration;
+  short *buffer;
+
+  FILE *wav_file;
+  unsigned char *wav_buffer;
+  uint64_t wav_frame_count;
+
+  // the device thread sleeps on the condition while paused or once the song is over
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t condition;
+  int is_playing;
+  int is_active;
+  int is_shutting_down;
+  struct cdplusg_null_audio_statistics statistics;
+  double total_callback_us;
+
+  // seconds of audio consumed, the stream time of the virtual clock
+  _Atomic double virtual_time;
+};
+
+static double
+cdplusg_null_audio_get_monotonic_time (void)
+{
+  struct timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static double
+cdplusg_null_audio_get_stream_time (struct cdplusg_null_audio_context *context)
+{
+  if (context->is_virtual_clock)
+    return atomic_load_explicit (&context->virtual_time, memory_order_relaxed);
+
+  return cdplusg_null_audio_get_monotonic_time ();
+}
+
+static void
+cdplusg_null_audio_sleep_until (double time)
+{
+  struct timespec deadline;
+
+  deadline.tv_sec = (time_t) time;
+  deadline.tv_nsec = (long) ((time - deadline.tv_sec) * 1e9);
+
+  while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR)
+    ;
+}
+
+static void
+cdplusg_null_audio_put_u16 (unsigned char *bytes, uint16_t value)
+{
+  bytes[0] = value;
+  bytes[1] = value >> 8;
+}
+
+static void
+cdplusg_null_audio_put_u32 (unsigned char *bytes, uint32_t value)
+{
+  bytes[0] = value;
+  bytes[1] = value >> 8;
+  bytes[2] = value >> 16;
+  bytes[3] = value >> 24;
+}
+
+// Writes the header of a 16-bit stereo PCM WAV file of frame_count frames.
+static int
+cdplusg_null_audio_write_wav_header (FILE *file, uint32_t sample_rate, uint64_t frame_count)
+{
+  unsigned char header [CDPLUSG_NULL_AUDIO_WAV_HEADER_SIZE];
+  uint64_t data_size = 4 * frame_count;
+
+  // the sizes are 32 bits, longer files just end up with a truncated header
+  if (data_size > UINT32_MAX - CDPLUSG_NULL_AUDIO_WAV_HEADER_SIZE)
+    data_size = UINT32_MAX - CDPLUSG_NULL_AUDIO_WAV_HEADER_SIZE;
+
+  memcpy (&header[0], "RIFF", 4);
+  cdplusg_null_audio_put_u32 (&header[4], CDPLUSG_NULL_AUDIO_WAV_HEADER_SIZE - 8 + data_size);
+  memcpy (&header[8], "WAVE", 4);
+
+  memcpy (&header[12], "fmt ", 4);
+  cdplusg_null_audio_put_u32 (&header[16], 16);
+  cdplusg_null_audio_put_u16 (&header[20], 1);
+  cdplusg_null_audio_put_u16 (&header[22], 2);
+  cdplusg_null_audio_put_u32 (&header[24], sample_rate);
+  cdplusg_null_audio_put_u32 (&header[28], 4 * sample_rate);
+  cdplusg_null_audio_put_u16 (&header[32], 4);
+  cdplusg_null_audio_put_u16 (&header[34], 16);
+
+  memcpy (&header[36], "data", 4);
+  cdplusg_null_audio_put_u32 (&header[40], data_size);
+
+  return fseek (file, 0, SEEK_SET) == 0 && fwrite (header, sizeof (header), 1, file) == 1;
+}
+
+static void
+cdplusg_null_audio_write_wav (struct cdplusg_null_audio_context *context, const short *samples, size_t frame_count)
+{
+  if (context->wav_file == NULL)
+    return;
+
+  // WAV is little-endian whatever the host is
+  for (size_t i = 0; i < 2 * frame_count; i++)
+    cdplusg_null_audio_put_u16 (&context->wav_buffer[2 * i], (uint16_t) samples[i]);
+
+  if (fwrite (context->wav_buffer, 4, frame_count, context->wav_file) != frame_count)
+  {
+    fprintf (stderr, "%s: debug: error writing wav file, no longer writing it: %s\n", PROGNAME (), strerror (errno));
+    fclose (context->wav_file);
+    context->wav_file = NULL;
+    return;
+  }
+
+  context->wav_frame_count += frame_count;
+}
+
+static void *
+cdplusg_null_audio_main (void *user_data)
+{
+  struct cdplusg_null_audio_context *context = (struct cdplusg_null_audio_context *) user_data;
+  struct cdplusg_null_audio_statistics *statistics = &context->statistics;
+
+  int is_running = 0;
+  double running_start_time = 0;
+  double deadline = 0;
+
+  pthread_mutex_lock (&context->mutex);
+
+  while (!context->is_shutting_down)
+  {
+    if (!context->is_playing || !context->is_active)
+    {
+      if (is_running)
+        statistics->elapsed_seconds += cdplusg_null_audio_get_monotonic_time () - running_start_time;
+
+      is_running = 0;
+      pthread_cond_wait (&context->condition, &context->mutex);
+      continue;
+    }
+
+    // after a pause the device picks up from now, it does not make up for lost time
+    if (!is_running)
+    {
+      is_running = 1;
+      running_start_time = cdplusg_null_audio_get_monotonic_time ();
+      deadline = running_start_time;
+    }
+
+    pthread_mutex_unlock (&context->mutex);
+
+    double lateness = 0;
+    double stall_time = 0;
+    double dac_time;
+    int is_late = 0;
+
+    if (context->is_virtual_clock)
+    {
+      double stall_start_time = cdplusg_null_audio_get_monotonic_time ();
+
+      // rather than inventing silence, time stands still until the decoder catches up
+      if (!cdplusg_decoder_is_ready (context->playback.decoder, context->buffer_frames))
+      {
+        struct timespec duration = { 0, CDPLUSG_NULL_AUDIO_STALL_NS };
+
+        do
+          nanosleep (&duration, NULL);
+        while (!cdplusg_decoder_is_ready (context->playback.decoder, context->buffer_frames));
+
+        stall_time = cdplusg_null_audio_get_monotonic_time () - stall_start_time;
+      }
+
+      // no output latency, a buffer is heard the moment it is consumed
+      dac_time = atomic_load_explicit (&context->virtual_time, memory_order_relaxed);
+    }
+    else
+    {
+      cdplusg_null_audio_sleep_until (deadline);
+      lateness = cdplusg_null_audio_get_monotonic_time () - deadline;
+
+      // a device this late would have run dry, so the schedule starts over from now
+      if (lateness > context->buffer_duration)
+      {
+        is_late = 1;
+        deadline += lateness;
+      }
+
+      // one buffer is queued ahead of this one
+      dac_time = deadline + context->buffer_duration;
+    }
+
+    double callback_start_time = cdplusg_null_audio_get_monotonic_time ();
+    size_t read_count = cdplusg_playback_fill (&context->playback, context->buffer, context->buffer_frames, dac_time);
+    double callback_us = 1e6 * (cdplusg_null_audio_get_monotonic_time () - callback_start_time);
+
+    cdplusg_null_audio_write_wav (context, context->buffer, context->buffer_frames);
+
+    if (context->is_virtual_clock)
+      atomic_store_explicit (&context->virtual_time, dac_time + context->buffer_duration, memory_order_relaxed);
+    else
+      deadline += context->buffer_duration;
+
+    int is_finished = read_count < context->buffer_frames && cdplusg_decoder_is_finished (context->playback.decoder);
+
+    pthread_mutex_lock (&context->mutex);
+
+    statistics->callback_count++;
+    statistics->frame_count += context->buffer_frames;
+
+    // running out at the end of the song is not an underrun
+    if (read_count < context->buffer_frames && !is_finished)
+    {
+      statistics->underrun_count++;
+      statistics->silent_frame_count += context->buffer_frames - read_count;
+    }
+
+    statistics->late_count += is_late;
+    statistics->stall_seconds += stall_time;
+
+    if (callback_us > statistics->max_callback_us)
+      statistics->max_callback_us = callback_us;
+
+    if (1e6 * lateness > statistics->max_lateness_us)
+      statistics->max_lateness_us = 1e6 * lateness;
+
+    context->total_callback_us += callback_us;
+    statistics->mean_callback_us = context->total_callback_us / statistics->callback_count;
+
+    if (is_finished)
+      context->is_active = 0;
+  }
+
+  if (is_running)
+    statistics->elapsed_seconds += cdplusg_null_audio_get_monotonic_time () - running_start_time;
+
+  pthread_mutex_unlock (&context->mutex);
+
+  return NULL;
+}
+
+struct cdplusg_null_audio_context *
+cdplusg_null_audio_context_initialize (const char *audio_filename, double tempo, int semitones,
+    const struct cdplusg_null_audio_options *options)
+{
+  struct cdplusg_null_audio_options default_options = { 0, 0, NULL };
+
+  if (options == NULL)
+    options = &default_options;
+
+  struct cdplusg_null_audio_context *context =
+    (struct cdplusg_null_audio_context *) calloc (1, sizeof (struct cdplusg_null_audio_context));
+
+  if (context == NULL)
+    return NULL;
+
+  if (!cdplusg_playback_initialize (&context->playback, audio_filename, tempo, semitones))
+  {
+    free (context);
+    return NULL;
+  }
+
+  int sample_rate = context->playback.sample_rate;
+
+  context->is_virtual_clock = options->is_virtual_clock;
+
+  context->buffer_frames = options->buffer_frames ? options->buffer_frames : CDPLUSG_NULL_AUDIO_DEFAULT_BUFFER_FRAMES;
+
+  if (context->buffer_frames > CDPLUSG_NULL_AUDIO_MAX_BUFFER_FRAMES)
+    context->buffer_frames = CDPLUSG_NULL_AUDIO_MAX_BUFFER_FRAMES;
+
+  context->buffer_duration = (double) context->buffer_frames / sample_rate;
+  context->buffer = (short *) malloc (2 * sizeof (short) * context->buffer_frames);
+
+  if (context->buffer == NULL)
+    goto error_pre_initialize;
+
+  if (options->wav_filename)
+  {
+    context->wav_file = fopen (options->wav_filename, "wb");
+    context->wav_buffer = (unsigned char *) malloc (4 * (size_t) context->buffer_frames);
+
+    if (context->wav_file == NULL || context->wav_buffer == NULL
+          || !cdplusg_null_audio_write_wav_header (context->wav_file, sample_rate, 0))
+    {
+      fprintf (stderr, "%s: error: could not write wav file '%s': %s\n", PROGNAME (), options->wav_filename,
+          strerror (errno));
+      goto error_pre_initialize;
+    }
+  }
+
+  atomic_init (&context->virtual_time, 0);
+
+  pthread_mutex_init (&context->mutex, NULL);
+  pthread_cond_init (&context->condition, NULL);
+
+  context->is_playing = 1;
+  context->is_active = 1;
+
+  if (pthread_create (&context->thread, NULL, cdplusg_null_audio_main, context) == 0)
+    return context;
+
+  pthread_cond_destroy (&context->condition);
+  pthread_mutex_destroy (&context->mutex);
+
+error_pre_initialize:
+  if (context->wav_file)
+    fclose (context->wav_file);
+
+  free (context->wav_buffer);
+  free (context->buffer);
+  cdplusg_playback_finalize (&context->playback);
+  free (context);
+  return NULL;
+}
+
+unsigned int
+cdplusg_null_audio_context_get_elapsed_time_ms (struct cdplusg_null_audio_context *context)
+{
+  return (unsigned int) (cdplusg_null_audio_context_get_position (context) * 1000);
+}
+
+double
+cdplusg_null_audio_context_get_position (struct cdplusg_null_audio_context *context)
+{
+  // past the end of the song time just goes on, as with PortAudio
+  int is_running_on = cdplusg_null_audio_context_is_finished (context);
+
+  return cdplusg_playback_get_position (&context->playback, cdplusg_null_audio_get_stream_time (context), is_running_on);
+}
+
+void
+cdplusg_null_audio_context_seek (struct cdplusg_null_audio_context *context, unsigned int ms)
+{
+  cdplusg_playback_seek (&context->playback, ms);
+
+  // a device that completed at the end of the song has to be started again
+  pthread_mutex_lock (&context->mutex);
+
+  if (!context->is_active)
+  {
+    context->is_active = 1;
+    pthread_cond_signal (&context->condition);
+  }
+
+  pthread_mutex_unlock (&context->mutex);
+}
+
+void
+cdplusg_null_audio_context_set_tempo (struct cdplusg_null_audio_context *context, double tempo)
+{
+  double position = cdplusg_null_audio_context_get_position (context);
+
+  cdplusg_decoder_set_tempo (context->playback.decoder, tempo);
+  cdplusg_null_audio_context_seek (context, (unsigned int) (position * 1000 + 0.5));
+}
+
+void
+cdplusg_null_audio_context_set_pitch (struct cdplusg_null_audio_context *context, int semitones)
+{
+  double position = cdplusg_null_audio_context_get_position (context);
+
+  cdplusg_decoder_set_pitch (context->playback.decoder, semitones);
+  cdplusg_null_audio_context_seek (context, (unsigned int) (position * 1000 + 0.5));
+}
+
+void
+cdplusg_null_audio_context_set_vocal_reduction (struct cdplusg_null_audio_context *context, double amount)
+{
+  cdplusg_decoder_set_vocal_reduction (context->playback.decoder, amount);
+}
+
+void
+cdplusg_null_audio_context_restart (struct cdplusg_null_audio_context *context)
+{
+  cdplusg_null_audio_context_seek (context, 0);
+}
+
+void
+cdplusg_null_audio_context_pause (struct cdplusg_null_audio_context *context)
+{
+  pthread_mutex_lock (&context->mutex);
+  context->is_playing = 0;
+  pthread_mutex_unlock (&context->mutex);
+}
+
+void
+cdplusg_null_audio_context_resume (struct cdplusg_null_audio_context *context)
+{
+  pthread_mutex_lock (&context->mutex);
+  context->is_playing = 1;
+  pthread_cond_signal (&context->condition);
+  pthread_mutex_unlock (&context->mutex);
+}
+
+void
+cdplusg_null_audio_context_toggle_playback (struct cdplusg_null_audio_context *context)
+{
+  pthread_mutex_lock (&context->mutex);
+  context->is_playing = !context->is_playing;
+  pthread_cond_signal (&context->condition);
+  pthread_mutex_unlock (&context->mutex);
+}
+
+int
+cdplusg_null_audio_context_is_finished (struct cdplusg_null_audio_context *context)
+{
+  pthread_mutex_lock (&context->mutex);
+  int is_finished = !context->is_active;
+  pthread_mutex_unlock (&context->mutex);
+
+  return is_finished;
+}
+
+void
+cdplusg_null_audio_context_get_statistics (struct cdplusg_null_audio_context *context,
+    struct cdplusg_null_audio_statistics *statistics)
+{
+  pthread_mutex_lock (&context->mutex);
+  *statistics = context->statistics;
+  pthread_mutex_unlock (&context->mutex);
+}
+
+void
+cdplusg_null_audio_context_destroy (struct cdplusg_null_audio_context *context)
+{
+  if (context == NULL)
+    return;
+
+  pthread_mutex_lock (&context->mutex);
+  context->is_shutting_down = 1;
+  pthread_cond_signal (&context->condition);
+  pthread_mutex_unlock (&context->mutex);
+
+  pthread_join (context->thread, NULL);
+
+  if (context->wav_file)
+  {
+    int success = cdplusg_null_audio_write_wav_header (context->wav_file, context->playback.sample_rate,
+                    context->wav_frame_count);
+
+    if (fclose (context->wav_file) != 0 || !success)
+      fprintf (stderr, "%s: debug: error finishing wav file: %s\n", PROGNAME (), strerror (errno));
+  }
+
+  pthread_cond_destroy (&context->condition);
+  pthread_mutex_destroy (&context->mutex);
+
+  free (context->wav_buffer);
+  free (context->buffer);
+  cdplusg_playback_finalize (&context->playback);
+  free (context);
+}
+
+static void *
+cdplusg_null_audio_backend_open (const char *audio_filename, double tempo, int semitones, const void *options)
+{
+  return cdplusg_null_audio_context_initialize (audio_filename, tempo, semitones,
+           (const struct cdplusg_null_audio_options *) options);
+}
+
+static void
+cdplusg_null_audio_backend_start (void *context)
+{
+  cdplusg_null_audio_context_resume ((struct cdplusg_null_audio_context *) context);
+}
+
+static void
+cdplusg_null_audio_backend_pause (void *context)
+{
+  cdplusg_null_audio_context_pause ((struct cdplusg_null_audio_context *) context);
+}
+
+static double
+cdplusg_null_audio_backend_get_position (void *context)
+{
+  return cdplusg_null_audio_context_get_position ((struct cdplusg_null_audio_context *) context);
+}
+
+static void
+cdplusg_null_audio_backend_seek (void *context, unsigned int ms)
+{
+  cdplusg_null_audio_context_seek ((struct cdplusg_null_audio_context *) context, ms);
+}
+
+static void
+cdplusg_null_audio_backend_set_tempo (void *context, double tempo)
+{
+  cdplusg_null_audio_context_set_tempo ((struct cdplusg_null_audio_context *) context, tempo);
+}
+
+static void
+cdplusg_null_audio_backend_set_pitch (void *context, int semitones)
+{
+  cdplusg_null_audio_context_set_pitch ((struct cdplusg_null_audio_context *) context, semitones);
+}
+
+static void
+cdplusg_null_audio_backend_set_vocal_reduction (void *context, double amount)
+{
+  cdplusg_null_audio_context_set_vocal_reduction ((struct cdplusg_null_audio_context *) context, amount);
+}
+
+static int
+cdplusg_null_audio_backend_is_finished (void *context)
+{
+  return cdplusg_null_audio_context_is_finished ((struct cdplusg_null_audio_context *) context);
+}
+
+static void
+cdplusg_null_audio_backend_destroy (void *context)
+{
+  cdplusg_null_audio_context_destroy ((struct cdplusg_null_audio_context *) context);
+}
+
+const struct cdplusg_audio_backend cdplusg_null_audio_backend =
+{
+  "null",
+  cdplusg_null_audio_backend_open,
+  cdplusg_null_audio_backend_start,
+  cdplusg_null_audio_backend_pause,
+  cdplusg_null_audio_backend_get_position,
+  cdplusg_null_audio_backend_seek,
+  cdplusg_null_audio_backend_set_tempo,
+  cdplusg_null_audio_backend_set_pitch,
+  cdplusg_null_audio_backend_set_vocal_reduction,
+  cdplusg_null_audio_backend_is_finished,
+  cdplusg_null_audio_backend_destroy
+};
@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "playback.h"
+
+#ifdef __GLIBC__
+extern char *program_invocation_short_name;
+#define PROGNAME() program_invocation_short_name
+#else
+#define PROGNAME() getprogname ()
+#endif
+
+int
+cdplusg_playback_initialize (struct cdplusg_playback *playback, const char *audio_filename, double tempo, int semitones)
+{
+  fprintf (stderr, "%s: debug: attempting to open file '%s'\n", PROGNAME (), audio_filename);
+
+  // decoding continues on the decoder's own thread, this only waits for the first few frames
+  playback->decoder = cdplusg_decoder_new (audio_filename, tempo, semitones);
+
+  if (playback->decoder == NULL)
+    return 0;
+
+  fprintf (stderr, "%s: debug: successfully opened file '%s'\n", PROGNAME (), audio_filename);
+
+  if (cdplusg_decoder_is_finished (playback->decoder))
+  {
+    fprintf (stderr,
+        "%s: debug: audio file has no contents, continuing without audio\n", PROGNAME ());
+    cdplusg_decoder_free (playback->decoder);
+    return 0;
+  }
+
+  playback->sample_rate = cdplusg_decoder_get_sample_rate (playback->decoder);
+
+  atomic_init (&playback->seek_count, 0);
+  atomic_init (&playback->seek_frame, 0);
+  atomic_init (&playback->timing_sequence, 0);
+  atomic_init (&playback->start_frame, 0);
+  atomic_init (&playback->end_frame, 0);
+  atomic_init (&playback->segment_frame, 0);
+  atomic_init (&playback->dac_time, 0);
+  atomic_init (&playback->tempo, 1);
+  atomic_init (&playback->timing_seek_count, 0);
+
+  playback->previous_end_frame = 0;
+  playback->current_segment_frame = 0;
+
+  return 1;
+}
+
+void
+cdplusg_playback_finalize (struct cdplusg_playback *playback)
+{
+  cdplusg_decoder_free (playback->decoder);
+}
+
+static void
+cdplusg_playback_publish_timing (struct cdplusg_playback *playback, unsigned int seek_count,
+    uint64_t start_frame, uint64_t end_frame, double tempo, double dac_time)
+{
+  unsigned int sequence = atomic_load_explicit (&playback->timing_sequence, memory_order_relaxed);
+
+  atomic_store_explicit (&playback->timing_sequence, sequence + 1, memory_order_relaxed);
+  atomic_thread_fence (memory_order_release);
+
+  atomic_store_explicit (&playback->start_frame, start_frame, memory_order_relaxed);
+  atomic_store_explicit (&playback->end_frame, end_frame, memory_order_relaxed);
+  atomic_store_explicit (&playback->segment_frame, playback->current_segment_frame, memory_order_relaxed);
+  atomic_store_explicit (&playback->dac_time, dac_time, memory_order_relaxed);
+  atomic_store_explicit (&playback->tempo, tempo, memory_order_relaxed);
+  atomic_store_explicit (&playback->timing_seek_count, seek_count, memory_order_relaxed);
+
+  atomic_store_explicit (&playback->timing_sequence, sequence + 2, memory_order_release);
+}
+
+size_t
+cdplusg_playback_fill (struct cdplusg_playback *playback, short *samples, size_t frame_count, double dac_time)
+{
+  // a seek counted here has already been handed to the decoder, so the read reflects it
+  unsigned int seek_count = atomic_load_explicit (&playback->seek_count, memory_order_acquire);
+
+  uint64_t start_frame;
+  uint64_t end_frame;
+  double tempo;
+
+  size_t read_count = cdplusg_decoder_read (playback->decoder, samples, frame_count);
+  cdplusg_decoder_get_read_frames (playback->decoder, &start_frame, &end_frame, &tempo);
+
+  if (start_frame != playback->previous_end_frame)
+    playback->current_segment_frame = start_frame;
+
+  playback->previous_end_frame = end_frame;
+
+  cdplusg_playback_publish_timing (playback, seek_count, start_frame, end_frame, tempo, dac_time);
+
+  // the decoder fell behind or the file ended, either way the rest of the buffer is silence
+  memset (&samples[2 * read_count], 0x00, 2 * sizeof (short) * (frame_count - read_count));
+
+  return read_count;
+}
+
+double
+cdplusg_playback_get_position (struct cdplusg_playback *playback, double stream_time, int is_running_on)
+{
+  unsigned int sequence;
+  uint64_t start_frame;
+  uint64_t end_frame;
+  uint64_t segment_frame;
+  double dac_time;
+  double tempo;
+  unsigned int timing_seek_count;
+
+  do
+  {
+    sequence = atomic_load_explicit (&playback->timing_sequence, memory_order_acquire);
+
+    start_frame = atomic_load_explicit (&playback->start_frame, memory_order_relaxed);
+    end_frame = atomic_load_explicit (&playback->end_frame, memory_order_relaxed);
+    segment_frame = atomic_load_explicit (&playback->segment_frame, memory_order_relaxed);
+    dac_time = atomic_load_explicit (&playback->dac_time, memory_order_relaxed);
+    tempo = atomic_load_explicit (&playback->tempo, memory_order_relaxed);
+    timing_seek_count = atomic_load_explicit (&playback->timing_seek_count, memory_order_relaxed);
+
+    atomic_thread_fence (memory_order_acquire);
+  }
+  while ((sequence & 1) || sequence != atomic_load_explicit (&playback->timing_sequence, memory_order_relaxed));
+
+  // nothing played yet
+  if (sequence == 0)
+    return (double) cdplusg_decoder_get_position (playback->decoder) / playback->sample_rate;
+
+  // no buffer since the last seek, but that is where playback is headed
+  if (timing_seek_count != atomic_load_explicit (&playback->seek_count, memory_order_acquire))
+    return (double) atomic_load_explicit (&playback->seek_frame, memory_order_relaxed) / playback->sample_rate;
+
+  // frames leave the DAC at the song's rate, each one tempo frames of the song
+  double frame = start_frame + (stream_time - dac_time) * tempo * playback->sample_rate;
+
+  // the audio from before a seek may still be on its way to the DAC, but the song is
+  // already at the seek position
+  if (frame < segment_frame)
+    frame = segment_frame;
+
+  if (frame > end_frame && !is_running_on)
+    frame = end_frame;
+
+  return frame / playback->sample_rate;
+}
+
+void
+cdplusg_playback_seek (struct cdplusg_playback *playback, unsigned int ms)
+{
+  uint64_t frame = (uint64_t) ms * playback->sample_rate / 1000;
+
+  // the decoder goes first, so a device that sees the new count also reads after the seek
+  cdplusg_decoder_seek (playback->decoder, frame);
+  atomic_store_explicit (&playback->seek_frame, frame, memory_order_relaxed);
+  atomic_fetch_add_explicit (&playback->seek_count, 1, memory_order_release);
+}
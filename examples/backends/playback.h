@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "decoder.h"
+
+/** What the audio backends share: the decoder, read buffer by buffer from the device's
+ * callback or thread, and the position of the audio being heard, worked out from when the
+ * last buffer reaches the DAC on the device's stream clock.
+ *
+ * cdplusg_playback_fill belongs to the device; the rest is safe from other threads,
+ * seeking from one at a time.
+ **/
+struct cdplusg_playback
+{
+  struct cdplusg_decoder *decoder;
+  int sample_rate;
+
+  // seeks requested so far and the frame of the last one
+  _Atomic unsigned int seek_count;
+  _Atomic uint64_t seek_frame;
+
+  // Where the last buffer sits on the stream clock: its first frame reaches the DAC at
+  // dac_time and it holds the frames start_frame to end_frame of the file, stretched at
+  // tempo, which has played without a jump since segment_frame; seek_count is the seeks it
+  // reflects. Written under a sequence lock, so the device never waits and readers retry on
+  // the rare torn read.
+  _Atomic unsigned int timing_sequence;
+  _Atomic uint64_t start_frame;
+  _Atomic uint64_t end_frame;
+  _Atomic uint64_t segment_frame;
+  _Atomic double dac_time;
+  _Atomic double tempo;
+  _Atomic unsigned int timing_seek_count;
+
+  // only touched by the device
+  uint64_t previous_end_frame;
+  uint64_t current_segment_frame;
+};
+
+/** Opens the decoder at the given tempo and key, printing what happens as the backends do.
+ * Returns 0 on failure.
+ **/
+int cdplusg_playback_initialize (struct cdplusg_playback *playback, const char *audio_filename, double tempo, int semitones);
+void cdplusg_playback_finalize (struct cdplusg_playback *playback);
+
+/** Fills a device buffer of frame_count frames, whose first frame reaches the DAC at
+ * dac_time on the stream clock, and returns how many frames came from the decoder; the
+ * rest is silence.
+ **/
+size_t cdplusg_playback_fill (struct cdplusg_playback *playback, short *samples, size_t frame_count, double dac_time);
+
+/** Position of the audio leaving the DAC at stream_time, in seconds of the song. It stops
+ * at the end of the last buffer, as after a pause or an underrun, unless is_running_on is
+ * set, for time that goes on once the song is over.
+ **/
+double cdplusg_playback_get_position (struct cdplusg_playback *playback, double stream_time, int is_running_on);
+
+/** Seeks the decoder; the position reports the target until a buffer from there is filled. **/
+void cdplusg_playback_seek (struct cdplusg_playback *playback, unsigned int ms);
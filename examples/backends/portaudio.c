@@ -1,4 +1,6 @@
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -8,8 +10,9 @@
 
 #include <portaudio.h>
 
-#define MINIMP3_IMPLEMENTATION
-#include <minimp3_ex.h>
+#include <cdplusg/portaudio.h>
+
+#include "playback.h"
 
 #ifdef __GLIBC__
 extern char *program_invocation_short_name;
@@ -21,13 +24,9 @@ extern char *program_invocation_short_name;
 struct cdplusg_portaudio_context
 {
   PaStream *stream;
+  struct cdplusg_playback playback;
 
-  short *audio_bytes;
-  unsigned long audio_size;
-  unsigned long audio_head;
-
-  double scale_factor;
-  int samples_per_second;
+  double output_latency;
 
   int is_playing;
 };
@@ -37,68 +36,41 @@ cdplusg_portaudio_callback (const void *data, void *output, unsigned long frame_
                               const PaStreamCallbackTimeInfo *time_info,
                               PaStreamCallbackFlags callback_flags, void *user_data)
 {
-  (void) time_info;
   (void) callback_flags;
   (void) data;
 
   struct cdplusg_portaudio_context *info = (struct cdplusg_portaudio_context *) user_data;
 
-  unsigned long samples_to_tx = frame_count * 2;
-  unsigned long bytes_to_tx = samples_to_tx * 2;
+  // some host APIs leave the DAC time at zero, then the reported latency has to do
+  double dac_time = time_info->outputBufferDacTime;
 
-  if (samples_to_tx + info->audio_head <= info->audio_size)
-  {
-    memcpy (output, &info->audio_bytes[info->audio_head], bytes_to_tx);
-    info->audio_head += samples_to_tx;
-    return 0;
-  }
+  if (dac_time == 0)
+    dac_time = time_info->currentTime + info->output_latency;
+
+  size_t read_count = cdplusg_playback_fill (&info->playback, (short *) output, frame_count, dac_time);
+
+  if (read_count == frame_count)
+    return paContinue;
 
-  memset (output, 0x00, bytes_to_tx);
-  memcpy (output, &info->audio_bytes[info->audio_head], 2 * (info->audio_size - info->audio_head));
-  info->audio_head = info->audio_size;
-  return paComplete;
+  return cdplusg_decoder_is_finished (info->playback.decoder) ? paComplete : paContinue;
 }
 
 struct cdplusg_portaudio_context *
-cdplusg_portaudio_context_initialize (const char *audio_filename, double scale_factor)
+cdplusg_portaudio_context_initialize (const char *audio_filename, double tempo, int semitones)
 {
-  fprintf (stderr, "%s: debug: attempting to open file '%s'\n", PROGNAME (), audio_filename);
-  mp3dec_t mp3_decoder;
-  mp3dec_file_info_t mp3_info;
-
-  int mp3_decoder_retval = mp3dec_load (&mp3_decoder, audio_filename, &mp3_info, NULL, NULL);
+  struct cdplusg_portaudio_context *context =
+    (struct cdplusg_portaudio_context *) calloc (1, sizeof (struct cdplusg_portaudio_context));
 
-  if (mp3_decoder_retval == MP3D_E_IOERROR)
-  {
-    fprintf (stderr, "%s: debug: could not open file '%s': %s\n", PROGNAME (),
-               audio_filename, strerror (errno));
+  if (context == NULL)
     return NULL;
-  }
-  else if (mp3_decoder_retval)
+
+  if (!cdplusg_playback_initialize (&context->playback, audio_filename, tempo, semitones))
   {
-    fprintf (stderr, "%s: debug: something went wrong decoding the audio file '%s'\n",
-               PROGNAME (), audio_filename);
+    free (context);
     return NULL;
   }
-  
-  fprintf (stderr, "%s: debug: successfully opened file '%s'\n", PROGNAME (), audio_filename);
-
-  struct cdplusg_portaudio_context *context =
-    (struct cdplusg_portaudio_context *) calloc (1, sizeof (struct cdplusg_portaudio_context));  
 
   context->is_playing = 0;
-  context->audio_bytes = mp3_info.buffer;
-  mp3_info.buffer = NULL;  // tx ownership
-
-  context->audio_size = mp3_info.samples;
-  context->scale_factor = scale_factor;
-
-  if (context->audio_size == 0)
-  {
-    fprintf (stderr,
-        "%s: debug: audio file has no contents, continuing without audio\n", PROGNAME ());
-    goto error_pre_initialize;
-  }
 
   // workaround to temporarily disable output to stderr
   fflush (stderr);
@@ -117,14 +89,17 @@ cdplusg_portaudio_context_initialize (const char *audio_filename, double scale_f
   if (error != paNoError)
     goto error_post_initialize;
 
-  error = Pa_OpenDefaultStream (&context->stream, 0, 2, paInt16, scale_factor * mp3_info.hz,
+  error = Pa_OpenDefaultStream (&context->stream, 0, 2, paInt16, context->playback.sample_rate,
             paFramesPerBufferUnspecified, cdplusg_portaudio_callback, context);
 
-  context->samples_per_second = 2 * mp3_info.hz;
-
   if (error != paNoError)
     goto error_post_initialize;
 
+  const PaStreamInfo *stream_info = Pa_GetStreamInfo (context->stream);
+
+  if (stream_info != NULL)
+    context->output_latency = stream_info->outputLatency;
+
   error = Pa_StartStream (context->stream);
 
   if (error == paNoError)
@@ -140,9 +115,7 @@ error_post_initialize:
              PROGNAME (), Pa_GetErrorText (error));
   fprintf (stderr, "%s: debug: continuing with no audio\n", PROGNAME ());
   Pa_Terminate ();
-error_pre_initialize:
-  free (context->audio_bytes);
-  context->audio_size = 0;
+  cdplusg_playback_finalize (&context->playback);
   free (context);
   return NULL;
 }
@@ -150,13 +123,61 @@ error_pre_initialize:
 unsigned int
 cdplusg_portaudio_context_get_elapsed_time_ms (struct cdplusg_portaudio_context *context)
 {
-  return (unsigned int) (context->audio_head * 1000 / (context->scale_factor * context->samples_per_second));
+  return (unsigned int) (cdplusg_portaudio_context_get_position (context) * 1000);
+}
+
+double
+cdplusg_portaudio_context_get_position (struct cdplusg_portaudio_context *context)
+{
+  // the last buffer has not necessarily been followed by another one, because of a pause or
+  // an underrun, except once the song is over, then time just goes on
+  int is_running_on = context->is_playing && cdplusg_decoder_is_finished (context->playback.decoder);
+
+  return cdplusg_playback_get_position (&context->playback, Pa_GetStreamTime (context->stream), is_running_on);
+}
+
+void
+cdplusg_portaudio_context_seek (struct cdplusg_portaudio_context *context, unsigned int ms)
+{
+  cdplusg_playback_seek (&context->playback, ms);
+
+  // a stream that completed at the end of the song has to be started again
+  if (context->is_playing && Pa_IsStreamActive (context->stream) != 1)
+  {
+    Pa_StopStream (context->stream);
+    Pa_StartStream (context->stream);
+  }
+}
+
+void
+cdplusg_portaudio_context_set_tempo (struct cdplusg_portaudio_context *context, double tempo)
+{
+  double position = cdplusg_portaudio_context_get_position (context);
+
+  // the tempo takes effect from the seek, everything before it was stretched at the old one
+  cdplusg_decoder_set_tempo (context->playback.decoder, tempo);
+  cdplusg_portaudio_context_seek (context, (unsigned int) (position * 1000 + 0.5));
+}
+
+void
+cdplusg_portaudio_context_set_pitch (struct cdplusg_portaudio_context *context, int semitones)
+{
+  double position = cdplusg_portaudio_context_get_position (context);
+
+  cdplusg_decoder_set_pitch (context->playback.decoder, semitones);
+  cdplusg_portaudio_context_seek (context, (unsigned int) (position * 1000 + 0.5));
+}
+
+void
+cdplusg_portaudio_context_set_vocal_reduction (struct cdplusg_portaudio_context *context, double amount)
+{
+  cdplusg_decoder_set_vocal_reduction (context->playback.decoder, amount);
 }
 
 void
 cdplusg_portaudio_context_restart (struct cdplusg_portaudio_context *context)
 {
-  context->audio_head = 0;
+  cdplusg_portaudio_context_seek (context, 0);
 }
 
 void
@@ -195,7 +216,84 @@ cdplusg_portaudio_context_destroy (struct cdplusg_portaudio_context *context)
   {
     Pa_AbortStream (context->stream);
     Pa_Terminate ();
-    free (context->audio_bytes);
+    cdplusg_playback_finalize (&context->playback);
     free (context);
   }
 }
+
+static void *
+cdplusg_portaudio_backend_open (const char *audio_filename, double tempo, int semitones, const void *options)
+{
+  (void) options;
+
+  return cdplusg_portaudio_context_initialize (audio_filename, tempo, semitones);
+}
+
+static void
+cdplusg_portaudio_backend_start (void *context)
+{
+  cdplusg_portaudio_context_resume ((struct cdplusg_portaudio_context *) context);
+}
+
+static void
+cdplusg_portaudio_backend_pause (void *context)
+{
+  cdplusg_portaudio_context_pause ((struct cdplusg_portaudio_context *) context);
+}
+
+static double
+cdplusg_portaudio_backend_get_position (void *context)
+{
+  return cdplusg_portaudio_context_get_position ((struct cdplusg_portaudio_context *) context);
+}
+
+static void
+cdplusg_portaudio_backend_seek (void *context, unsigned int ms)
+{
+  cdplusg_portaudio_context_seek ((struct cdplusg_portaudio_context *) context, ms);
+}
+
+static void
+cdplusg_portaudio_backend_set_tempo (void *context, double tempo)
+{
+  cdplusg_portaudio_context_set_tempo ((struct cdplusg_portaudio_context *) context, tempo);
+}
+
+static void
+cdplusg_portaudio_backend_set_pitch (void *context, int semitones)
+{
+  cdplusg_portaudio_context_set_pitch ((struct cdplusg_portaudio_context *) context, semitones);
+}
+
+static void
+cdplusg_portaudio_backend_set_vocal_reduction (void *context, double amount)
+{
+  cdplusg_portaudio_context_set_vocal_reduction ((struct cdplusg_portaudio_context *) context, amount);
+}
+
+static int
+cdplusg_portaudio_backend_is_finished (void *context)
+{
+  return cdplusg_decoder_is_finished (((struct cdplusg_portaudio_context *) context)->playback.decoder);
+}
+
+static void
+cdplusg_portaudio_backend_destroy (void *context)
+{
+  cdplusg_portaudio_context_destroy ((struct cdplusg_portaudio_context *) context);
+}
+
+const struct cdplusg_audio_backend cdplusg_portaudio_backend =
+{
+  "portaudio",
+  cdplusg_portaudio_backend_open,
+  cdplusg_portaudio_backend_start,
+  cdplusg_portaudio_backend_pause,
+  cdplusg_portaudio_backend_get_position,
+  cdplusg_portaudio_backend_seek,
+  cdplusg_portaudio_backend_set_tempo,
+  cdplusg_portaudio_backend_set_pitch,
+  cdplusg_portaudio_backend_set_vocal_reduction,
+  cdplusg_portaudio_backend_is_finished,
+  cdplusg_portaudio_backend_destroy
+};
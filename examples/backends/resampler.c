@@ -0,0 +1,298 @@
+#define _DEFAULT_SOURCE
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "resampler.h"
+
+#define CDPLUSG_RESAMPLER_TAPS 16
+#define CDPLUSG_RESAMPLER_PHASES 256
+
+// input frames before the one an output frame falls on or after that the filter reaches
+#define CDPLUSG_RESAMPLER_HISTORY (CDPLUSG_RESAMPLER_TAPS / 2 - 1)
+
+// the passband, as a fraction of the lower of the input and output Nyquist frequencies
+#define CDPLUSG_RESAMPLER_CUTOFF 0.9
+
+// coefficients are Q15, each phase summing to exactly one so that nothing is amplified
+#define CDPLUSG_RESAMPLER_COEFFICIENT_BITS 15
+
+// room for a decoder chunk or two without growing
+#define CDPLUSG_RESAMPLER_INITIAL_CAPACITY 16384
+
+struct cdplusg_resampler
+{
+  double ratio;
+  short coefficients [CDPLUSG_RESAMPLER_PHASES][CDPLUSG_RESAMPLER_TAPS];
+
+  // the input still needed, one plane per channel so that the taps are contiguous
+  short *left;
+  short *right;
+  size_t capacity;
+  size_t count;
+
+  // of the next output frame, relative to the input held
+  double position;
+
+  // once finished the input is padded with silence, and ends at end_count
+  int is_finished;
+  size_t end_count;
+};
+
+static void
+cdplusg_resampler_design (struct cdplusg_resampler *resampler)
+{
+  double cutoff = CDPLUSG_RESAMPLER_CUTOFF * (resampler->ratio > 1 ? 1 / resampler->ratio : 1);
+  double half_width = CDPLUSG_RESAMPLER_TAPS / 2;
+
+  for (int phase = 0; phase < CDPLUSG_RESAMPLER_PHASES; phase++)
+  {
+    double taps [CDPLUSG_RESAMPLER_TAPS];
+    double sum = 0;
+
+    for (int i = 0; i < CDPLUSG_RESAMPLER_TAPS; i++)
+    {
+      // distance of the tap from the output frame, windowed with a Blackman window
+      double t = i - CDPLUSG_RESAMPLER_HISTORY - (double) phase / CDPLUSG_RESAMPLER_PHASES;
+      double x = M_PI * cutoff * t;
+      double window = 0.42 + 0.5 * cos (M_PI * t / half_width) + 0.08 * cos (2 * M_PI * t / half_width);
+
+      taps[i] = (x == 0 ? 1 : sin (x) / x) * (fabs (t) < half_width ? window : 0);
+      sum += taps[i];
+    }
+
+    // rounding leaves the sum a little off, which goes to the largest tap
+    int total = 0;
+    int largest = 0;
+
+    for (int i = 0; i < CDPLUSG_RESAMPLER_TAPS; i++)
+    {
+      resampler->coefficients[phase][i] = (short) lrint (taps[i] / sum * (1 << CDPLUSG_RESAMPLER_COEFFICIENT_BITS));
+      total += resampler->coefficients[phase][i];
+
+      if (taps[i] > taps[largest])
+        largest = i;
+    }
+
+    resampler->coefficients[phase][largest] += (1 << CDPLUSG_RESAMPLER_COEFFICIENT_BITS) - total;
+  }
+}
+
+struct cdplusg_resampler *
+cdplusg_resampler_new (void)
+{
+  struct cdplusg_resampler *resampler = (struct cdplusg_resampler *) calloc (1, sizeof (struct cdplusg_resampler));
+
+  if (resampler == NULL)
+    return NULL;
+
+  resampler->capacity = CDPLUSG_RESAMPLER_INITIAL_CAPACITY;
+  resampler->left = (short *) malloc (sizeof (short) * resampler->capacity);
+  resampler->right = (short *) malloc (sizeof (short) * resampler->capacity);
+
+  if (resampler->left == NULL || resampler->right == NULL)
+  {
+    cdplusg_resampler_free (resampler);
+    return NULL;
+  }
+
+  cdplusg_resampler_reset (resampler, 1);
+
+  return resampler;
+}
+
+void
+cdplusg_resampler_free (struct cdplusg_resampler *resampler)
+{
+  if (resampler == NULL)
+    return;
+
+  free (resampler->left);
+  free (resampler->right);
+  free (resampler);
+}
+
+void
+cdplusg_resampler_reset (struct cdplusg_resampler *resampler, double ratio)
+{
+  if (ratio < CDPLUSG_RESAMPLER_MIN_RATIO)
+    ratio = CDPLUSG_RESAMPLER_MIN_RATIO;
+  else if (ratio > CDPLUSG_RESAMPLER_MAX_RATIO)
+    ratio = CDPLUSG_RESAMPLER_MAX_RATIO;
+
+  if (ratio != resampler->ratio)
+  {
+    resampler->ratio = ratio;
+    cdplusg_resampler_design (resampler);
+  }
+
+  // silence before the start, so that the first output frame is the first input frame
+  memset (resampler->left, 0x00, sizeof (short) * CDPLUSG_RESAMPLER_HISTORY);
+  memset (resampler->right, 0x00, sizeof (short) * CDPLUSG_RESAMPLER_HISTORY);
+
+  resampler->count = CDPLUSG_RESAMPLER_HISTORY;
+  resampler->position = CDPLUSG_RESAMPLER_HISTORY;
+  resampler->is_finished = 0;
+  resampler->end_count = 0;
+}
+
+// Makes room for frame_count more frames of input, dropping what the filter has passed.
+static int
+cdplusg_resampler_reserve (struct cdplusg_resampler *resampler, size_t frame_count)
+{
+  size_t frame = (size_t) resampler->position;
+  size_t used_count = frame > CDPLUSG_RESAMPLER_HISTORY ? frame - CDPLUSG_RESAMPLER_HISTORY : 0;
+
+  if (used_count > resampler->count)
+    used_count = resampler->count;
+
+  if (used_count > 0)
+  {
+    resampler->count -= used_count;
+
+    memmove (resampler->left, &resampler->left[used_count], sizeof (short) * resampler->count);
+    memmove (resampler->right, &resampler->right[used_count], sizeof (short) * resampler->count);
+
+    resampler->position -= used_count;
+  }
+
+  if (resampler->count + frame_count <= resampler->capacity)
+    return 1;
+
+  size_t capacity = 2 * (resampler->count + frame_count);
+  short *left = (short *) realloc (resampler->left, sizeof (short) * capacity);
+
+  if (left == NULL)
+    return 0;
+
+  resampler->left = left;
+
+  short *right = (short *) realloc (resampler->right, sizeof (short) * capacity);
+
+  if (right == NULL)
+    return 0;
+
+  resampler->right = right;
+  resampler->capacity = capacity;
+
+  return 1;
+}
+
+int
+cdplusg_resampler_write (struct cdplusg_resampler *resampler, const short *samples, size_t frame_count)
+{
+  if (!cdplusg_resampler_reserve (resampler, frame_count))
+    return 0;
+
+  short *left = &resampler->left[resampler->count];
+  short *right = &resampler->right[resampler->count];
+
+  for (size_t i = 0; i < frame_count; i++)
+  {
+    left[i] = samples[2 * i + 0];
+    right[i] = samples[2 * i + 1];
+  }
+
+  resampler->count += frame_count;
+
+  return 1;
+}
+
+void
+cdplusg_resampler_finish (struct cdplusg_resampler *resampler)
+{
+  if (resampler->is_finished)
+    return;
+
+  size_t padding_count = CDPLUSG_RESAMPLER_TAPS / 2 + 1;
+
+  resampler->is_finished = 1;
+
+  if (!cdplusg_resampler_reserve (resampler, padding_count))
+  {
+    // the last few frames are lost, rather than read past the end
+    resampler->end_count = 0;
+    return;
+  }
+
+  resampler->end_count = resampler->count;
+
+  memset (&resampler->left[resampler->count], 0x00, sizeof (short) * padding_count);
+  memset (&resampler->right[resampler->count], 0x00, sizeof (short) * padding_count);
+
+  resampler->count += padding_count;
+}
+
+// Filters one output frame out of the taps starting at left and right.
+static void
+cdplusg_resampler_filter (const short *left, const short *right, const short *coefficients, short *output)
+{
+#if defined(__SSE2__)
+  __m128i low = _mm_loadu_si128 ((const __m128i *) &coefficients[0]);
+  __m128i high = _mm_loadu_si128 ((const __m128i *) &coefficients[8]);
+
+  __m128i left_sums = _mm_add_epi32 (_mm_madd_epi16 (_mm_loadu_si128 ((const __m128i *) &left[0]), low),
+                        _mm_madd_epi16 (_mm_loadu_si128 ((const __m128i *) &left[8]), high));
+  __m128i right_sums = _mm_add_epi32 (_mm_madd_epi16 (_mm_loadu_si128 ((const __m128i *) &right[0]), low),
+                         _mm_madd_epi16 (_mm_loadu_si128 ((const __m128i *) &right[8]), high));
+
+  // both channels are summed across at once, ending up as left, right, left, right
+  __m128i sums = _mm_add_epi32 (_mm_unpacklo_epi32 (left_sums, right_sums),
+                   _mm_unpackhi_epi32 (left_sums, right_sums));
+
+  sums = _mm_add_epi32 (sums, _mm_shuffle_epi32 (sums, _MM_SHUFFLE (1, 0, 3, 2)));
+  sums = _mm_add_epi32 (sums, _mm_set1_epi32 (1 << (CDPLUSG_RESAMPLER_COEFFICIENT_BITS - 1)));
+  sums = _mm_srai_epi32 (sums, CDPLUSG_RESAMPLER_COEFFICIENT_BITS);
+
+  int32_t frame = _mm_cvtsi128_si32 (_mm_packs_epi32 (sums, sums));
+  memcpy (output, &frame, sizeof (frame));
+#else
+  const short *channels [2] = { left, right };
+
+  for (int channel = 0; channel < 2; channel++)
+  {
+    int32_t sum = 1 << (CDPLUSG_RESAMPLER_COEFFICIENT_BITS - 1);
+
+    for (int i = 0; i < CDPLUSG_RESAMPLER_TAPS; i++)
+      sum += channels[channel][i] * coefficients[i];
+
+    sum >>= CDPLUSG_RESAMPLER_COEFFICIENT_BITS;
+
+    // the filter rings a little past a full-scale edge
+    output[channel] = (short) (sum > INT16_MAX ? INT16_MAX : sum < INT16_MIN ? INT16_MIN : sum);
+  }
+#endif
+}
+
+size_t
+cdplusg_resampler_read (struct cdplusg_resampler *resampler, short *samples, size_t frame_count)
+{
+  size_t read_count = 0;
+
+  for (; read_count < frame_count; read_count++)
+  {
+    size_t frame = (size_t) resampler->position;
+
+    if (resampler->is_finished && frame >= resampler->end_count)
+      break;
+
+    if (frame + CDPLUSG_RESAMPLER_TAPS / 2 >= resampler->count)
+      break;
+
+    int phase = (int) ((resampler->position - frame) * CDPLUSG_RESAMPLER_PHASES);
+    size_t first = frame - CDPLUSG_RESAMPLER_HISTORY;
+
+    cdplusg_resampler_filter (&resampler->left[first], &resampler->right[first], resampler->coefficients[phase],
+        &samples[2 * read_count]);
+
+    resampler->position += resampler->ratio;
+  }
+
+  return read_count;
+}
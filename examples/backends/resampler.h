@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stddef.h>
+
+/** Changes the sample rate of interleaved 16-bit stereo audio by a ratio, with a 16-tap
+ * windowed-sinc filter in 256 phases that also keeps what would alias out of a rate going
+ * down. Used to play audio a ratio faster or slower than it was stretched to, which moves
+ * its pitch by that ratio.
+ *
+ * Like the time stretcher, input is written and output read in any amounts; output frame n
+ * is input frame n * ratio.
+ **/
+struct cdplusg_resampler;
+
+/** The ratio goes from half to double, an octave either way. **/
+#define CDPLUSG_RESAMPLER_MIN_RATIO 0.5
+#define CDPLUSG_RESAMPLER_MAX_RATIO 2.0
+
+struct cdplusg_resampler *cdplusg_resampler_new (void);
+void cdplusg_resampler_free (struct cdplusg_resampler *resampler);
+
+/** Drops everything held, to start over at the given ratio of input frames to output
+ * frames; the filter is designed again only when the ratio changes.
+ **/
+void cdplusg_resampler_reset (struct cdplusg_resampler *resampler, double ratio);
+
+/** Returns 0 if the memory for the frames could not be had. **/
+int cdplusg_resampler_write (struct cdplusg_resampler *resampler, const short *samples, size_t frame_count);
+void cdplusg_resampler_finish (struct cdplusg_resampler *resampler);
+size_t cdplusg_resampler_read (struct cdplusg_resampler *resampler, short *samples, size_t frame_count);
@@ -0,0 +1,148 @@
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ring_buffer.h"
+
+struct cdplusg_ring_buffer
+{
+  short *samples;
+  uint32_t mask;
+
+  // each index is stored by its own side only; the release store publishes the frames
+  // written, or the space freed, before it
+  _Atomic uint32_t write_index;
+  _Atomic uint32_t read_index;
+};
+
+struct cdplusg_ring_buffer *
+cdplusg_ring_buffer_new (size_t frame_capacity)
+{
+  if (frame_capacity == 0 || (frame_capacity & (frame_capacity - 1)) != 0 || frame_capacity > UINT32_C (1) << 31)
+    return NULL;
+
+  struct cdplusg_ring_buffer *ring = (struct cdplusg_ring_buffer *) calloc (1, sizeof (struct cdplusg_ring_buffer));
+
+  if (ring == NULL)
+    return NULL;
+
+  ring->samples = (short *) malloc (2 * frame_capacity * sizeof (short));
+
+  if (ring->samples == NULL)
+  {
+    free (ring);
+    return NULL;
+  }
+
+  ring->mask = frame_capacity - 1;
+  atomic_init (&ring->write_index, 0);
+  atomic_init (&ring->read_index, 0);
+
+  return ring;
+}
+
+void
+cdplusg_ring_buffer_free (struct cdplusg_ring_buffer *ring)
+{
+  if (ring)
+    free (ring->samples);
+
+  free (ring);
+}
+
+// Both copies are done in at most two pieces, split where the ring wraps around.
+static void
+cdplusg_ring_buffer_copy_in (struct cdplusg_ring_buffer *ring, uint32_t index, const short *samples,
+    size_t frame_count)
+{
+  size_t offset = index & ring->mask;
+  size_t first_count = ring->mask + 1 - offset;
+
+  if (first_count > frame_count)
+    first_count = frame_count;
+
+  memcpy (&ring->samples[2 * offset], samples, 2 * sizeof (short) * first_count);
+  memcpy (ring->samples, &samples[2 * first_count], 2 * sizeof (short) * (frame_count - first_count));
+}
+
+static void
+cdplusg_ring_buffer_copy_out (struct cdplusg_ring_buffer *ring, uint32_t index, short *samples,
+    size_t frame_count)
+{
+  size_t offset = index & ring->mask;
+  size_t first_count = ring->mask + 1 - offset;
+
+  if (first_count > frame_count)
+    first_count = frame_count;
+
+  memcpy (samples, &ring->samples[2 * offset], 2 * sizeof (short) * first_count);
+  memcpy (&samples[2 * first_count], ring->samples, 2 * sizeof (short) * (frame_count - first_count));
+}
+
+size_t
+cdplusg_ring_buffer_write (struct cdplusg_ring_buffer *ring, const short *samples, size_t frame_count)
+{
+  uint32_t write_index = atomic_load_explicit (&ring->write_index, memory_order_relaxed);
+  uint32_t read_index = atomic_load_explicit (&ring->read_index, memory_order_acquire);
+  size_t free_count = ring->mask + 1 - (uint32_t) (write_index - read_index);
+
+  if (frame_count > free_count)
+    frame_count = free_count;
+
+  cdplusg_ring_buffer_copy_in (ring, write_index, samples, frame_count);
+  atomic_store_explicit (&ring->write_index, write_index + (uint32_t) frame_count, memory_order_release);
+
+  return frame_count;
+}
+
+size_t
+cdplusg_ring_buffer_get_free (struct cdplusg_ring_buffer *ring)
+{
+  uint32_t write_index = atomic_load_explicit (&ring->write_index, memory_order_relaxed);
+  uint32_t read_index = atomic_load_explicit (&ring->read_index, memory_order_acquire);
+
+  return ring->mask + 1 - (uint32_t) (write_index - read_index);
+}
+
+uint32_t
+cdplusg_ring_buffer_get_write_index (struct cdplusg_ring_buffer *ring)
+{
+  return atomic_load_explicit (&ring->write_index, memory_order_relaxed);
+}
+
+size_t
+cdplusg_ring_buffer_read (struct cdplusg_ring_buffer *ring, short *samples, size_t frame_count)
+{
+  uint32_t read_index = atomic_load_explicit (&ring->read_index, memory_order_relaxed);
+  uint32_t write_index = atomic_load_explicit (&ring->write_index, memory_order_acquire);
+  size_t available = (uint32_t) (write_index - read_index);
+
+  if (frame_count > available)
+    frame_count = available;
+
+  cdplusg_ring_buffer_copy_out (ring, read_index, samples, frame_count);
+  atomic_store_explicit (&ring->read_index, read_index + (uint32_t) frame_count, memory_order_release);
+
+  return frame_count;
+}
+
+size_t
+cdplusg_ring_buffer_get_available (struct cdplusg_ring_buffer *ring)
+{
+  uint32_t read_index = atomic_load_explicit (&ring->read_index, memory_order_relaxed);
+  uint32_t write_index = atomic_load_explicit (&ring->write_index, memory_order_acquire);
+
+  return (uint32_t) (write_index - read_index);
+}
+
+uint32_t
+cdplusg_ring_buffer_get_read_index (struct cdplusg_ring_buffer *ring)
+{
+  return atomic_load_explicit (&ring->read_index, memory_order_relaxed);
+}
+
+void
+cdplusg_ring_buffer_skip_to (struct cdplusg_ring_buffer *ring, uint32_t index)
+{
+  atomic_store_explicit (&ring->read_index, index, memory_order_release);
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** A lock-free ring of interleaved 16-bit stereo frames for exactly one producer thread and
+ * one consumer thread. Neither side ever blocks or retries, so the consumer may run on a
+ * real-time audio thread. Indices are free-running 32-bit frame counts.
+ **/
+struct cdplusg_ring_buffer;
+
+/** frame_capacity must be a power of two. **/
+struct cdplusg_ring_buffer *cdplusg_ring_buffer_new (size_t frame_capacity);
+void cdplusg_ring_buffer_free (struct cdplusg_ring_buffer *ring);
+
+/** Producer side: copies as many frames as fit and returns how many that was. **/
+size_t cdplusg_ring_buffer_write (struct cdplusg_ring_buffer *ring, const short *samples, size_t frame_count);
+size_t cdplusg_ring_buffer_get_free (struct cdplusg_ring_buffer *ring);
+uint32_t cdplusg_ring_buffer_get_write_index (struct cdplusg_ring_buffer *ring);
+
+/** Consumer side: copies as many frames as are available and returns how many that was. **/
+size_t cdplusg_ring_buffer_read (struct cdplusg_ring_buffer *ring, short *samples, size_t frame_count);
+size_t cdplusg_ring_buffer_get_available (struct cdplusg_ring_buffer *ring);
+uint32_t cdplusg_ring_buffer_get_read_index (struct cdplusg_ring_buffer *ring);
+
+/** Consumer side: drops everything before index, which must not be past the write index. **/
+void cdplusg_ring_buffer_skip_to (struct cdplusg_ring_buffer *ring, uint32_t index);
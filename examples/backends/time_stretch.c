@@ -0,0 +1,425 @@
+#include <float.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "time_stretch.h"
+
+// length of the crossfade between segments, which is also what each step outputs
+#define CDPLUSG_TIME_STRETCH_OVERLAP_MS 15
+
+// how far a segment may be moved from where it should start to line up with the last one,
+// half a period of 60 Hz, so any pitch above that finds a match
+#define CDPLUSG_TIME_STRETCH_SEARCH_MS 8
+
+// The search runs on a mono mix shifted down to 13 bits, so that eight products of it
+// summed in pairs fit a 32-bit lane; plenty for telling alignments apart.
+#define CDPLUSG_TIME_STRETCH_MONO_SHIFT 3
+#define CDPLUSG_TIME_STRETCH_BLOCK_SAMPLES 64
+
+// crossfade weights are Q14, so that the two of a pair add up to a representable 16384
+#define CDPLUSG_TIME_STRETCH_FADE_BITS 14
+
+struct cdplusg_time_stretch
+{
+  double tempo;
+  size_t overlap_frames;
+  size_t search_frames;
+
+  // interleaved weights of the continuation and the new segment, one pair per sample
+  short *fade;
+
+  // the input not yet used up, interleaved and as a mono mix for the search
+  short *input;
+  short *mono;
+  size_t input_capacity;
+  size_t input_count;
+
+  // Where the next segment should start by the tempo, and where the last one would have
+  // gone on had it not been cut off, both relative to the input held; the next segment is
+  // picked near the one to resemble the other.
+  double position;
+  size_t continuation;
+  int is_started;
+
+  // once finished the input is padded with silence, and ends at end_count
+  int is_finished;
+  size_t end_count;
+
+  // the last step's output, overlap_frames frames of it
+  short *output;
+  size_t output_offset;
+  size_t output_count;
+};
+
+struct cdplusg_time_stretch *
+cdplusg_time_stretch_new (int sample_rate)
+{
+  struct cdplusg_time_stretch *stretch =
+    (struct cdplusg_time_stretch *) calloc (1, sizeof (struct cdplusg_time_stretch));
+
+  if (stretch == NULL)
+    return NULL;
+
+  stretch->overlap_frames = (size_t) sample_rate * CDPLUSG_TIME_STRETCH_OVERLAP_MS / 1000;
+  stretch->search_frames = (size_t) sample_rate * CDPLUSG_TIME_STRETCH_SEARCH_MS / 1000;
+
+  stretch->fade = (short *) malloc (4 * sizeof (short) * stretch->overlap_frames);
+  stretch->output = (short *) malloc (2 * sizeof (short) * stretch->overlap_frames);
+
+  if (stretch->fade == NULL || stretch->output == NULL)
+  {
+    cdplusg_time_stretch_free (stretch);
+    return NULL;
+  }
+
+  for (size_t i = 0; i < stretch->overlap_frames; i++)
+  {
+    short weight = (short) ((i << CDPLUSG_TIME_STRETCH_FADE_BITS) / stretch->overlap_frames);
+
+    for (size_t channel = 0; channel < 2; channel++)
+    {
+      stretch->fade[4 * i + 2 * channel + 0] = (1 << CDPLUSG_TIME_STRETCH_FADE_BITS) - weight;
+      stretch->fade[4 * i + 2 * channel + 1] = weight;
+    }
+  }
+
+  cdplusg_time_stretch_reset (stretch, 1);
+
+  return stretch;
+}
+
+void
+cdplusg_time_stretch_free (struct cdplusg_time_stretch *stretch)
+{
+  if (stretch == NULL)
+    return;
+
+  free (stretch->fade);
+  free (stretch->input);
+  free (stretch->mono);
+  free (stretch->output);
+  free (stretch);
+}
+
+void
+cdplusg_time_stretch_reset (struct cdplusg_time_stretch *stretch, double tempo)
+{
+  if (tempo < CDPLUSG_TIME_STRETCH_MIN_TEMPO)
+    tempo = CDPLUSG_TIME_STRETCH_MIN_TEMPO;
+  else if (tempo > CDPLUSG_TIME_STRETCH_MAX_TEMPO)
+    tempo = CDPLUSG_TIME_STRETCH_MAX_TEMPO;
+
+  stretch->tempo = tempo;
+  stretch->input_count = 0;
+  stretch->position = 0;
+  stretch->continuation = 0;
+  stretch->is_started = 0;
+  stretch->is_finished = 0;
+  stretch->end_count = 0;
+  stretch->output_offset = 0;
+  stretch->output_count = 0;
+}
+
+// Makes room for frame_count more frames of input, dropping what no segment can start in
+// any more.
+static int
+cdplusg_time_stretch_reserve (struct cdplusg_time_stretch *stretch, size_t frame_count)
+{
+  size_t nominal = (size_t) stretch->position;
+  size_t used_count = nominal > stretch->search_frames ? nominal - stretch->search_frames : 0;
+
+  if (used_count > stretch->continuation)
+    used_count = stretch->continuation;
+
+  if (used_count > stretch->input_count)
+    used_count = stretch->input_count;
+
+  if (used_count > 0)
+  {
+    stretch->input_count -= used_count;
+
+    memmove (stretch->input, &stretch->input[2 * used_count], 2 * sizeof (short) * stretch->input_count);
+    memmove (stretch->mono, &stretch->mono[used_count], sizeof (short) * stretch->input_count);
+
+    stretch->position -= used_count;
+    stretch->continuation -= used_count;
+  }
+
+  if (stretch->input_count + frame_count <= stretch->input_capacity)
+    return 1;
+
+  size_t capacity = 2 * (stretch->input_count + frame_count);
+  short *input = (short *) realloc (stretch->input, 2 * sizeof (short) * capacity);
+
+  if (input == NULL)
+    return 0;
+
+  stretch->input = input;
+
+  short *mono = (short *) realloc (stretch->mono, sizeof (short) * capacity);
+
+  if (mono == NULL)
+    return 0;
+
+  stretch->mono = mono;
+  stretch->input_capacity = capacity;
+
+  return 1;
+}
+
+int
+cdplusg_time_stretch_write (struct cdplusg_time_stretch *stretch, const short *samples, size_t frame_count)
+{
+  if (!cdplusg_time_stretch_reserve (stretch, frame_count))
+    return 0;
+
+  short *input = &stretch->input[2 * stretch->input_count];
+  short *mono = &stretch->mono[stretch->input_count];
+
+  memcpy (input, samples, 2 * sizeof (short) * frame_count);
+
+  for (size_t i = 0; i < frame_count; i++)
+    mono[i] = (short) ((samples[2 * i + 0] + samples[2 * i + 1]) >> CDPLUSG_TIME_STRETCH_MONO_SHIFT);
+
+  stretch->input_count += frame_count;
+
+  return 1;
+}
+
+void
+cdplusg_time_stretch_finish (struct cdplusg_time_stretch *stretch)
+{
+  if (stretch->is_finished)
+    return;
+
+  // enough silence for the segments that start before the end to be taken whole
+  size_t padding_count = 2 * (stretch->overlap_frames + stretch->search_frames) + 1;
+
+  stretch->end_count = stretch->input_count;
+
+  if (!cdplusg_time_stretch_reserve (stretch, padding_count))
+  {
+    // nothing more can be taken, so nothing more is given
+    stretch->position = stretch->input_count;
+    stretch->end_count = stretch->input_count;
+    stretch->is_finished = 1;
+    return;
+  }
+
+  // the reserve may have moved everything down
+  stretch->end_count = stretch->input_count;
+
+  memset (&stretch->input[2 * stretch->input_count], 0x00, 2 * sizeof (short) * padding_count);
+  memset (&stretch->mono[stretch->input_count], 0x00, sizeof (short) * padding_count);
+
+  stretch->input_count += padding_count;
+  stretch->is_finished = 1;
+}
+
+static int64_t
+cdplusg_time_stretch_correlate (const short *a, const short *b, size_t count)
+{
+  int64_t sum = 0;
+  size_t i = 0;
+
+#if defined(__SSE2__)
+  // pairs of products are summed into 32-bit lanes, which are widened to 64 bits after
+  // every block, before they can overflow
+  __m128i sums = _mm_setzero_si128 ();
+
+  while (i + CDPLUSG_TIME_STRETCH_BLOCK_SAMPLES <= count)
+  {
+    __m128i lanes = _mm_setzero_si128 ();
+
+    for (size_t end = i + CDPLUSG_TIME_STRETCH_BLOCK_SAMPLES; i < end; i += 8)
+    {
+      __m128i x = _mm_loadu_si128 ((const __m128i *) &a[i]);
+      __m128i y = _mm_loadu_si128 ((const __m128i *) &b[i]);
+
+      lanes = _mm_add_epi32 (lanes, _mm_madd_epi16 (x, y));
+    }
+
+    __m128i signs = _mm_srai_epi32 (lanes, 31);
+
+    sums = _mm_add_epi64 (sums, _mm_unpacklo_epi32 (lanes, signs));
+    sums = _mm_add_epi64 (sums, _mm_unpackhi_epi32 (lanes, signs));
+  }
+
+  int64_t halves [2];
+  _mm_storeu_si128 ((__m128i *) halves, sums);
+  sum = halves[0] + halves[1];
+#endif
+
+  for (; i < count; i++)
+    sum += a[i] * b[i];
+
+  return sum;
+}
+
+// How well the segment at candidate would follow on from the continuation, comparing their
+// correlation normalized by the candidate's energy, squared to do without a square root.
+static double
+cdplusg_time_stretch_score (int64_t correlation, int64_t energy)
+{
+  double square = (double) correlation * (double) correlation / ((double) energy + 1);
+
+  return correlation < 0 ? -square : square;
+}
+
+static size_t
+cdplusg_time_stretch_search (struct cdplusg_time_stretch *stretch, size_t nominal)
+{
+  const short *target = &stretch->mono[stretch->continuation];
+  size_t length = stretch->overlap_frames;
+  size_t first = nominal > stretch->search_frames ? nominal - stretch->search_frames : 0;
+  size_t last = nominal + stretch->search_frames;
+
+  // Every other candidate first, with the energies slid along, then the two beside the best
+  // of them; the correlation is smooth enough at these rates for that to find the peak. The
+  // nominal position wins ties, as in silence.
+  size_t best = nominal;
+  double best_score = cdplusg_time_stretch_score (
+                        cdplusg_time_stretch_correlate (target, &stretch->mono[nominal], length),
+                        cdplusg_time_stretch_correlate (&stretch->mono[nominal], &stretch->mono[nominal], length));
+
+  int64_t energy = cdplusg_time_stretch_correlate (&stretch->mono[first], &stretch->mono[first], length);
+
+  for (size_t candidate = first; candidate <= last; candidate += 2)
+  {
+    const short *mono = &stretch->mono[candidate];
+    double score = cdplusg_time_stretch_score (cdplusg_time_stretch_correlate (target, mono, length), energy);
+
+    if (score > best_score)
+    {
+      best = candidate;
+      best_score = score;
+    }
+
+    if (candidate + 2 <= last)
+    {
+      for (size_t i = 0; i < 2; i++)
+        energy += mono[length + i] * mono[length + i] - mono[i] * mono[i];
+    }
+  }
+
+  size_t refined = best;
+  size_t neighbors [2] = { best - 1, best + 1 };
+
+  for (size_t i = 0; i < 2; i++)
+  {
+    if (neighbors[i] < first || neighbors[i] > last)
+      continue;
+
+    const short *mono = &stretch->mono[neighbors[i]];
+    double score = cdplusg_time_stretch_score (cdplusg_time_stretch_correlate (target, mono, length),
+                     cdplusg_time_stretch_correlate (mono, mono, length));
+
+    if (score > best_score)
+    {
+      refined = neighbors[i];
+      best_score = score;
+    }
+  }
+
+  return refined;
+}
+
+// Fades from the continuation into the new segment over one overlap.
+static void
+cdplusg_time_stretch_crossfade (const short *from, const short *to, const short *fade, short *output,
+    size_t frame_count)
+{
+  size_t sample_count = 2 * frame_count;
+  size_t i = 0;
+
+#if defined(__SSE2__)
+  // interleaved with their weights, each pair of samples takes a single multiply-add
+  for (; i + 8 <= sample_count; i += 8)
+  {
+    __m128i x = _mm_loadu_si128 ((const __m128i *) &from[i]);
+    __m128i y = _mm_loadu_si128 ((const __m128i *) &to[i]);
+    __m128i low = _mm_madd_epi16 (_mm_unpacklo_epi16 (x, y), _mm_loadu_si128 ((const __m128i *) &fade[2 * i]));
+    __m128i high = _mm_madd_epi16 (_mm_unpackhi_epi16 (x, y), _mm_loadu_si128 ((const __m128i *) &fade[2 * i + 8]));
+
+    low = _mm_srai_epi32 (low, CDPLUSG_TIME_STRETCH_FADE_BITS);
+    high = _mm_srai_epi32 (high, CDPLUSG_TIME_STRETCH_FADE_BITS);
+
+    _mm_storeu_si128 ((__m128i *) &output[i], _mm_packs_epi32 (low, high));
+  }
+#endif
+
+  // the weights add up to one, so this never leaves the range of the inputs
+  for (; i < sample_count; i++)
+    output[i] = (short) ((from[i] * fade[2 * i] + to[i] * fade[2 * i + 1]) >> CDPLUSG_TIME_STRETCH_FADE_BITS);
+}
+
+// Produces the next overlap's worth of output, or returns 0 if that takes more input.
+static int
+cdplusg_time_stretch_step (struct cdplusg_time_stretch *stretch)
+{
+  size_t overlap_frames = stretch->overlap_frames;
+
+  if (stretch->is_finished && stretch->position >= stretch->end_count)
+    return 0;
+
+  if (!stretch->is_started)
+  {
+    if (stretch->input_count < overlap_frames)
+      return 0;
+
+    memcpy (stretch->output, stretch->input, 2 * sizeof (short) * overlap_frames);
+
+    stretch->is_started = 1;
+  }
+  else
+  {
+    size_t nominal = (size_t) (stretch->position + 0.5);
+
+    if (nominal + stretch->search_frames + overlap_frames > stretch->input_count
+          || stretch->continuation + overlap_frames > stretch->input_count)
+      return 0;
+
+    size_t segment = cdplusg_time_stretch_search (stretch, nominal);
+
+    cdplusg_time_stretch_crossfade (&stretch->input[2 * stretch->continuation], &stretch->input[2 * segment],
+        stretch->fade, stretch->output, overlap_frames);
+
+    stretch->continuation = segment;
+  }
+
+  stretch->continuation += overlap_frames;
+  stretch->position += stretch->tempo * overlap_frames;
+  stretch->output_offset = 0;
+  stretch->output_count = overlap_frames;
+
+  return 1;
+}
+
+size_t
+cdplusg_time_stretch_read (struct cdplusg_time_stretch *stretch, short *samples, size_t frame_count)
+{
+  size_t read_count = 0;
+
+  while (read_count < frame_count)
+  {
+    if (stretch->output_offset == stretch->output_count && !cdplusg_time_stretch_step (stretch))
+      break;
+
+    size_t count = stretch->output_count - stretch->output_offset;
+
+    if (count > frame_count - read_count)
+      count = frame_count - read_count;
+
+    memcpy (&samples[2 * read_count], &stretch->output[2 * stretch->output_offset], 2 * sizeof (short) * count);
+
+    stretch->output_offset += count;
+    read_count += count;
+  }
+
+  return read_count;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stddef.h>
+
+/** Changes the tempo of interleaved 16-bit stereo audio without changing its pitch, by
+ * WSOLA: the output is built from segments of the input taken a tempo's worth apart, each
+ * one picked within a few milliseconds of where it should be so that it lines up with
+ * where the previous one left off, and crossfaded into it.
+ *
+ * Input is written in whatever amounts it comes and output read back in whatever amounts
+ * are wanted; output frame n corresponds to input frame n * tempo, give or take the search
+ * range of about 8 ms.
+ **/
+struct cdplusg_time_stretch;
+
+/** Slowest and fastest tempo, as a factor of the original, wide enough for any tempo the
+ * decoder plays at to be stretched further for a pitch shift.
+ **/
+#define CDPLUSG_TIME_STRETCH_MIN_TEMPO 0.25
+#define CDPLUSG_TIME_STRETCH_MAX_TEMPO 4.0
+
+struct cdplusg_time_stretch *cdplusg_time_stretch_new (int sample_rate);
+void cdplusg_time_stretch_free (struct cdplusg_time_stretch *stretch);
+
+/** Drops everything held, to start over at the given tempo, for example after a seek. **/
+void cdplusg_time_stretch_reset (struct cdplusg_time_stretch *stretch, double tempo);
+
+/** Returns 0 if the memory for the frames could not be had. **/
+int cdplusg_time_stretch_write (struct cdplusg_time_stretch *stretch, const short *samples, size_t frame_count);
+
+/** Marks the end of the input, so that what is left of it is read out too. **/
+void cdplusg_time_stretch_finish (struct cdplusg_time_stretch *stretch);
+
+/** Copies up to frame_count output frames into samples, fewer when more input is needed or
+ * after the end, and returns how many.
+ **/
+size_t cdplusg_time_stretch_read (struct cdplusg_time_stretch *stretch, short *samples, size_t frame_count);
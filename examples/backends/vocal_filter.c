@@ -0,0 +1,182 @@
+#define _DEFAULT_SOURCE
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "vocal_filter.h"
+
+// edges of the band taken out of the mid signal
+#define CDPLUSG_VOCAL_FILTER_LOW_HZ 120
+#define CDPLUSG_VOCAL_FILTER_HIGH_HZ 8000
+
+// The band is what gets through a one-pole lowpass at the upper edge but not one at the lower
+// edge. Steeper edges would shift the phase inside the band away from the mid signal, and
+// leave more of the vocals behind than they would spare the rest.
+#define CDPLUSG_VOCAL_FILTER_POLES 2
+
+struct cdplusg_vocal_filter_pole
+{
+  float feedback;
+  float gain;
+
+  // The recursion worked out four samples ahead: each of four outputs is the last output
+  // before them times decay, plus the four inputs weighted by their column.
+  float decay [4];
+  float columns [4][4];
+};
+
+struct cdplusg_vocal_filter
+{
+  // the upper edge, then the lower
+  struct cdplusg_vocal_filter_pole poles [CDPLUSG_VOCAL_FILTER_POLES];
+  float states [CDPLUSG_VOCAL_FILTER_POLES];
+
+  // where the last ramp ended
+  float amount;
+};
+
+static void
+cdplusg_vocal_filter_pole_initialize (struct cdplusg_vocal_filter_pole *pole, int sample_rate, double frequency)
+{
+  double feedback = exp (-2 * M_PI * frequency / sample_rate);
+
+  pole->feedback = (float) feedback;
+  pole->gain = (float) (1 - feedback);
+
+  for (int i = 0; i < 4; i++)
+  {
+    pole->decay[i] = (float) pow (feedback, i + 1);
+
+    for (int j = 0; j < 4; j++)
+      pole->columns[j][i] = i >= j ? (float) ((1 - feedback) * pow (feedback, i - j)) : 0;
+  }
+}
+
+struct cdplusg_vocal_filter *
+cdplusg_vocal_filter_new (int sample_rate)
+{
+  struct cdplusg_vocal_filter *filter =
+    (struct cdplusg_vocal_filter *) calloc (1, sizeof (struct cdplusg_vocal_filter));
+
+  if (filter == NULL)
+    return NULL;
+
+  for (int i = 0; i < CDPLUSG_VOCAL_FILTER_POLES; i++)
+  {
+    cdplusg_vocal_filter_pole_initialize (&filter->poles[i], sample_rate,
+        i == 0 ? CDPLUSG_VOCAL_FILTER_HIGH_HZ : CDPLUSG_VOCAL_FILTER_LOW_HZ);
+  }
+
+  return filter;
+}
+
+void
+cdplusg_vocal_filter_free (struct cdplusg_vocal_filter *filter)
+{
+  free (filter);
+}
+
+void
+cdplusg_vocal_filter_reset (struct cdplusg_vocal_filter *filter)
+{
+  for (int i = 0; i < CDPLUSG_VOCAL_FILTER_POLES; i++)
+    filter->states[i] = 0;
+}
+
+#if defined(__SSE2__)
+
+static __m128
+cdplusg_vocal_filter_lowpass4 (const struct cdplusg_vocal_filter_pole *pole, __m128 input, float *state)
+{
+  __m128 output = _mm_mul_ps (_mm_loadu_ps (pole->decay), _mm_set1_ps (*state));
+
+  output = _mm_add_ps (output, _mm_mul_ps (_mm_loadu_ps (pole->columns[0]), _mm_shuffle_ps (input, input, 0x00)));
+  output = _mm_add_ps (output, _mm_mul_ps (_mm_loadu_ps (pole->columns[1]), _mm_shuffle_ps (input, input, 0x55)));
+  output = _mm_add_ps (output, _mm_mul_ps (_mm_loadu_ps (pole->columns[2]), _mm_shuffle_ps (input, input, 0xaa)));
+  output = _mm_add_ps (output, _mm_mul_ps (_mm_loadu_ps (pole->columns[3]), _mm_shuffle_ps (input, input, 0xff)));
+
+  *state = _mm_cvtss_f32 (_mm_shuffle_ps (output, output, 0xff));
+
+  return output;
+}
+
+#endif
+
+void
+cdplusg_vocal_filter_process (struct cdplusg_vocal_filter *filter, short *samples, size_t frame_count, float amount)
+{
+  if (amount < 0)
+    amount = 0;
+  else if (amount > 1)
+    amount = 1;
+
+  float start_amount = filter->amount;
+
+  // switched off, the audio goes through untouched, and the filters start from silence
+  // when switched on again
+  if (start_amount == 0 && amount == 0)
+  {
+    cdplusg_vocal_filter_reset (filter);
+    return;
+  }
+
+  float step = frame_count > 0 ? (amount - start_amount) / frame_count : 0;
+  struct cdplusg_vocal_filter_pole *poles = filter->poles;
+  float *states = filter->states;
+  size_t i = 0;
+
+#if defined(__SSE2__)
+  // four frames at a time, the filters running across them in the lanes
+  __m128 ramp = _mm_setr_ps (start_amount, start_amount + step, start_amount + 2 * step, start_amount + 3 * step);
+  __m128 ramp_step = _mm_set1_ps (4 * step);
+
+  for (; i + 4 <= frame_count; i += 4)
+  {
+    __m128i pcm = _mm_loadu_si128 ((const __m128i *) &samples[2 * i]);
+
+    // left and right of frames 0 and 1, then of frames 2 and 3, sign-extended
+    __m128 first = _mm_cvtepi32_ps (_mm_srai_epi32 (_mm_unpacklo_epi16 (pcm, pcm), 16));
+    __m128 second = _mm_cvtepi32_ps (_mm_srai_epi32 (_mm_unpackhi_epi16 (pcm, pcm), 16));
+
+    __m128 left = _mm_shuffle_ps (first, second, _MM_SHUFFLE (2, 0, 2, 0));
+    __m128 right = _mm_shuffle_ps (first, second, _MM_SHUFFLE (3, 1, 3, 1));
+    __m128 mid = _mm_mul_ps (_mm_add_ps (left, right), _mm_set1_ps (0.5f));
+
+    __m128 high = cdplusg_vocal_filter_lowpass4 (&poles[0], mid, &states[0]);
+    __m128 low = cdplusg_vocal_filter_lowpass4 (&poles[1], mid, &states[1]);
+
+    __m128 band = _mm_mul_ps (_mm_sub_ps (high, low), ramp);
+    ramp = _mm_add_ps (ramp, ramp_step);
+
+    // both channels of a frame lose the same
+    first = _mm_sub_ps (first, _mm_unpacklo_ps (band, band));
+    second = _mm_sub_ps (second, _mm_unpackhi_ps (band, band));
+
+    _mm_storeu_si128 ((__m128i *) &samples[2 * i], _mm_packs_epi32 (_mm_cvtps_epi32 (first),
+                                                      _mm_cvtps_epi32 (second)));
+  }
+#endif
+
+  for (; i < frame_count; i++)
+  {
+    float mid = 0.5f * ((float) samples[2 * i + 0] + (float) samples[2 * i + 1]);
+
+    for (int j = 0; j < CDPLUSG_VOCAL_FILTER_POLES; j++)
+      states[j] = poles[j].feedback * states[j] + poles[j].gain * mid;
+
+    float band = (states[0] - states[1]) * (start_amount + step * i);
+
+    for (int channel = 0; channel < 2; channel++)
+    {
+      long sample = lrintf (samples[2 * i + channel] - band);
+      samples[2 * i + channel] = (short) (sample > INT16_MAX ? INT16_MAX : sample < INT16_MIN ? INT16_MIN : sample);
+    }
+  }
+
+  filter->amount = amount;
+}
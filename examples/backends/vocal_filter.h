@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stddef.h>
+
+/** Reduces the vocals of interleaved 16-bit stereo audio, by taking out the part of the
+ * center of the mix that lies in the vocal range: the mid signal, (L + R) / 2, band-limited
+ * to roughly 120 Hz to 8 kHz, is subtracted from both channels. Kick and bass, also in the
+ * center, are mostly left alone. Anything panned to one side loses its share of the mid
+ * signal in that range, which for a hard pan is half, and the side signal is untouched.
+ **/
+struct cdplusg_vocal_filter;
+
+struct cdplusg_vocal_filter *cdplusg_vocal_filter_new (int sample_rate);
+void cdplusg_vocal_filter_free (struct cdplusg_vocal_filter *filter);
+
+/** Forgets the audio filtered so far, for example after a seek. **/
+void cdplusg_vocal_filter_reset (struct cdplusg_vocal_filter *filter);
+
+/** Filters the frames in place, with amount going from 0 for none of the reduction to 1
+ * for all of it; a change of amount is ramped over the frames, so that it does not click.
+ **/
+void cdplusg_vocal_filter_process (struct cdplusg_vocal_filter *filter, short *samples, size_t frame_count, float amount);
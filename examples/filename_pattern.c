@@ -0,0 +1,56 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "filename_pattern.h"
+
+// wide enough for any sensible padding, and far from overflowing the width printf parses
+#define FILENAME_PATTERN_MAX_WIDTH_DIGITS 2
+
+int
+filename_pattern_is_pattern (const char *name)
+{
+  return strchr (name, '%') != NULL;
+}
+
+int
+filename_pattern_is_valid (const char *pattern)
+{
+  int conversion_count = 0;
+
+  for (const char *c = strchr (pattern, '%'); c != NULL; c = strchr (c, '%'))
+  {
+    c++;
+
+    if (*c == '%')
+    {
+      c++;
+      continue;
+    }
+
+    if (*c == '0')
+      c++;
+
+    for (int i = 0; *c >= '0' && *c <= '9'; i++, c++)
+    {
+      if (i == FILENAME_PATTERN_MAX_WIDTH_DIGITS)
+        return 0;
+    }
+
+    if (*c != 'd' && *c != 'u')
+      return 0;
+
+    c++;
+    conversion_count++;
+  }
+
+  return conversion_count == 1;
+}
+
+int
+filename_pattern_format (char *filename, size_t size, const char *pattern, unsigned int number)
+{
+  // %d reads an int, which every image number of a song fits
+  int length = snprintf (filename, size, pattern, number);
+
+  return length >= 0 && (size_t) length < size;
+}
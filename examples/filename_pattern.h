@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stddef.h>
+
+/** Output names with a printf pattern, which the tools writing one file per image number
+ * their files with. Only a single %d or %u is taken, optionally with a width padded with
+ * spaces or zeros like %05d, and any other % has to be written %%, so that a name from
+ * the command line never makes printf read an argument that is not there.
+ **/
+
+/** Returns 1 for a name holding a % at all, which makes it a pattern, valid or not. **/
+int filename_pattern_is_pattern (const char *name);
+
+/** Returns 1 for a pattern as above. **/
+int filename_pattern_is_valid (const char *pattern);
+
+/** Formats the image number into a valid pattern; returns 0 if the name does not fit. **/
+int filename_pattern_format (char *filename, size_t size, const char *pattern, unsigned int number);
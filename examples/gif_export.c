@@ -0,0 +1,588 @@
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cdplusg.h>
+
+#define DEFAULT_FPS 10
+#define DEFAULT_SCALE_FACTOR 1
+
+// CD+G has 16 colors, so every image uses 4-bit LZW codes
+#define GIF_MIN_CODE_SIZE 4
+#define GIF_CLEAR_CODE (1 << GIF_MIN_CODE_SIZE)
+#define GIF_END_CODE (GIF_CLEAR_CODE + 1)
+#define GIF_MAX_CODE_SIZE 12
+#define GIF_MAX_CODES (1 << GIF_MAX_CODE_SIZE)
+#define GIF_MAX_BLOCK_SIZE 255
+
+static char *progname;
+
+struct gif_buffer
+{
+  unsigned char *data;
+  size_t size;
+  size_t capacity;
+};
+
+struct gif_lzw_encoder
+{
+  // the string table as a trie: children[code][index] is the code of the string extended
+  // by one more color index, or 0 since no string code is below GIF_END_CODE
+  uint16_t children [GIF_MAX_CODES][CDPLUSG_COLOR_TABLE_SIZE];
+
+  unsigned int next_code;
+  unsigned int code_size;
+
+  uint32_t bits;
+  unsigned int bit_count;
+
+  unsigned char block [GIF_MAX_BLOCK_SIZE];
+  unsigned int block_size;
+
+  struct gif_buffer *output;
+};
+
+struct gif_exporter
+{
+  FILE *output;
+
+  struct cdplusg_converter *converter;
+  unsigned int scale_factor;
+
+  struct gif_lzw_encoder encoder;
+
+  // color table indices as exported so far, used to shrink dirty rectangles to the
+  // pixels that actually changed
+  unsigned char previous_pixels [CDPLUSG_SCREEN_WIDTH * CDPLUSG_SCREEN_HEIGHT];
+
+  struct cdplusg_color_table_entry global_palette [CDPLUSG_COLOR_TABLE_SIZE];
+  unsigned int palette_version;
+
+  unsigned char *indices;
+
+  // the last frame is held back until the next change, when its duration is known
+  struct gif_buffer pending_frame;
+  unsigned long pending_packet;
+  int has_pending_frame;
+};
+
+static int
+gif_buffer_reserve (struct gif_buffer *buffer, size_t size)
+{
+  if (buffer->size + size <= buffer->capacity)
+    return 1;
+
+  size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+
+  while (capacity < buffer->size + size)
+    capacity *= 2;
+
+  unsigned char *data = realloc (buffer->data, capacity);
+
+  if (data == NULL)
+    return 0;
+
+  buffer->data = data;
+  buffer->capacity = capacity;
+
+  return 1;
+}
+
+static int
+gif_buffer_append (struct gif_buffer *buffer, const void *data, size_t size)
+{
+  if (!gif_buffer_reserve (buffer, size))
+    return 0;
+
+  memcpy (buffer->data + buffer->size, data, size);
+  buffer->size += size;
+
+  return 1;
+}
+
+static int
+gif_buffer_append_byte (struct gif_buffer *buffer, unsigned char byte)
+{
+  return gif_buffer_append (buffer, &byte, 1);
+}
+
+static int
+gif_buffer_append_u16 (struct gif_buffer *buffer, unsigned int value)
+{
+  unsigned char bytes [] = { value & 0xFF, (value >> 8) & 0xFF };
+  return gif_buffer_append (buffer, bytes, sizeof (bytes));
+}
+
+static int
+gif_buffer_append_palette (struct gif_buffer *buffer, const struct cdplusg_color_table_entry *palette)
+{
+  unsigned char colors [3 * CDPLUSG_COLOR_TABLE_SIZE];
+
+  for (int i = 0; i < CDPLUSG_COLOR_TABLE_SIZE; i++)
+  {
+    colors[3 * i + 0] = palette[i].r;
+    colors[3 * i + 1] = palette[i].g;
+    colors[3 * i + 2] = palette[i].b;
+  }
+
+  return gif_buffer_append (buffer, colors, sizeof (colors));
+}
+
+static void
+gif_lzw_encoder_flush_block (struct gif_lzw_encoder *encoder)
+{
+  if (encoder->block_size == 0)
+    return;
+
+  gif_buffer_append_byte (encoder->output, encoder->block_size);
+  gif_buffer_append (encoder->output, encoder->block, encoder->block_size);
+  encoder->block_size = 0;
+}
+
+static void
+gif_lzw_encoder_emit (struct gif_lzw_encoder *encoder, unsigned int code)
+{
+  encoder->bits |= (uint32_t) code << encoder->bit_count;
+  encoder->bit_count += encoder->code_size;
+
+  while (encoder->bit_count >= 8)
+  {
+    encoder->block[encoder->block_size++] = encoder->bits & 0xFF;
+    encoder->bits >>= 8;
+    encoder->bit_count -= 8;
+
+    if (encoder->block_size == GIF_MAX_BLOCK_SIZE)
+      gif_lzw_encoder_flush_block (encoder);
+  }
+}
+
+static void
+gif_lzw_encoder_reset (struct gif_lzw_encoder *encoder)
+{
+  memset (encoder->children, 0, sizeof (encoder->children));
+  encoder->next_code = GIF_END_CODE + 1;
+  encoder->code_size = GIF_MIN_CODE_SIZE + 1;
+}
+
+// Appends the image data of a GIF image: the minimum code size, the LZW codes in
+// sub-blocks and the block terminator.
+static void
+gif_lzw_encode (struct gif_lzw_encoder *encoder, const unsigned char *indices, size_t count,
+              struct gif_buffer *output)
+{
+  encoder->output = output;
+  encoder->bits = 0;
+  encoder->bit_count = 0;
+  encoder->block_size = 0;
+
+  gif_buffer_append_byte (output, GIF_MIN_CODE_SIZE);
+
+  gif_lzw_encoder_reset (encoder);
+  gif_lzw_encoder_emit (encoder, GIF_CLEAR_CODE);
+
+  unsigned int prefix = indices[0];
+
+  for (size_t i = 1; i < count; i++)
+  {
+    unsigned int index = indices[i];
+    unsigned int child = encoder->children[prefix][index];
+
+    if (child != 0)
+    {
+      prefix = child;
+      continue;
+    }
+
+    gif_lzw_encoder_emit (encoder, prefix);
+
+    if (encoder->next_code == GIF_MAX_CODES)
+    {
+      // the table is full, start over rather than keep using a stale table
+      gif_lzw_encoder_emit (encoder, GIF_CLEAR_CODE);
+      gif_lzw_encoder_reset (encoder);
+    }
+    else
+    {
+      encoder->children[prefix][index] = encoder->next_code++;
+
+      // the decoder adds its entries one code later, so it widens its codes only once
+      // the code just added no longer fits
+      if (encoder->next_code > (1u << encoder->code_size))
+        encoder->code_size++;
+    }
+
+    prefix = index;
+  }
+
+  gif_lzw_encoder_emit (encoder, prefix);
+  gif_lzw_encoder_emit (encoder, GIF_END_CODE);
+
+  if (encoder->bit_count > 0)
+  {
+    encoder->block[encoder->block_size++] = encoder->bits & 0xFF;
+
+    if (encoder->block_size == GIF_MAX_BLOCK_SIZE)
+      gif_lzw_encoder_flush_block (encoder);
+  }
+
+  gif_lzw_encoder_flush_block (encoder);
+  gif_buffer_append_byte (output, 0);
+}
+
+static int
+gif_exporter_write_header (struct gif_exporter *exporter, const struct cdplusg_graphics_state *gpx_state)
+{
+  struct gif_buffer header = { NULL, 0, 0 };
+
+  exporter->palette_version = cdplusg_graphics_state_get_palette (gpx_state, exporter->global_palette);
+
+  gif_buffer_append (&header, "GIF89a", 6);
+  gif_buffer_append_u16 (&header, CDPLUSG_SCREEN_WIDTH * exporter->scale_factor);
+  gif_buffer_append_u16 (&header, CDPLUSG_SCREEN_HEIGHT * exporter->scale_factor);
+
+  // global color table of 16 entries with 8 bits per primary, background 0, square pixels
+  gif_buffer_append_byte (&header, 0xF3);
+  gif_buffer_append_byte (&header, 0);
+  gif_buffer_append_byte (&header, 0);
+  gif_buffer_append_palette (&header, exporter->global_palette);
+
+  // loop forever
+  gif_buffer_append (&header, "\x21\xFF\x0BNETSCAPE2.0\x03\x01\x00\x00\x00", 19);
+
+  int success = header.data != NULL
+    && fwrite (header.data, header.size, 1, exporter->output) == 1;
+
+  free (header.data);
+
+  return success;
+}
+
+static int
+gif_exporter_flush_pending_frame (struct gif_exporter *exporter, unsigned long packet)
+{
+  if (!exporter->has_pending_frame)
+    return 1;
+
+  // delays are in hundredths of a second, which is three packets
+  unsigned long delay = packet / 3 - exporter->pending_packet / 3;
+
+  if (delay > 0xFFFF)
+    delay = 0xFFFF;
+
+  // graphic control extension: leave the frame in place, no transparency
+  unsigned char control [] =
+    { 0x21, 0xF9, 0x04, 0x04, delay & 0xFF, (delay >> 8) & 0xFF, 0x00, 0x00 };
+
+  exporter->has_pending_frame = 0;
+
+  return fwrite (control, sizeof (control), 1, exporter->output) == 1
+    && fwrite (exporter->pending_frame.data, exporter->pending_frame.size, 1, exporter->output) == 1;
+}
+
+// Bounding box of the pixels inside rect that differ from what was exported last,
+// which becomes the new export.
+static int
+gif_exporter_diff_rect (struct gif_exporter *exporter, const unsigned char *pixels,
+              struct cdplusg_rect *rect)
+{
+  int first_row = rect->y + rect->height;
+  int last_row = -1;
+  int first_column = rect->x + rect->width;
+  int last_column = -1;
+
+  for (int i = rect->y; i < rect->y + rect->height; i++)
+  {
+    const unsigned char *row = &pixels[i * CDPLUSG_SCREEN_WIDTH];
+    unsigned char *previous_row = &exporter->previous_pixels[i * CDPLUSG_SCREEN_WIDTH];
+
+    int left = rect->x;
+    int right = rect->x + rect->width - 1;
+
+    while (left <= right && row[left] == previous_row[left])
+      left++;
+
+    if (left > right)
+      continue;
+
+    while (row[right] == previous_row[right])
+      right--;
+
+    memcpy (&previous_row[left], &row[left], right - left + 1);
+
+    first_row = first_row < i ? first_row : i;
+    last_row = i;
+    first_column = first_column < left ? first_column : left;
+    last_column = last_column > right ? last_column : right;
+  }
+
+  if (last_row < 0)
+    return 0;
+
+  rect->x = first_column;
+  rect->y = first_row;
+  rect->width = last_column - first_column + 1;
+  rect->height = last_row - first_row + 1;
+
+  return 1;
+}
+
+// Called at every frame boundary; turns whatever changed since the last call into a
+// GIF image, or does nothing so that the previous image is shown for longer.
+static int
+gif_exporter_add_frame (struct gif_exporter *exporter, struct cdplusg_graphics_state *gpx_state,
+              unsigned long packet)
+{
+  struct cdplusg_color_table_entry palette [CDPLUSG_COLOR_TABLE_SIZE];
+  unsigned int palette_version = cdplusg_graphics_state_get_palette (gpx_state, palette);
+
+  struct cdplusg_rect rect;
+  int changed = 0;
+
+  if (cdplusg_graphics_state_get_dirty_rect (gpx_state, &rect))
+  {
+    changed = gif_exporter_diff_rect (exporter, gpx_state->pixels, &rect);
+    cdplusg_graphics_state_clear_dirty (gpx_state);
+  }
+
+  // a palette change recolors the whole screen, but the colors of a GIF image only apply
+  // to its own pixels
+  if (palette_version != exporter->palette_version)
+  {
+    exporter->palette_version = palette_version;
+    rect = (struct cdplusg_rect) { 0, 0, CDPLUSG_SCREEN_WIDTH, CDPLUSG_SCREEN_HEIGHT };
+    changed = 1;
+  }
+
+  if (!changed)
+    return 1;
+
+  if (!gif_exporter_flush_pending_frame (exporter, packet))
+    return 0;
+
+  unsigned int scale_factor = exporter->scale_factor;
+  unsigned int width = rect.width * scale_factor;
+  unsigned int height = rect.height * scale_factor;
+
+  cdplusg_converter_convert_rect (exporter->converter, gpx_state, &rect, exporter->indices,
+      width, -rect.x * (int) scale_factor, -rect.y * (int) scale_factor);
+
+  int local_palette = memcmp (palette, exporter->global_palette, sizeof (palette)) != 0;
+  struct gif_buffer *frame = &exporter->pending_frame;
+
+  frame->size = 0;
+
+  gif_buffer_append_byte (frame, 0x2C);
+  gif_buffer_append_u16 (frame, rect.x * scale_factor);
+  gif_buffer_append_u16 (frame, rect.y * scale_factor);
+  gif_buffer_append_u16 (frame, width);
+  gif_buffer_append_u16 (frame, height);
+  gif_buffer_append_byte (frame, local_palette ? 0x83 : 0x00);
+
+  if (local_palette)
+    gif_buffer_append_palette (frame, palette);
+
+  gif_lzw_encode (&exporter->encoder, exporter->indices, (size_t) width * height, frame);
+
+  if (frame->data == NULL)
+  {
+    fprintf (stderr, "%s: out of memory\n", progname);
+    return 0;
+  }
+
+  exporter->pending_packet = packet;
+  exporter->has_pending_frame = 1;
+
+  return 1;
+}
+
+static void
+usage (void)
+{
+  fprintf (stderr, "usage: %s [-r fps] [-s scale] [-o output] filename\n", progname);
+}
+
+static int
+parse_unsigned (const char *string, unsigned int *value, unsigned int maximum)
+{
+  char *end;
+  unsigned long parsed = strtoul (string, &end, 10);
+
+  if (*string == '\0' || *end != '\0' || parsed == 0 || parsed > maximum)
+    return 0;
+
+  *value = (unsigned int) parsed;
+  return 1;
+}
+
+int
+main (int argc, char **argv)
+{
+  progname = argv[0];
+
+  const char *output_filename = NULL;
+  unsigned int fps_numerator = DEFAULT_FPS;
+  unsigned int fps_denominator = 1;
+  unsigned int scale_factor = DEFAULT_SCALE_FACTOR;
+  int option;
+
+  while ((option = getopt (argc, argv, "r:s:o:")) != -1)
+  {
+    switch (option)
+    {
+      case 'r':
+        // GIF delays are in hundredths of a second and browsers slow down anything faster
+        // than 50 frames per second
+        if (!cdplusg_frame_iterator_parse_frame_rate (optarg, &fps_numerator, &fps_denominator)
+              || fps_numerator > 50ULL * fps_denominator)
+        {
+          usage ();
+          return 1;
+        }
+        break;
+      case 's':
+        if (!parse_unsigned (optarg, &scale_factor, 8))
+        {
+          usage ();
+          return 1;
+        }
+        break;
+      case 'o':
+        output_filename = optarg;
+        break;
+      default:
+        usage ();
+        return 1;
+    }
+  }
+
+  if (optind + 1 != argc)
+  {
+    usage ();
+    return 1;
+  }
+
+  const char *filename = argv[optind];
+  FILE *file = fopen (filename, "rb");
+
+  if (file == NULL)
+  {
+    fprintf (stderr, "%s: error opening file '%s': %s\n", progname, filename, strerror (errno));
+    return 1;
+  }
+
+  struct gif_exporter *exporter = calloc (1, sizeof (struct gif_exporter));
+
+  if (exporter == NULL)
+  {
+    fprintf (stderr, "%s: out of memory\n", progname);
+    return 1;
+  }
+
+  if (output_filename == NULL || strcmp (output_filename, "-") == 0)
+  {
+    exporter->output = stdout;
+  }
+  else
+  {
+    exporter->output = fopen (output_filename, "wb");
+
+    if (exporter->output == NULL)
+    {
+      fprintf (stderr, "%s: error opening file '%s': %s\n", progname, output_filename,
+          strerror (errno));
+      return 1;
+    }
+  }
+
+  setvbuf (file, NULL, _IOFBF, 1 << 16);
+
+  exporter->scale_factor = scale_factor;
+  exporter->converter = cdplusg_converter_create (CDPLUSG_PIXEL_FORMAT_INDEX8, scale_factor);
+
+  if (exporter->converter == NULL)
+  {
+    fprintf (stderr, "%s: could not create a converter at scale %u\n", progname, scale_factor);
+    return 1;
+  }
+
+  exporter->indices = malloc (cdplusg_converter_get_pixmap_size (exporter->converter));
+
+  if (exporter->indices == NULL)
+  {
+    fprintf (stderr, "%s: out of memory\n", progname);
+    return 1;
+  }
+
+  struct cdplusg_graphics_state *gpx_state = cdplusg_graphics_state_new ();
+  struct cdplusg_instruction instruction;
+  struct cdplusg_frame_iterator frame_iterator;
+
+  cdplusg_frame_iterator_initialize (&frame_iterator, fps_numerator, fps_denominator);
+
+  unsigned long packet_count = 0;
+  unsigned long frame_count = 0;
+  int success = 1;
+  int end_of_file = 0;
+
+  // the previous pixels start out as a blank screen, so force the first image to cover it
+  memset (exporter->previous_pixels, 0xFF, sizeof (exporter->previous_pixels));
+
+  while (!end_of_file && success)
+  {
+    unsigned long frame_end = cdplusg_frame_iterator_next (&frame_iterator);
+    unsigned long frame_start = packet_count;
+
+    while (packet_count < frame_end)
+    {
+      if (cdplusg_instruction_initialize_from_file (&instruction, file) != 1)
+      {
+        end_of_file = 1;
+        break;
+      }
+
+      cdplusg_graphics_state_apply_instruction (gpx_state, &instruction);
+      packet_count++;
+    }
+
+    if (packet_count == frame_start)
+      break;
+
+    // the global palette is whatever is loaded when the first frame is shown
+    if (frame_count == 0)
+      success = gif_exporter_write_header (exporter, gpx_state);
+
+    if (success)
+      success = gif_exporter_add_frame (exporter, gpx_state, frame_start);
+
+    frame_count++;
+  }
+
+  if (success && frame_count > 0)
+  {
+    success = gif_exporter_flush_pending_frame (exporter, packet_count)
+      && fputc (0x3B, exporter->output) != EOF;
+  }
+
+  if (fflush (exporter->output) != 0)
+    success = 0;
+
+  if (!success)
+    fprintf (stderr, "%s: error writing output: %s\n", progname, strerror (errno));
+
+  if (exporter->output != stdout && fclose (exporter->output) != 0)
+    success = 0;
+
+  cdplusg_graphics_state_free (gpx_state);
+  cdplusg_converter_destroy (exporter->converter);
+  free (exporter->pending_frame.data);
+  free (exporter->indices);
+  free (exporter);
+  fclose (file);
+
+  return success ? 0 : 1;
+}
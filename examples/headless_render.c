@@ -0,0 +1,531 @@
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cdplusg.h>
+
+#include "filename_pattern.h"
+
+#define PACKETS_PER_SECOND 300
+#define DEFAULT_FPS 30
+#define DEFAULT_SCALE_FACTOR 1
+
+// number of frames that can be in flight between the decode, convert and write stages
+#define PIPELINE_DEPTH 8
+
+static char *progname;
+
+enum headless_output_format
+{
+  HEADLESS_OUTPUT_Y4M,
+  HEADLESS_OUTPUT_RAW,
+  HEADLESS_OUTPUT_PPM
+};
+
+struct headless_options
+{
+  const char *input_filename;
+  const char *output_filename;   // NULL or "-" for stdout; may hold a %d pattern for ppm
+  enum headless_output_format format;
+  unsigned int fps_numerator;
+  unsigned int fps_denominator;
+  unsigned int scale_factor;
+  unsigned int thread_count;
+};
+
+struct headless_frame
+{
+  struct cdplusg_graphics_state *gpx_state;
+  unsigned char *pixmap;
+};
+
+struct headless_pipeline
+{
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+
+  struct headless_frame frames [PIPELINE_DEPTH];
+
+  // frame counters of each stage, slot i holds frame i % PIPELINE_DEPTH
+  unsigned int decoded;
+  unsigned int converted;
+  unsigned int written;
+
+  int decode_done;
+  int aborted;
+
+  FILE *input;
+  unsigned int fps_numerator;
+  unsigned int fps_denominator;
+
+  struct cdplusg_converter *converter;
+  size_t pixmap_size;
+};
+
+static void
+usage (void)
+{
+  fprintf (stderr,
+      "usage: %s [-f y4m|raw|ppm] [-r fps] [-s scale] [-j threads] [-o output] filename\n",
+      progname);
+}
+
+static int
+parse_unsigned (const char *string, unsigned int *value)
+{
+  char *end;
+  unsigned long parsed = strtoul (string, &end, 10);
+
+  if (*string == '\0' || *end != '\0' || parsed == 0 || parsed > 1000)
+    return 0;
+
+  *value = (unsigned int) parsed;
+  return 1;
+}
+
+static int
+parse_options (struct headless_options *options, int argc, char **argv)
+{
+  int option;
+
+  options->output_filename = NULL;
+  options->format = HEADLESS_OUTPUT_Y4M;
+  options->fps_numerator = DEFAULT_FPS;
+  options->fps_denominator = 1;
+  options->scale_factor = DEFAULT_SCALE_FACTOR;
+  options->thread_count = 1;
+
+  while ((option = getopt (argc, argv, "f:r:s:j:o:")) != -1)
+  {
+    switch (option)
+    {
+      case 'f':
+        if (strcmp (optarg, "y4m") == 0)
+          options->format = HEADLESS_OUTPUT_Y4M;
+        else if (strcmp (optarg, "raw") == 0)
+          options->format = HEADLESS_OUTPUT_RAW;
+        else if (strcmp (optarg, "ppm") == 0)
+          options->format = HEADLESS_OUTPUT_PPM;
+        else
+          return 0;
+        break;
+      case 'r':
+        if (!cdplusg_frame_iterator_parse_frame_rate (optarg, &options->fps_numerator, &options->fps_denominator)
+              || options->fps_numerator > (unsigned long long) PACKETS_PER_SECOND * options->fps_denominator)
+          return 0;
+        break;
+      case 's':
+        if (!parse_unsigned (optarg, &options->scale_factor))
+          return 0;
+        break;
+      case 'j':
+        if (!parse_unsigned (optarg, &options->thread_count))
+          return 0;
+        break;
+      case 'o':
+        options->output_filename = optarg;
+        break;
+      default:
+        return 0;
+    }
+  }
+
+  if (optind + 1 != argc)
+    return 0;
+
+  options->input_filename = argv[optind];
+
+  return 1;
+}
+
+static int
+headless_write_frame (const struct headless_options *options, FILE *output,
+              unsigned int frame_index, const unsigned char *pixmap, size_t pixmap_size,
+              unsigned int width, unsigned int height)
+{
+  FILE *frame_output = output;
+
+  // a ppm output name with a printf pattern writes one file per frame
+  if (output == NULL)
+  {
+    char filename [4096];
+
+    if (!filename_pattern_format (filename, sizeof (filename), options->output_filename, frame_index))
+    {
+      fprintf (stderr, "%s: output name for frame %u is too long\n", progname, frame_index);
+      return 0;
+    }
+
+    frame_output = fopen (filename, "wb");
+
+    if (frame_output == NULL)
+    {
+      fprintf (stderr, "%s: error opening file '%s': %s\n", progname, filename, strerror (errno));
+      return 0;
+    }
+  }
+
+  switch (options->format)
+  {
+    case HEADLESS_OUTPUT_Y4M:
+      fputs ("FRAME\n", frame_output);
+      break;
+    case HEADLESS_OUTPUT_PPM:
+      fprintf (frame_output, "P6\n%u %u\n255\n", width, height);
+      break;
+    case HEADLESS_OUTPUT_RAW:
+      break;
+  }
+
+  int success = fwrite (pixmap, pixmap_size, 1, frame_output) == 1;
+
+  if (output == NULL && fclose (frame_output) != 0)
+    success = 0;
+
+  if (!success)
+    fprintf (stderr, "%s: error writing frame %u: %s\n", progname, frame_index, strerror (errno));
+
+  return success;
+}
+
+static void *
+headless_decode_thread (void *data)
+{
+  struct headless_pipeline *pipeline = data;
+  struct cdplusg_graphics_state *gpx_state = cdplusg_graphics_state_new ();
+  struct cdplusg_instruction instruction;
+  struct cdplusg_frame_iterator frame_iterator;
+
+  if (gpx_state == NULL)
+  {
+    fprintf (stderr, "%s: out of memory\n", progname);
+
+    pthread_mutex_lock (&pipeline->mutex);
+    pipeline->aborted = 1;
+    pipeline->decode_done = 1;
+    pthread_cond_broadcast (&pipeline->cond);
+    pthread_mutex_unlock (&pipeline->mutex);
+
+    return NULL;
+  }
+
+  cdplusg_frame_iterator_initialize (&frame_iterator, pipeline->fps_numerator, pipeline->fps_denominator);
+
+  unsigned long packet_count = 0;
+  unsigned long frame_count = 0;
+  int end_of_file = 0;
+
+  while (!end_of_file)
+  {
+    // every frame shows the state after the packets complete by its end
+    unsigned long frame_end = cdplusg_frame_iterator_next (&frame_iterator);
+    unsigned long frame_start = packet_count;
+
+    while (packet_count < frame_end)
+    {
+      if (cdplusg_instruction_initialize_from_file (&instruction, pipeline->input) != 1)
+      {
+        end_of_file = 1;
+        break;
+      }
+
+      cdplusg_graphics_state_apply_instruction (gpx_state, &instruction);
+      packet_count++;
+    }
+
+    // a trailing partial frame is still shown, an empty one is not
+    if (packet_count == frame_start)
+      break;
+
+    pthread_mutex_lock (&pipeline->mutex);
+
+    while (pipeline->decoded - pipeline->written == PIPELINE_DEPTH && !pipeline->aborted)
+      pthread_cond_wait (&pipeline->cond, &pipeline->mutex);
+
+    int aborted = pipeline->aborted;
+    pthread_mutex_unlock (&pipeline->mutex);
+
+    if (aborted)
+      break;
+
+    // snapshot the state so that decoding can run ahead of the conversion
+    struct headless_frame *frame = &pipeline->frames[frame_count % PIPELINE_DEPTH];
+
+    memcpy (frame->gpx_state->pixels, gpx_state->pixels, CDPLUSG_SCREEN_WIDTH * CDPLUSG_SCREEN_HEIGHT);
+    memcpy (frame->gpx_state->color_table, gpx_state->color_table,
+        sizeof (struct cdplusg_color_table_entry) * CDPLUSG_COLOR_TABLE_SIZE);
+
+    frame_count++;
+
+    pthread_mutex_lock (&pipeline->mutex);
+    pipeline->decoded++;
+    pthread_cond_broadcast (&pipeline->cond);
+    pthread_mutex_unlock (&pipeline->mutex);
+  }
+
+  pthread_mutex_lock (&pipeline->mutex);
+  pipeline->decode_done = 1;
+  pthread_cond_broadcast (&pipeline->cond);
+  pthread_mutex_unlock (&pipeline->mutex);
+
+  cdplusg_graphics_state_free (gpx_state);
+
+  return NULL;
+}
+
+static void *
+headless_convert_thread (void *data)
+{
+  struct headless_pipeline *pipeline = data;
+
+  for (;;)
+  {
+    pthread_mutex_lock (&pipeline->mutex);
+
+    while (pipeline->converted == pipeline->decoded && !pipeline->decode_done && !pipeline->aborted)
+      pthread_cond_wait (&pipeline->cond, &pipeline->mutex);
+
+    int finished = pipeline->aborted || pipeline->converted == pipeline->decoded;
+    unsigned int frame_index = pipeline->converted;
+    pthread_mutex_unlock (&pipeline->mutex);
+
+    if (finished)
+      break;
+
+    struct headless_frame *frame = &pipeline->frames[frame_index % PIPELINE_DEPTH];
+    cdplusg_converter_convert (pipeline->converter, frame->gpx_state, frame->pixmap);
+
+    pthread_mutex_lock (&pipeline->mutex);
+    pipeline->converted++;
+    pthread_cond_broadcast (&pipeline->cond);
+    pthread_mutex_unlock (&pipeline->mutex);
+  }
+
+  return NULL;
+}
+
+static int
+headless_run_writer (struct headless_pipeline *pipeline, const struct headless_options *options,
+              FILE *output)
+{
+  unsigned int width = cdplusg_converter_get_width (pipeline->converter);
+  unsigned int height = cdplusg_converter_get_height (pipeline->converter);
+  int success = 1;
+
+  if (options->format == HEADLESS_OUTPUT_Y4M)
+  {
+    // the converter averages chroma over each 2x2 block, which is the centered 420jpeg siting
+    fprintf (output, "YUV4MPEG2 W%u H%u F%u:%u Ip A1:1 C420jpeg XCOLORRANGE=LIMITED\n",
+        width, height, options->fps_numerator, options->fps_denominator);
+  }
+
+  for (;;)
+  {
+    pthread_mutex_lock (&pipeline->mutex);
+
+    // the decoder only finishes once everything it produced was handed on, so when both
+    // counters match after it is done, the converter is done as well
+    while (pipeline->written == pipeline->converted && !pipeline->aborted
+              && !(pipeline->decode_done && pipeline->converted == pipeline->decoded))
+      pthread_cond_wait (&pipeline->cond, &pipeline->mutex);
+
+    int aborted = pipeline->aborted;
+    int finished = pipeline->written == pipeline->converted;
+    unsigned int frame_index = pipeline->written;
+    pthread_mutex_unlock (&pipeline->mutex);
+
+    // another stage gave up, what it would have produced is missing
+    if (aborted)
+    {
+      success = 0;
+      break;
+    }
+
+    if (finished)
+      break;
+
+    struct headless_frame *frame = &pipeline->frames[frame_index % PIPELINE_DEPTH];
+
+    if (!headless_write_frame (options, output, frame_index, frame->pixmap,
+              pipeline->pixmap_size, width, height))
+    {
+      success = 0;
+    }
+
+    pthread_mutex_lock (&pipeline->mutex);
+    pipeline->written++;
+    pipeline->aborted |= !success;
+    pthread_cond_broadcast (&pipeline->cond);
+    pthread_mutex_unlock (&pipeline->mutex);
+
+    if (!success)
+      break;
+  }
+
+  if (output != NULL && fflush (output) != 0)
+  {
+    fprintf (stderr, "%s: error writing output: %s\n", progname, strerror (errno));
+    success = 0;
+  }
+
+  return success;
+}
+
+int
+main (int argc, char **argv)
+{
+  progname = argv[0];
+
+  struct headless_options options;
+
+  if (!parse_options (&options, argc, argv))
+  {
+    usage ();
+    return 1;
+  }
+
+  int to_stdout = options.output_filename == NULL || strcmp (options.output_filename, "-") == 0;
+  int per_frame_files = !to_stdout && filename_pattern_is_pattern (options.output_filename);
+
+  if (per_frame_files && options.format != HEADLESS_OUTPUT_PPM)
+  {
+    fprintf (stderr, "%s: per-frame output names are only supported for ppm\n", progname);
+    return 1;
+  }
+
+  if (per_frame_files && !filename_pattern_is_valid (options.output_filename))
+  {
+    fprintf (stderr, "%s: per-frame output names take a single %%d or %%u and %%%% for any other %%\n",
+        progname);
+    return 1;
+  }
+
+  if (to_stdout && isatty (STDOUT_FILENO))
+  {
+    fprintf (stderr, "%s: refusing to write video to a terminal\n", progname);
+    return 1;
+  }
+
+  struct headless_pipeline pipeline;
+  memset (&pipeline, 0, sizeof (pipeline));
+
+  pipeline.fps_numerator = options.fps_numerator;
+  pipeline.fps_denominator = options.fps_denominator;
+  pipeline.input = fopen (options.input_filename, "rb");
+
+  if (pipeline.input == NULL)
+  {
+    fprintf (stderr, "%s: error opening file '%s': %s\n", progname, options.input_filename,
+        strerror (errno));
+    return 1;
+  }
+
+  FILE *output = NULL;
+
+  if (to_stdout)
+  {
+    output = stdout;
+  }
+  else if (!per_frame_files)
+  {
+    output = fopen (options.output_filename, "wb");
+
+    if (output == NULL)
+    {
+      fprintf (stderr, "%s: error opening file '%s': %s\n", progname, options.output_filename,
+          strerror (errno));
+      fclose (pipeline.input);
+      return 1;
+    }
+  }
+
+  // large stdio buffers keep the reader and the writer out of the kernel most of the time
+  setvbuf (pipeline.input, NULL, _IOFBF, 1 << 16);
+
+  if (output != NULL)
+    setvbuf (output, NULL, _IOFBF, 1 << 20);
+
+  enum cdplusg_pixel_format pixel_format = options.format == HEADLESS_OUTPUT_Y4M
+    ? CDPLUSG_PIXEL_FORMAT_YUV420P : CDPLUSG_PIXEL_FORMAT_RGB24;
+
+  pipeline.converter = cdplusg_converter_create (pixel_format, options.scale_factor);
+
+  if (pipeline.converter == NULL)
+  {
+    fprintf (stderr, "%s: could not create a converter at scale %u\n", progname,
+        options.scale_factor);
+    return 1;
+  }
+
+  if (options.thread_count > 1)
+    cdplusg_converter_set_thread_count (pipeline.converter, options.thread_count);
+
+  pipeline.pixmap_size = cdplusg_converter_get_pixmap_size (pipeline.converter);
+
+  for (unsigned int i = 0; i < PIPELINE_DEPTH; i++)
+  {
+    pipeline.frames[i].gpx_state = cdplusg_graphics_state_new ();
+    pipeline.frames[i].pixmap = malloc (pipeline.pixmap_size);
+
+    if (pipeline.frames[i].gpx_state == NULL || pipeline.frames[i].pixmap == NULL)
+    {
+      fprintf (stderr, "%s: out of memory\n", progname);
+      return 1;
+    }
+  }
+
+  pthread_mutex_init (&pipeline.mutex, NULL);
+  pthread_cond_init (&pipeline.cond, NULL);
+
+  pthread_t decode_thread;
+  pthread_t convert_thread;
+
+  int decode_started = pthread_create (&decode_thread, NULL, headless_decode_thread, &pipeline) == 0;
+  int convert_started = decode_started
+                          && pthread_create (&convert_thread, NULL, headless_convert_thread, &pipeline) == 0;
+  int success;
+
+  if (decode_started && convert_started)
+  {
+    success = headless_run_writer (&pipeline, &options, output);
+  }
+  else
+  {
+    fprintf (stderr, "%s: could not start the pipeline threads\n", progname);
+    success = 0;
+
+    // a decoder that did start stops at the first frame it would hand on
+    pthread_mutex_lock (&pipeline.mutex);
+    pipeline.aborted = 1;
+    pthread_cond_broadcast (&pipeline.cond);
+    pthread_mutex_unlock (&pipeline.mutex);
+  }
+
+  if (decode_started)
+    pthread_join (decode_thread, NULL);
+
+  if (convert_started)
+    pthread_join (convert_thread, NULL);
+
+  pthread_cond_destroy (&pipeline.cond);
+  pthread_mutex_destroy (&pipeline.mutex);
+
+  for (unsigned int i = 0; i < PIPELINE_DEPTH; i++)
+  {
+    cdplusg_graphics_state_free (pipeline.frames[i].gpx_state);
+    free (pipeline.frames[i].pixmap);
+  }
+
+  cdplusg_converter_destroy (pipeline.converter);
+  fclose (pipeline.input);
+
+  if (output != NULL && output != stdout && fclose (output) != 0)
+    success = 0;
+
+  return success ? 0 : 1;
+}
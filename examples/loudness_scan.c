@@ -0,0 +1,116 @@
+#define _DEFAULT_SOURCE
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cdplusg/loudness.h>
+
+static char *progname;
+
+static void
+usage (void)
+{
+  fprintf (stderr,
+      "usage: %s [-j threads] [filename.mp3...]\n"
+      "  with no file names, they are read from standard input, one per line\n",
+      progname);
+}
+
+static double
+loudness_scan_get_time (void)
+{
+  struct timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// Analyzes one file, printing what playback will make of it. The analysis goes to the cache
+// on the way, which is the point of a scan.
+static int
+loudness_scan_file (const char *filename, unsigned int thread_count)
+{
+  struct cdplusg_loudness loudness;
+
+  if (!cdplusg_loudness_analyze (filename, thread_count, &loudness))
+  {
+    fprintf (stderr, "%s: error analyzing file '%s'\n", progname, filename);
+    return 0;
+  }
+
+  printf ("%s: %.1f LUFS, peak %.1f dBFS, gain %+.1f dB\n", filename, loudness.integrated_lufs,
+      20 * log10 (loudness.peak), 20 * log10 (cdplusg_loudness_get_gain (&loudness)));
+
+  return 1;
+}
+
+int
+main (int argc, char **argv)
+{
+  progname = argv[0];
+
+  unsigned int thread_count = 0;
+  int option;
+  char *end;
+
+  while ((option = getopt (argc, argv, "j:")) != -1)
+  {
+    switch (option)
+    {
+      case 'j':
+        thread_count = strtoul (optarg, &end, 10);
+
+        if (*optarg == '\0' || *end != '\0' || thread_count == 0)
+        {
+          usage ();
+          return 1;
+        }
+        break;
+      default:
+        usage ();
+        return 1;
+    }
+  }
+
+  double start_time = loudness_scan_get_time ();
+  unsigned long file_count = 0;
+  unsigned long failed_count = 0;
+
+  if (optind < argc)
+  {
+    for (int i = optind; i < argc; i++, file_count++)
+      failed_count += !loudness_scan_file (argv[i], thread_count);
+  }
+  else
+  {
+    // a whole library does not fit on a command line
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t length;
+
+    while ((length = getline (&line, &line_size, stdin)) != -1)
+    {
+      if (length > 0 && line[length - 1] == '\n')
+        line[--length] = '\0';
+
+      if (length == 0)
+        continue;
+
+      failed_count += !loudness_scan_file (line, thread_count);
+      file_count++;
+    }
+
+    free (line);
+  }
+
+  double elapsed_seconds = loudness_scan_get_time () - start_time;
+
+  fprintf (stderr, "%s: %lu files, %lu failed, in %.2f s, %.1f files a second\n", progname, file_count,
+      failed_count, elapsed_seconds, elapsed_seconds > 0 ? file_count / elapsed_seconds : 0);
+
+  return failed_count > 0;
+}
@@ -0,0 +1,390 @@
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cdplusg.h>
+
+#include "filename_pattern.h"
+
+#define PACKETS_PER_SECOND 300
+#define DEFAULT_INTERVAL 10
+#define DEFAULT_COLUMNS 5
+#define DEFAULT_SCALE_FACTOR 1
+
+// largest block deflate can store without compressing it
+#define PNG_MAX_STORED_BLOCK 65535
+
+static char *progname;
+
+enum thumbnails_output_format
+{
+  THUMBNAILS_OUTPUT_PPM,
+  THUMBNAILS_OUTPUT_PNG
+};
+
+static uint32_t png_crc_table [256];
+
+static void
+png_initialize_crc_table (void)
+{
+  for (uint32_t i = 0; i < 256; i++)
+  {
+    uint32_t crc = i;
+
+    for (int j = 0; j < 8; j++)
+      crc = (crc & 1) ? 0xEDB88320 ^ (crc >> 1) : crc >> 1;
+
+    png_crc_table[i] = crc;
+  }
+}
+
+static uint32_t
+png_update_crc (uint32_t crc, const unsigned char *data, size_t size)
+{
+  for (size_t i = 0; i < size; i++)
+    crc = png_crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+
+  return crc;
+}
+
+static void
+png_put_u32 (unsigned char *bytes, uint32_t value)
+{
+  bytes[0] = value >> 24;
+  bytes[1] = value >> 16;
+  bytes[2] = value >> 8;
+  bytes[3] = value;
+}
+
+static int
+png_write_chunk (FILE *file, const char *type, const unsigned char *data, size_t size)
+{
+  unsigned char header [8];
+  unsigned char footer [4];
+
+  png_put_u32 (header, size);
+  memcpy (&header[4], type, 4);
+
+  uint32_t crc = png_update_crc (0xFFFFFFFF, &header[4], 4);
+  crc = png_update_crc (crc, data, size) ^ 0xFFFFFFFF;
+  png_put_u32 (footer, crc);
+
+  return fwrite (header, sizeof (header), 1, file) == 1
+    && (size == 0 || fwrite (data, size, 1, file) == 1)
+    && fwrite (footer, sizeof (footer), 1, file) == 1;
+}
+
+// Writes an RGB image as PNG. The image data is stored rather than deflated, which keeps
+// this free of a zlib dependency; run the sheets through an optimizer to shrink them.
+static int
+png_write_rgb (FILE *file, const unsigned char *pixels, unsigned int width, unsigned int height)
+{
+  size_t row_size = 3 * (size_t) width;
+  size_t raw_size = (row_size + 1) * height;
+  size_t block_count = (raw_size + PNG_MAX_STORED_BLOCK - 1) / PNG_MAX_STORED_BLOCK;
+  size_t data_size = 2 + raw_size + 5 * block_count + 4;
+
+  unsigned char *raw = (unsigned char *) malloc (raw_size);
+  unsigned char *data = (unsigned char *) malloc (data_size);
+
+  if (raw == NULL || data == NULL)
+  {
+    free (raw);
+    free (data);
+    return 0;
+  }
+
+  // every row starts with filter type 0, no filtering
+  for (unsigned int i = 0; i < height; i++)
+  {
+    raw[i * (row_size + 1)] = 0;
+    memcpy (&raw[i * (row_size + 1) + 1], &pixels[i * row_size], row_size);
+  }
+
+  // zlib header for deflate with a 32k window and no preset dictionary
+  size_t position = 0;
+  data[position++] = 0x78;
+  data[position++] = 0x01;
+
+  uint32_t adler_a = 1;
+  uint32_t adler_b = 0;
+
+  for (size_t offset = 0; offset < raw_size; offset += PNG_MAX_STORED_BLOCK)
+  {
+    size_t block_size = raw_size - offset;
+
+    if (block_size > PNG_MAX_STORED_BLOCK)
+      block_size = PNG_MAX_STORED_BLOCK;
+
+    data[position++] = offset + block_size == raw_size;
+    data[position++] = block_size & 0xFF;
+    data[position++] = block_size >> 8;
+    data[position++] = ~block_size & 0xFF;
+    data[position++] = (~block_size >> 8) & 0xFF;
+
+    memcpy (&data[position], &raw[offset], block_size);
+    position += block_size;
+
+    for (size_t i = 0; i < block_size; i++)
+    {
+      adler_a = (adler_a + raw[offset + i]) % 65521;
+      adler_b = (adler_b + adler_a) % 65521;
+    }
+  }
+
+  png_put_u32 (&data[position], (adler_b << 16) | adler_a);
+  position += 4;
+
+  unsigned char header [13];
+  png_put_u32 (&header[0], width);
+  png_put_u32 (&header[4], height);
+  header[8] = 8;    // bits per sample
+  header[9] = 2;    // truecolor
+  header[10] = 0;   // deflate
+  header[11] = 0;   // adaptive filtering
+  header[12] = 0;   // not interlaced
+
+  int success = fwrite ("\x89PNG\r\n\x1A\n", 8, 1, file) == 1
+    && png_write_chunk (file, "IHDR", header, sizeof (header))
+    && png_write_chunk (file, "IDAT", data, position)
+    && png_write_chunk (file, "IEND", NULL, 0);
+
+  free (raw);
+  free (data);
+
+  return success;
+}
+
+static int
+thumbnails_write_image (const char *filename, enum thumbnails_output_format format,
+              const unsigned char *pixels, unsigned int width, unsigned int height)
+{
+  int to_stdout = strcmp (filename, "-") == 0;
+  FILE *file = to_stdout ? stdout : fopen (filename, "wb");
+
+  if (file == NULL)
+  {
+    fprintf (stderr, "%s: error opening file '%s': %s\n", progname, filename, strerror (errno));
+    return 0;
+  }
+
+  int success;
+
+  if (format == THUMBNAILS_OUTPUT_PNG)
+  {
+    success = png_write_rgb (file, pixels, width, height);
+  }
+  else
+  {
+    success = fprintf (file, "P6\n%u %u\n255\n", width, height) > 0
+      && fwrite (pixels, 3 * (size_t) width * height, 1, file) == 1;
+  }
+
+  if (fflush (file) != 0)
+    success = 0;
+
+  if (!to_stdout && fclose (file) != 0)
+    success = 0;
+
+  if (!success)
+    fprintf (stderr, "%s: error writing '%s': %s\n", progname, filename, strerror (errno));
+
+  return success;
+}
+
+static void
+usage (void)
+{
+  fprintf (stderr,
+      "usage: %s [-i seconds] [-n count] [-s scale] [-c columns] [-f ppm|png] [-o output] filename\n",
+      progname);
+}
+
+static int
+parse_unsigned (const char *string, unsigned int *value)
+{
+  char *end;
+  unsigned long parsed = strtoul (string, &end, 10);
+
+  if (*string == '\0' || *end != '\0' || parsed == 0 || parsed > 100000)
+    return 0;
+
+  *value = (unsigned int) parsed;
+  return 1;
+}
+
+int
+main (int argc, char **argv)
+{
+  progname = argv[0];
+
+  const char *output_filename = "-";
+  enum thumbnails_output_format format = THUMBNAILS_OUTPUT_PPM;
+  unsigned int interval = DEFAULT_INTERVAL;
+  unsigned int max_count = 0;
+  unsigned int scale_factor = DEFAULT_SCALE_FACTOR;
+  unsigned int columns = DEFAULT_COLUMNS;
+  int option;
+
+  while ((option = getopt (argc, argv, "i:n:s:c:f:o:")) != -1)
+  {
+    int valid = 1;
+
+    switch (option)
+    {
+      case 'i':
+        valid = parse_unsigned (optarg, &interval);
+        break;
+      case 'n':
+        valid = parse_unsigned (optarg, &max_count);
+        break;
+      case 's':
+        valid = parse_unsigned (optarg, &scale_factor) && scale_factor <= 8;
+        break;
+      case 'c':
+        valid = parse_unsigned (optarg, &columns);
+        break;
+      case 'f':
+        if (strcmp (optarg, "ppm") == 0)
+          format = THUMBNAILS_OUTPUT_PPM;
+        else if (strcmp (optarg, "png") == 0)
+          format = THUMBNAILS_OUTPUT_PNG;
+        else
+          valid = 0;
+        break;
+      case 'o':
+        output_filename = optarg;
+        break;
+      default:
+        valid = 0;
+        break;
+    }
+
+    if (!valid)
+    {
+      usage ();
+      return 1;
+    }
+  }
+
+  if (optind + 1 != argc)
+  {
+    usage ();
+    return 1;
+  }
+
+  // an output name with a printf pattern writes every thumbnail to its own file, anything
+  // else gets a single contact sheet
+  int separate_files = filename_pattern_is_pattern (output_filename);
+
+  if (separate_files && !filename_pattern_is_valid (output_filename))
+  {
+    fprintf (stderr, "%s: per-thumbnail output names take a single %%d or %%u and %%%% for any other %%\n",
+        progname);
+    return 1;
+  }
+
+  const char *filename = argv[optind];
+  FILE *file = fopen (filename, "rb");
+
+  if (file == NULL)
+  {
+    fprintf (stderr, "%s: error opening file '%s': %s\n", progname, filename, strerror (errno));
+    return 1;
+  }
+
+  struct cdplusg_stream *stream = cdplusg_stream_new_from_file (file);
+  fclose (file);
+
+  if (stream == NULL)
+  {
+    fprintf (stderr, "%s: error reading file '%s'\n", progname, filename);
+    return 1;
+  }
+
+  // one thumbnail at the end of every interval the song lasts
+  size_t packet_count = cdplusg_stream_get_packet_count (stream);
+  size_t interval_packets = (size_t) interval * PACKETS_PER_SECOND;
+  size_t count = packet_count / interval_packets;
+
+  if (max_count != 0 && count > max_count)
+    count = max_count;
+
+  if (count == 0)
+  {
+    fprintf (stderr, "%s: '%s' is shorter than one interval\n", progname, filename);
+    cdplusg_stream_free (stream);
+    return 1;
+  }
+
+  png_initialize_crc_table ();
+
+  struct cdplusg_converter *converter = cdplusg_converter_create (CDPLUSG_PIXEL_FORMAT_RGB24, scale_factor);
+
+  if (converter == NULL)
+  {
+    fprintf (stderr, "%s: could not create a converter at scale %u\n", progname, scale_factor);
+    cdplusg_stream_free (stream);
+    return 1;
+  }
+
+  struct cdplusg_graphics_state *gpx_state = cdplusg_graphics_state_new ();
+
+  unsigned int width = cdplusg_converter_get_width (converter);
+  unsigned int height = cdplusg_converter_get_height (converter);
+
+  unsigned int sheet_columns = separate_files ? 1 : (count < columns ? count : columns);
+  unsigned int sheet_rows = separate_files ? 1 : (count + sheet_columns - 1) / sheet_columns;
+  unsigned int sheet_width = sheet_columns * width;
+  unsigned int sheet_height = sheet_rows * height;
+  size_t pitch = 3 * (size_t) sheet_width;
+
+  unsigned char *sheet = (unsigned char *) calloc (pitch, sheet_height);
+  int success = sheet != NULL;
+
+  for (size_t i = 0; i < count && success; i++)
+  {
+    // seeking only replays what is still visible at the sampled packet and nothing is
+    // converted in between
+    cdplusg_stream_seek (stream, gpx_state, (i + 1) * interval_packets);
+
+    if (separate_files)
+    {
+      char thumbnail_filename [4096];
+
+      cdplusg_converter_convert_rect (converter, gpx_state, NULL, sheet, pitch, 0, 0);
+
+      if (!filename_pattern_format (thumbnail_filename, sizeof (thumbnail_filename), output_filename,
+                (unsigned int) i))
+      {
+        fprintf (stderr, "%s: output name for thumbnail %u is too long\n", progname, (unsigned int) i);
+        success = 0;
+        break;
+      }
+
+      success = thumbnails_write_image (thumbnail_filename, format, sheet, width, height);
+    }
+    else
+    {
+      int x = (i % sheet_columns) * width;
+      int y = (i / sheet_columns) * height;
+
+      cdplusg_converter_convert_rect (converter, gpx_state, NULL, sheet, pitch, x, y);
+    }
+  }
+
+  if (success && !separate_files)
+    success = thumbnails_write_image (output_filename, format, sheet, sheet_width, sheet_height);
+
+  free (sheet);
+  cdplusg_graphics_state_free (gpx_state);
+  cdplusg_converter_destroy (converter);
+  cdplusg_stream_free (stream);
+
+  return success ? 0 : 1;
+}
@@ -1,29 +1,43 @@
 #define _DEFAULT_SOURCE
 
-#include <assert.h>
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
-#include <sys/time.h>
+#include <time.h>
 
 #include <xcb/xcb.h>
 #include <xcb/xcb_image.h>
 
 #include <cdplusg.h>
-#include <cdplusg/portaudio.h>
+#include <cdplusg/audio.h>
 
-#define FPS 30
-#define COMMANDS_PER_FRAME (300 / FPS)
+// redraw rate as a fraction, for example 60000 / 1001 to match a 59.94 Hz display
+#define FPS_NUMERATOR 30
+#define FPS_DENOMINATOR 1
 #define DEFAULT_SCALE_FACTOR 3
 
+// keycodes of the evdev driver X uses on Linux, how far one key press seeks and how much
+// one changes the tempo; page up and down change the key a semitone at a time, and V turns
+// the vocal reduction on and off
+#define XCB_KEYCODE_V 55
+#define XCB_KEYCODE_UP 111
+#define XCB_KEYCODE_PAGE_UP 112
+#define XCB_KEYCODE_LEFT 113
+#define XCB_KEYCODE_RIGHT 114
+#define XCB_KEYCODE_DOWN 116
+#define XCB_KEYCODE_PAGE_DOWN 117
+#define SEEK_STEP_MS 5000
+#define TEMPO_STEP 0.05
+#define MIN_TEMPO 0.5
+#define MAX_TEMPO 2.0
+#define MAX_SEMITONES 6
+
 #define XCB_SCREEN_WIDTH (DEFAULT_SCALE_FACTOR * CDPLUSG_SCREEN_WIDTH)
 #define XCB_SCREEN_HEIGHT (DEFAULT_SCALE_FACTOR * CDPLUSG_SCREEN_HEIGHT)
 
-static_assert (300 % FPS == 0, "Frames per second must divide 300.");
-
 static char *progname;
 
 struct cdplusg_xcb_context
@@ -34,11 +48,46 @@ struct cdplusg_xcb_context
   size_t            image_data_size;
   unsigned char    *image_data;
 
+  // where the tiles changed since the last update are converted to on their own, so that
+  // only they go to the server
+  unsigned char    *update_data;
+
+  // what the window shows, which anything but the dirty tiles changing redraws in full
+  int               has_frame;
+  unsigned int      frame_x;
+  unsigned int      frame_y;
+  unsigned int      palette_version;
+
   xcb_window_t      window;
-  xcb_pixmap_t      pixmap;
   xcb_gcontext_t    gcontext;
+
+  struct cdplusg_converter *converter;
 };
 
+static struct cdplusg_converter *
+cdplusg_xcb_create_converter_for_visual (xcb_screen_t *screen)
+{
+  xcb_depth_iterator_t depth_iterator = xcb_screen_allowed_depths_iterator (screen);
+
+  for (; depth_iterator.rem; xcb_depth_next (&depth_iterator))
+  {
+    xcb_visualtype_iterator_t visual_iterator = xcb_depth_visuals_iterator (depth_iterator.data);
+
+    for (; visual_iterator.rem; xcb_visualtype_next (&visual_iterator))
+    {
+      xcb_visualtype_t *visual = visual_iterator.data;
+
+      if (visual->visual_id == screen->root_visual && depth_iterator.data->depth == 24)
+      {
+        return cdplusg_converter_create_from_masks (4, visual->red_mask, visual->green_mask,
+                 visual->blue_mask, DEFAULT_SCALE_FACTOR);
+      }
+    }
+  }
+
+  return cdplusg_converter_create (CDPLUSG_PIXEL_FORMAT_BGRA, DEFAULT_SCALE_FACTOR);
+}
+
 void
 cdplusg_xcb_context_initialize (struct cdplusg_xcb_context *context)
 {
@@ -56,7 +105,7 @@ cdplusg_xcb_context_initialize (struct cdplusg_xcb_context *context)
   xcb_screen_t *screen = iterator.data;
 
   unsigned int mask = XCB_CW_BACK_PIXEL | XCB_CW_EVENT_MASK;
-  unsigned int value_mask = XCB_EVENT_MASK_EXPOSURE;
+  unsigned int value_mask = XCB_EVENT_MASK_EXPOSURE | XCB_EVENT_MASK_KEY_PRESS;
   unsigned int values [] = { screen->black_pixel, value_mask };
 
   context->window = xcb_generate_id (context->connection);
@@ -64,17 +113,22 @@ cdplusg_xcb_context_initialize (struct cdplusg_xcb_context *context)
         0, 0, XCB_SCREEN_WIDTH, XCB_SCREEN_HEIGHT,
 		    0, XCB_WINDOW_CLASS_INPUT_OUTPUT,	screen->root_visual, mask, values);
 
-  context->image_data_size =
-        DEFAULT_SCALE_FACTOR * DEFAULT_SCALE_FACTOR * 4 * CDPLUSG_SCREEN_WIDTH * CDPLUSG_SCREEN_HEIGHT;
+  context->converter = cdplusg_xcb_create_converter_for_visual (screen);
 
-  context->image_data = (unsigned char *) malloc (context->image_data_size);
+  if (context->converter == NULL)
+  {
+    fprintf (stderr, "%s: could not create a converter for the screen\n", progname);
+    exit (1);
+  }
+
+  context->image_data_size = cdplusg_converter_get_pixmap_size (context->converter);
 
-  context->pixmap = xcb_generate_id (context->connection);
-  xcb_create_pixmap (context->connection, 24, context->pixmap, context->window,
-        XCB_SCREEN_WIDTH, XCB_SCREEN_HEIGHT);
+  context->image_data = (unsigned char *) malloc (context->image_data_size);
+  context->update_data = (unsigned char *) malloc (context->image_data_size);
+  context->has_frame = 0;
 
   context->gcontext = xcb_generate_id (context->connection);
-  xcb_create_gc (context->connection, context->gcontext, context->pixmap, 0, NULL);
+  xcb_create_gc (context->connection, context->gcontext, context->window, 0, NULL);
 
   context->xcb_image = xcb_image_create_native (context->connection,
 	      XCB_SCREEN_WIDTH, XCB_SCREEN_HEIGHT,
@@ -84,16 +138,12 @@ cdplusg_xcb_context_initialize (struct cdplusg_xcb_context *context)
   xcb_map_window (context->connection, context->window);
 }
 
+// Puts the tiles of gpx_state that changed since the last update in the window, or the whole
+// frame with is_full_redraw, as after a seek or when the window was exposed.
 void
 cdplusg_xcb_context_update_from_gpx_state (struct cdplusg_xcb_context *context,
-              struct cdplusg_graphics_state *gpx_state)
+              struct cdplusg_graphics_state *gpx_state, int is_full_redraw)
 {
-  cdplusg_graphics_state_to_pixmap
-    (gpx_state, context->image_data, DEFAULT_SCALE_FACTOR, CDPLUSG_BYTE_ORDER_BGR);
-
-  xcb_image_put
-    (context->connection, context->pixmap, context->gcontext, context->xcb_image, 0, 0, 0);
-
   xcb_get_geometry_cookie_t cookie = xcb_get_geometry (context->connection, context->window);
   xcb_get_geometry_reply_t *reply = xcb_get_geometry_reply (context->connection, cookie, NULL);
 
@@ -110,18 +160,157 @@ cdplusg_xcb_context_update_from_gpx_state (struct cdplusg_xcb_context *context,
     y = (reply->height - XCB_SCREEN_HEIGHT) / 2;
   }
 
-  xcb_copy_area (context->connection, context->pixmap, context->window, context->gcontext,
-      0, 0, x, y, XCB_SCREEN_WIDTH, XCB_SCREEN_HEIGHT);
+  free (reply);
+
+  // a new palette changes pixels without dirtying their tiles, and a frame that moved
+  // with the window has to be drawn again all over
+  if (!context->has_frame || gpx_state->palette_version != context->palette_version
+        || x != context->frame_x || y != context->frame_y)
+    is_full_redraw = 1;
+
+  struct cdplusg_rect rect;
+
+  if (is_full_redraw)
+  {
+    // convert straight into the image, honoring its stride, and put it at the centered
+    // position in the window without going through an intermediate pixmap
+    cdplusg_converter_convert_rect
+      (context->converter, gpx_state, NULL, context->image_data, context->xcb_image->stride, 0, 0);
+
+    xcb_image_put
+      (context->connection, context->window, context->gcontext, context->xcb_image, x, y, 0);
+  }
+  else if (cdplusg_graphics_state_get_dirty_rect (gpx_state, &rect))
+  {
+    // an image of just the dirty rectangle, the frame placed so that the rectangle lands
+    // at its top left corner
+    int rect_x = rect.x * DEFAULT_SCALE_FACTOR;
+    int rect_y = rect.y * DEFAULT_SCALE_FACTOR;
+
+    xcb_image_t *update_image = xcb_image_create_native (context->connection,
+        rect.width * DEFAULT_SCALE_FACTOR, rect.height * DEFAULT_SCALE_FACTOR,
+        XCB_IMAGE_FORMAT_Z_PIXMAP, 24, NULL, context->image_data_size, context->update_data);
+
+    if (update_image != NULL)
+    {
+      cdplusg_converter_convert_rect (context->converter, gpx_state, &rect, context->update_data,
+          update_image->stride, -rect_x, -rect_y);
+
+      xcb_image_put (context->connection, context->window, context->gcontext, update_image,
+          x + rect_x, y + rect_y, 0);
+
+      xcb_image_destroy (update_image);
+    }
+  }
+
+  cdplusg_graphics_state_clear_dirty (gpx_state);
+
+  context->has_frame = 1;
+  context->frame_x = x;
+  context->frame_y = y;
+  context->palette_version = gpx_state->palette_version;
+
   xcb_flush (context->connection);
 }
 
+// without audio, the graphics just follow the time since start
+static double
+cdplusg_xcb_wall_clock (void *user_data)
+{
+  const struct timespec *start_time = (const struct timespec *) user_data;
+  struct timespec now;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+
+  return (now.tv_sec - start_time->tv_sec) + (now.tv_nsec - start_time->tv_nsec) / 1e9;
+}
+
+// Seeks audio and graphics together by step_ms from where the clock is now. Without audio,
+// the wall clock is moved instead by shifting its start.
+static void
+cdplusg_xcb_seek (struct cdplusg_player *player, struct cdplusg_audio *audio,
+              struct timespec *start_time, int step_ms)
+{
+  double position = audio->backend
+    ? cdplusg_audio_clock (audio)
+    : cdplusg_xcb_wall_clock (start_time);
+
+  double target = 1000 * position + step_ms;
+  unsigned int ms = target > 0 ? (unsigned int) target : 0;
+
+  if (audio->backend)
+  {
+    audio->backend->seek (audio->context, ms);
+  }
+  else
+  {
+    clock_gettime (CLOCK_MONOTONIC, start_time);
+
+    long long start_ns = start_time->tv_sec * 1000000000LL + start_time->tv_nsec - ms * 1000000LL;
+    start_time->tv_sec = start_ns / 1000000000;
+    start_time->tv_nsec = start_ns % 1000000000;
+
+    if (start_time->tv_nsec < 0)
+    {
+      start_time->tv_sec--;
+      start_time->tv_nsec += 1000000000;
+    }
+  }
+
+  cdplusg_player_seek (player, ms);
+}
+
+// Changes the tempo of the audio by step, which the graphics follow through its clock; the
+// wall clock has no tempo to change.
+static void
+cdplusg_xcb_change_tempo (struct cdplusg_audio *audio, double *tempo, double step)
+{
+  double next_tempo = *tempo + step;
+
+  if (audio->backend == NULL || next_tempo < MIN_TEMPO - 1e-9 || next_tempo > MAX_TEMPO + 1e-9)
+    return;
+
+  *tempo = next_tempo;
+  audio->backend->set_tempo (audio->context, *tempo);
+
+  fprintf (stderr, "%s: debug: playing at %.0f%% of the original tempo\n", progname, 100 * *tempo);
+}
+
+static void
+cdplusg_xcb_change_pitch (struct cdplusg_audio *audio, int *semitones, int step)
+{
+  int next_semitones = *semitones + step;
+
+  if (audio->backend == NULL || next_semitones < -MAX_SEMITONES || next_semitones > MAX_SEMITONES)
+    return;
+
+  *semitones = next_semitones;
+  audio->backend->set_pitch (audio->context, *semitones);
+
+  fprintf (stderr, "%s: debug: playing %+d semitones from the original key\n", progname, *semitones);
+}
+
+static void
+cdplusg_xcb_toggle_vocal_reduction (struct cdplusg_audio *audio, int *is_vocal_reduced)
+{
+  if (audio->backend == NULL)
+    return;
+
+  *is_vocal_reduced = !*is_vocal_reduced;
+  audio->backend->set_vocal_reduction (audio->context, *is_vocal_reduced ? 1 : 0);
+
+  fprintf (stderr, "%s: debug: vocal reduction %s\n", progname, *is_vocal_reduced ? "on" : "off");
+}
+
 void
 cdplusg_xcb_context_destroy (struct cdplusg_xcb_context *context)
 {
   xcb_image_destroy (context->xcb_image);
-  xcb_free_pixmap (context->connection, context->pixmap);
+  xcb_free_gc (context->connection, context->gcontext);
   xcb_disconnect (context->connection);
+  cdplusg_converter_destroy (context->converter);
   free (context->image_data);
+  free (context->update_data);
 }
 
 int
@@ -129,14 +318,27 @@ main (int argc, char **argv)
 {
   progname = argv[0];
 
-  char *filename = argv[1];
+  const char *audio_backend_name = NULL;
+  int is_usage_error = 0;
+  int option;
 
-  if (argc != 2)
+  // without -a the first backend that works is used
+  while ((option = getopt (argc, argv, "a:")) != -1)
   {
-    fprintf (stderr, "usage: %s [filename]\n", progname);
+    if (option == 'a')
+      audio_backend_name = optarg;
+    else
+      is_usage_error = 1;
+  }
+
+  if (is_usage_error || optind + 1 != argc)
+  {
+    fprintf (stderr, "usage: %s [-a alsa|portaudio|null] [filename]\n", progname);
     return 1;
   }
 
+  char *filename = argv[optind];
+
   FILE *file = fopen (filename, "r");
 
   if (file == NULL)
@@ -145,11 +347,23 @@ main (int argc, char **argv)
     return 1;
   }
 
+  struct cdplusg_stream *stream = cdplusg_stream_new_from_file (file);
+  fclose (file);
+
+  if (stream == NULL)
+  {
+    fprintf (stderr, "%s: error reading file '%s'\n", progname, filename);
+    return 1;
+  }
+
   char audio_filename [256];
   const char *audio_file_extensions [] = { ".mp3" };
   const char *audio_file_extension = audio_file_extensions[0];
 
-  struct cdplusg_portaudio_context *audio_context = NULL;
+  struct cdplusg_audio audio = { NULL, NULL };
+  double tempo = 1;
+  int semitones = 0;
+  int is_vocal_reduced = 0;
 
   char *last_dot = strrchr (filename, '.');
 
@@ -169,61 +383,98 @@ main (int argc, char **argv)
     strcpy (audio_filename, filename);
     strcat (audio_filename, audio_file_extension);
 
-    audio_context = cdplusg_portaudio_context_initialize (audio_filename, 1);
+    cdplusg_audio_open (&audio, audio_backend_name, audio_filename, tempo, semitones, NULL);
   }
 
   struct cdplusg_xcb_context xcb_context;
 
   cdplusg_xcb_context_initialize (&xcb_context);
 
-  struct cdplusg_instruction instruction;
-  struct cdplusg_graphics_state *gpx_state = cdplusg_graphics_state_new ();
+  struct timespec start_time;
+  clock_gettime (CLOCK_MONOTONIC, &start_time);
 
-  struct timeval previous_time;
-  gettimeofday (&previous_time, NULL);
-  
-  struct timeval time_stride;
-  timerclear (&time_stride);
+  // redraws are paced from their own start, which seeking leaves alone
+  struct timespec redraw_start_time = start_time;
 
-  time_stride.tv_usec = 10000 * COMMANDS_PER_FRAME / 3;
-  static_assert (10000 * COMMANDS_PER_FRAME / 3 <= 999999, "too many commands per frame");
+  struct cdplusg_player *player = audio.backend
+    ? cdplusg_player_new (stream, cdplusg_audio_clock, &audio)
+    : cdplusg_player_new (stream, cdplusg_xcb_wall_clock, &start_time);
 
-  unsigned int counter = 0;
+  if (player == NULL)
+  {
+    fprintf (stderr, "%s: could not create a player\n", progname);
+    exit (1);
+  }
+
+  struct cdplusg_frame_iterator frame_iterator;
+  cdplusg_frame_iterator_initialize (&frame_iterator, FPS_NUMERATOR, FPS_DENOMINATOR);
 
-  while (cdplusg_instruction_initialize_from_file (&instruction, file) == 1)
+  // the clock decides which packets are due, this loop only decides how often to look; the
+  // redraw deadlines come from the frame count, so they do not drift at fractional rates
+  while (!cdplusg_player_is_finished (player))
   {
-    counter++;
-    cdplusg_graphics_state_apply_instruction (gpx_state, &instruction);
+    xcb_generic_event_t *event;
+    int redraw = 0;
+    int is_full_redraw = 0;
 
-    if (counter % COMMANDS_PER_FRAME == 0)
+    while ((event = xcb_poll_for_event (xcb_context.connection)) != NULL)
     {
-      cdplusg_xcb_context_update_from_gpx_state (&xcb_context, gpx_state);
+      if ((event->response_type & ~0x80) == XCB_EXPOSE)
+      {
+        redraw = 1;
+        is_full_redraw = 1;
+      }
+      else if ((event->response_type & ~0x80) == XCB_KEY_PRESS)
+      {
+        xcb_keycode_t keycode = ((xcb_key_press_event_t *) event)->detail;
+
+        if (keycode == XCB_KEYCODE_LEFT || keycode == XCB_KEYCODE_RIGHT)
+        {
+          cdplusg_xcb_seek (player, &audio, &start_time,
+              keycode == XCB_KEYCODE_LEFT ? -SEEK_STEP_MS : SEEK_STEP_MS);
+          redraw = 1;
+          is_full_redraw = 1;
+        }
+        else if (keycode == XCB_KEYCODE_UP || keycode == XCB_KEYCODE_DOWN)
+        {
+          cdplusg_xcb_change_tempo (&audio, &tempo, keycode == XCB_KEYCODE_UP ? TEMPO_STEP : -TEMPO_STEP);
+        }
+        else if (keycode == XCB_KEYCODE_PAGE_UP || keycode == XCB_KEYCODE_PAGE_DOWN)
+        {
+          cdplusg_xcb_change_pitch (&audio, &semitones, keycode == XCB_KEYCODE_PAGE_UP ? 1 : -1);
+        }
+        else if (keycode == XCB_KEYCODE_V)
+        {
+          cdplusg_xcb_toggle_vocal_reduction (&audio, &is_vocal_reduced);
+        }
+      }
 
-      struct timeval next_time;
-      struct timeval time_difference;
+      free (event);
+    }
 
-      gettimeofday (&next_time, NULL);
-      timersub (&next_time, &previous_time, &time_difference);
+    if (cdplusg_player_update (player) > 0 || redraw)
+      cdplusg_xcb_context_update_from_gpx_state (&xcb_context, cdplusg_player_get_graphics_state (player),
+          is_full_redraw);
 
-      while (timercmp (&time_difference, &time_stride, <))
-      {
-        struct timeval remaining_time;
+    uint64_t elapsed_us = 1000000 * cdplusg_xcb_wall_clock (&redraw_start_time);
 
-        timersub (&time_stride, &time_difference, &remaining_time);
+    // skip the deadlines already missed rather than drawing in a burst to catch up
+    while (cdplusg_frame_iterator_get_next_time_us (&frame_iterator) <= elapsed_us)
+      cdplusg_frame_iterator_next (&frame_iterator);
 
-        usleep (3 * remaining_time.tv_usec / 4);
+    usleep (cdplusg_frame_iterator_get_next_time_us (&frame_iterator) - elapsed_us);
+  }
 
-        gettimeofday (&next_time, NULL);
-	      timersub (&next_time, &previous_time, &time_difference);
-      }
+  struct cdplusg_player_statistics statistics;
+  cdplusg_player_get_statistics (player, &statistics);
 
-      timeradd (&previous_time, &time_stride, &previous_time);
-    }
-  }
+  fprintf (stderr, "%s: debug: %lu updates, %lu resyncs, drift mean %.2f ms, max %.2f ms\n", progname,
+      statistics.update_count, statistics.resync_count, statistics.mean_drift_ms, statistics.max_drift_ms);
 
-  cdplusg_graphics_state_free (gpx_state);
+  cdplusg_player_free (player);
+  cdplusg_stream_free (stream);
   cdplusg_xcb_context_destroy (&xcb_context);
-  cdplusg_portaudio_context_destroy (audio_context);
+  cdplusg_audio_close (&audio);
 
   return 0;
 }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stdint.h>
 #include <stdio.h> // for FILE *
 
 #define CDPLUSG_SCREEN_HEIGHT 216
@@ -8,7 +9,14 @@
 #define CDPLUSG_FONT_HEIGHT 12
 #define CDPLUSG_FONT_WIDTH  6
 
+#define CDPLUSG_TILE_ROWS    (CDPLUSG_SCREEN_HEIGHT / CDPLUSG_FONT_HEIGHT)
+#define CDPLUSG_TILE_COLUMNS (CDPLUSG_SCREEN_WIDTH / CDPLUSG_FONT_WIDTH)
+
+// two color table loads, a MEMORY_PRESET and at most four packets for each tile
+#define CDPLUSG_MAX_SYNTHESIZED_INSTRUCTIONS (3 + 4 * CDPLUSG_TILE_ROWS * CDPLUSG_TILE_COLUMNS)
+
 #define CDPLUSG_SUBCHANNEL_WIDTH 24
+#define CDPLUSG_PACKETS_PER_SECOND 300
 #define CDPLUSG_INSTRUCTION_DATA_WIDTH 16
 
 #define CDPLUSG_COLOR_TABLE_SIZE 16
@@ -39,6 +47,29 @@ enum cdplusg_byte_order
   CDPLUSG_BYTE_ORDER_BGR
 };
 
+enum cdplusg_pixel_format
+{
+  CDPLUSG_PIXEL_FORMAT_RGBA,      // bytes r, g, b, 0xFF
+  CDPLUSG_PIXEL_FORMAT_BGRA,      // bytes b, g, r, 0xFF
+  CDPLUSG_PIXEL_FORMAT_XRGB8888,  // native-endian 32-bit words, 0x00RRGGBB
+  CDPLUSG_PIXEL_FORMAT_ARGB8888,  // native-endian 32-bit words, 0xFFRRGGBB
+  CDPLUSG_PIXEL_FORMAT_RGB24,     // bytes r, g, b
+  CDPLUSG_PIXEL_FORMAT_BGR24,     // bytes b, g, r
+  CDPLUSG_PIXEL_FORMAT_RGB565,    // native-endian 16-bit words
+  CDPLUSG_PIXEL_FORMAT_GRAY8,     // one byte of BT.601 luma
+  CDPLUSG_PIXEL_FORMAT_INDEX8,    // one byte holding the color table index
+  CDPLUSG_PIXEL_FORMAT_YUV420P,   // BT.601 planes Y, U, V with 2x2 chroma subsampling
+  CDPLUSG_PIXEL_FORMAT_NV12,      // BT.601 plane Y followed by an interleaved UV plane
+  CDPLUSG_PIXEL_FORMAT_INDEX4     // two color table indices per byte, left pixel in the high nibble
+};
+
+enum cdplusg_scaler
+{
+  CDPLUSG_SCALER_NEAREST,
+  CDPLUSG_SCALER_SCALE2X,
+  CDPLUSG_SCALER_SCALE3X
+};
+
 struct cdplusg_color_table_entry
 {
   unsigned char b;
@@ -47,6 +78,54 @@ struct cdplusg_color_table_entry
   unsigned char a;
 };
 
+struct cdplusg_rect
+{
+  int x;
+  int y;
+  int width;
+  int height;
+};
+
+/** Splits a stream into output frames at a rational frame rate, numerator / denominator
+ * frames per second, for example 30000 / 1001. Packet k is complete (k + 1) / 300 seconds
+ * into the song and frame n, which ends (n + 1) * denominator / numerator seconds in, shows
+ * every packet complete by then. The packet count is kept as an exact quotient and
+ * remainder, so it never drifts however long the song is.
+ **/
+struct cdplusg_frame_iterator
+{
+  unsigned int numerator;
+  unsigned int denominator;
+
+  // frames and packets covered by the frames returned so far
+  uint64_t frame;
+  uint64_t packet;
+
+  // 300 * denominator / numerator, the packets of one frame, as quotient and remainder,
+  // and the remainder carried over from the frames so far
+  uint64_t step_quotient;
+  uint64_t step_remainder;
+  uint64_t remainder;
+};
+
+/** Returns the position of the audio being heard right now, in seconds of the song. **/
+typedef double (*cdplusg_player_clock) (void *user_data);
+
+/** How closely the graphics followed the clock, drift being how far the clock was ahead of
+ * the last applied packet right after each update.
+ **/
+struct cdplusg_player_statistics
+{
+  unsigned long update_count;
+  unsigned long packet_count;
+  unsigned long resync_count;
+  size_t max_batch_size;
+
+  double last_drift_ms;
+  double mean_drift_ms;
+  double max_drift_ms;
+};
+
 struct cdplusg_instruction
 {
   enum cdplusg_instruction_type type;
@@ -70,11 +149,63 @@ struct cdplusg_graphics_state
 {
   unsigned char *pixels;
   struct cdplusg_color_table_entry *color_table;
+
+  // incremented whenever the contents of the color table change
+  unsigned int palette_version;
+
+  // bit c of entry r is set once tile (r, c) has been written to, until the next
+  // cdplusg_graphics_state_clear_dirty; a new state starts out entirely dirty
+  uint64_t dirty_tiles [CDPLUSG_TILE_ROWS];
 };
 
+/** Converts graphics states to pixmaps of a fixed pixel format and scale factor.
+ * The conversion kernel is chosen once, when the converter is created, so there is
+ * no per-pixel branching on the format or scale factor.
+ *
+ * Converters created with cdplusg_converter_create_scaled produce an arbitrary output
+ * size instead: the color indices are first upscaled with the chosen scaler (Scale2x
+ * and Scale3x smooth the diagonal edges of lyric text) and then resampled to the
+ * output size with nearest neighbor.
+ **/
+struct cdplusg_converter;
+
+/** A whole CD+G stream held in memory, parsed once and indexed so that the graphics state
+ * at any packet can be rebuilt without replaying everything before it. Seeking starts from
+ * the last full-screen MEMORY_PRESET, restores only the last palette loads, and skips every
+ * tile write that a later TILE_BLOCK hides. A stream can be used by one thread at a time.
+ **/
+struct cdplusg_stream;
+
+/** Encodes a sequence of target frames into CD+G instructions. The encoder keeps the graphics
+ * state a player would have after everything it emitted, and every encode call diffs the
+ * current target against it: the color table is loaded first, a MEMORY_PRESET with the
+ * dominant color is sent when that is cheaper than patching the screen, and then changed tiles
+ * are drawn with the fewest TILE_BLOCK / TILE_BLOCK_XOR packets, most visible change first,
+ * until the packet budget of the call is used up. Tiles left over are drawn by later calls.
+ **/
+struct cdplusg_encoder;
+
+/** Plays a stream against an external clock, normally the audio output position, instead of
+ * pacing itself: every update reads the clock and applies exactly the packets due by then in
+ * one batch, so playback speed changes, underruns and pauses in the audio are followed for
+ * free. Small backward steps of the clock are ignored; larger jumps in either direction
+ * resynchronize through cdplusg_stream_seek. The stream must outlive the player.
+ **/
+struct cdplusg_player;
+
 void cdplusg_instruction_initialize_from_subchannel (struct cdplusg_instruction *instruction, const char *subchannel);
 int cdplusg_instruction_initialize_from_file (struct cdplusg_instruction *instruction, FILE *file);
 
+/** Writes instructions back as 24-byte subchannel packets, the inverse of
+ * cdplusg_instruction_initialize_from_subchannel. Colors are rounded to the 4 bits per
+ * primary a packet carries. With with_parity set the Q and P Reed-Solomon parity symbols
+ * over GF(64) are filled in, otherwise they are left 0 like most .cdg rips, which players
+ * ignore anyway. NO_OP is written as an all-zero packet.
+ **/
+void cdplusg_instruction_to_subchannel (const struct cdplusg_instruction *instruction, char *subchannel, int with_parity);
+void cdplusg_instructions_to_subchannel (const struct cdplusg_instruction *instructions, size_t count, char *subchannel, int with_parity);
+int cdplusg_instructions_write_to_file (const struct cdplusg_instruction *instructions, size_t count, FILE *file, int with_parity);
+
 void cdplusg_instruction_initialize_no_op (struct cdplusg_instruction *instruction);
 void cdplusg_instruction_initialize_border_preset (struct cdplusg_instruction *instruction, unsigned char color);
 void cdplusg_instruction_initialize_memory_preset (struct cdplusg_instruction *instruction, unsigned char color, char repeat);
@@ -92,5 +223,112 @@ void cdplusg_instruction_initialize_load_color_table_high (struct cdplusg_instru
 struct cdplusg_graphics_state *cdplusg_graphics_state_new (void);
 void cdplusg_graphics_state_free (struct cdplusg_graphics_state *state);
 void cdplusg_graphics_state_apply_instruction (struct cdplusg_graphics_state *state, struct cdplusg_instruction *instruction);
+/** Copies the 16-entry color table and returns its version. Consumers of INDEX8 or
+ * INDEX4 output only need to fetch the palette again when the version changes.
+ **/
+unsigned int cdplusg_graphics_state_get_palette (const struct cdplusg_graphics_state *state, struct cdplusg_color_table_entry *palette);
+
+/** Stores the bounding box, in screen pixels, of all tiles written to since the last call
+ * to cdplusg_graphics_state_clear_dirty. Returns 0, leaving rect untouched, when nothing
+ * was written. Palette changes are tracked by the palette version instead.
+ **/
+int cdplusg_graphics_state_get_dirty_rect (const struct cdplusg_graphics_state *state, struct cdplusg_rect *rect);
+void cdplusg_graphics_state_clear_dirty (struct cdplusg_graphics_state *state);
+
+/** Fills instructions, which must have room for CDPLUSG_MAX_SYNTHESIZED_INSTRUCTIONS, with a
+ * short sequence that recreates state on any player regardless of what it showed before:
+ * both color table loads, a MEMORY_PRESET with the most common color, and for every other
+ * tile the cheapest TILE_BLOCK color pair plus XORs for any further colors. Prepending it to
+ * a stream cut at the same point makes the cut play as if started from the beginning.
+ * Returns the number of instructions.
+ **/
+size_t cdplusg_graphics_state_synthesize (const struct cdplusg_graphics_state *state, struct cdplusg_instruction *instructions);
+
 void cdplusg_graphics_state_to_pixmap (struct cdplusg_graphics_state *gpx_state, unsigned char *pixmap, unsigned int scale_factor, enum cdplusg_byte_order byte_order);
 
+struct cdplusg_stream *cdplusg_stream_new_from_file (FILE *file);
+struct cdplusg_stream *cdplusg_stream_new_from_memory (const void *data, size_t size);
+void cdplusg_stream_free (struct cdplusg_stream *stream);
+size_t cdplusg_stream_get_packet_count (const struct cdplusg_stream *stream);
+const struct cdplusg_instruction *cdplusg_stream_get_instruction (const struct cdplusg_stream *stream, size_t packet);
+
+/** Sets state to what it is after applying the first packet packets of the stream, the
+ * same as replaying them into a new state. The whole screen is marked dirty.
+ **/
+void cdplusg_stream_seek (struct cdplusg_stream *stream, struct cdplusg_graphics_state *state, size_t packet);
+
+/** Returns 0 for a zero numerator or denominator. **/
+int cdplusg_frame_iterator_initialize (struct cdplusg_frame_iterator *iterator, unsigned int numerator, unsigned int denominator);
+
+/** Parses a frame rate given as a whole number, a decimal like 59.94 or a fraction like
+ * 60000/1001 into the numerator and denominator for cdplusg_frame_iterator_initialize.
+ * Returns 0 for anything else, or for a rate of zero.
+ **/
+int cdplusg_frame_iterator_parse_frame_rate (const char *string, unsigned int *numerator, unsigned int *denominator);
+
+/** Moves on to the next frame and returns its end: the packets from the previous end up to
+ * this one are the ones new in it. Frames may be empty when the frame rate exceeds 300.
+ **/
+uint64_t cdplusg_frame_iterator_next (struct cdplusg_frame_iterator *iterator);
+
+/** Microseconds from the start of the song to the end of the next frame. **/
+uint64_t cdplusg_frame_iterator_get_next_time_us (const struct cdplusg_frame_iterator *iterator);
+
+struct cdplusg_player *cdplusg_player_new (struct cdplusg_stream *stream, cdplusg_player_clock clock, void *user_data);
+void cdplusg_player_free (struct cdplusg_player *player);
+struct cdplusg_graphics_state *cdplusg_player_get_graphics_state (struct cdplusg_player *player);
+
+/** Brings the graphics state up to the clock and returns how many packets were applied. **/
+size_t cdplusg_player_update (struct cdplusg_player *player);
+
+/** Jumps to ms into the song by restoring the state from the last keyframe before it, rather
+ * than replaying. Seek the audio first, so that the next update finds the clock there too.
+ **/
+void cdplusg_player_seek (struct cdplusg_player *player, unsigned int ms);
+
+/** Number of packets applied so far, which is also the next packet to apply. **/
+size_t cdplusg_player_get_packet (const struct cdplusg_player *player);
+int cdplusg_player_is_finished (const struct cdplusg_player *player);
+void cdplusg_player_get_statistics (const struct cdplusg_player *player, struct cdplusg_player_statistics *statistics);
+
+struct cdplusg_encoder *cdplusg_encoder_new (void);
+void cdplusg_encoder_free (struct cdplusg_encoder *encoder);
+const struct cdplusg_graphics_state *cdplusg_encoder_get_graphics_state (const struct cdplusg_encoder *encoder);
+
+/** Sets the next target frame, as 300x216 color table indices with the color table they refer
+ * to, or as RGB24 pixels rows pitch bytes apart. RGB frames are reduced to the 16 most frequent
+ * colors CD+G can show; colors already loaded keep their index so that little is resent.
+ **/
+void cdplusg_encoder_set_frame_indexed (struct cdplusg_encoder *encoder, const unsigned char *indices, const struct cdplusg_color_table_entry *palette);
+void cdplusg_encoder_set_frame_rgb (struct cdplusg_encoder *encoder, const unsigned char *rgb, size_t pitch);
+
+/** Emits at most max_count instructions towards the target frame, for example 10 for one
+ * frame at 30 frames per second given the 300 packets per second of CD+G. Returns how many
+ * were written, 0 once the screen matches the target; pad with NO_OP packets as needed.
+ **/
+size_t cdplusg_encoder_encode (struct cdplusg_encoder *encoder, struct cdplusg_instruction *instructions, size_t max_count);
+
+struct cdplusg_converter *cdplusg_converter_create (enum cdplusg_pixel_format format, unsigned int scale_factor);
+struct cdplusg_converter *cdplusg_converter_create_from_masks (unsigned int bytes_per_pixel, uint32_t red_mask, uint32_t green_mask, uint32_t blue_mask, unsigned int scale_factor);
+struct cdplusg_converter *cdplusg_converter_create_scaled (enum cdplusg_pixel_format format, enum cdplusg_scaler scaler, unsigned int width, unsigned int height);
+void cdplusg_converter_destroy (struct cdplusg_converter *converter);
+unsigned int cdplusg_converter_get_width (const struct cdplusg_converter *converter);
+unsigned int cdplusg_converter_get_height (const struct cdplusg_converter *converter);
+size_t cdplusg_converter_get_pixmap_size (const struct cdplusg_converter *converter);
+void cdplusg_converter_convert (struct cdplusg_converter *converter, const struct cdplusg_graphics_state *gpx_state, unsigned char *pixmap);
+
+/** Converts only the pixels of source_rect (in screen coordinates, NULL for the whole
+ * screen) into a caller-owned buffer with rows pitch bytes apart. The frame is placed
+ * with its top left corner at pixel (x, y) of the buffer, so letterboxing and partial
+ * updates use the same origin; for example the safe area without the border is
+ * { CDPLUSG_FONT_WIDTH, CDPLUSG_FONT_HEIGHT, CDPLUSG_SCREEN_WIDTH - 2 * CDPLUSG_FONT_WIDTH,
+ * CDPLUSG_SCREEN_HEIGHT - 2 * CDPLUSG_FONT_HEIGHT }. Returns 0 for the planar YUV formats,
+ * which only support whole frames, and for INDEX4, whose pixels are not byte aligned.
+ **/
+int cdplusg_converter_convert_rect (struct cdplusg_converter *converter, const struct cdplusg_graphics_state *gpx_state, const struct cdplusg_rect *source_rect, unsigned char *target, size_t pitch, int x, int y);
+
+/** Splits every conversion into thread_count horizontal bands, converted in parallel by
+ * a persistent pool of thread_count - 1 workers plus the calling thread. Worth it at
+ * large scale factors, where a frame is several megabytes. Returns 0 on failure.
+ **/
+int cdplusg_converter_set_thread_count (struct cdplusg_converter *converter, unsigned int thread_count);
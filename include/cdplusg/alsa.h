@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cdplusg/audio.h>
+
+/** Plays straight through ALSA's default device with about 20 ms of latency, from a thread
+ * that writes a period whenever the device has room; the operations of cdplusg/portaudio.h
+ * without PortAudio's extra layer and callback thread.
+ **/
+struct cdplusg_alsa_context;
+
+/** These operations as a backend for cdplusg_audio_open; open takes no options. **/
+extern const struct cdplusg_audio_backend cdplusg_alsa_backend;
+
+struct cdplusg_alsa_context * cdplusg_alsa_context_initialize (const char *audio_filename, double tempo, int semitones);
+
+/** Milliseconds of the song played so far, as from the portaudio backend. **/
+unsigned int cdplusg_alsa_context_get_elapsed_time_ms (struct cdplusg_alsa_context *context);
+
+/** Position of the audio leaving the speakers right now, in seconds of the song, from the
+ * delay ALSA reported when the last period was written.
+ **/
+double cdplusg_alsa_context_get_position (struct cdplusg_alsa_context *context);
+void cdplusg_alsa_context_seek (struct cdplusg_alsa_context *context, unsigned int ms);
+
+/** As cdplusg_portaudio_context_set_tempo. **/
+void cdplusg_alsa_context_set_tempo (struct cdplusg_alsa_context *context, double tempo);
+
+/** As cdplusg_portaudio_context_set_pitch. **/
+void cdplusg_alsa_context_set_pitch (struct cdplusg_alsa_context *context, int semitones);
+
+/** As cdplusg_portaudio_context_set_vocal_reduction. **/
+void cdplusg_alsa_context_set_vocal_reduction (struct cdplusg_alsa_context *context, double amount);
+void cdplusg_alsa_context_restart (struct cdplusg_alsa_context *context);
+void cdplusg_alsa_context_pause (struct cdplusg_alsa_context *context);
+void cdplusg_alsa_context_resume (struct cdplusg_alsa_context *context);
+void cdplusg_alsa_context_toggle_playback (struct cdplusg_alsa_context *context);
+
+/** Returns 1 once the whole song has been written, until the next seek. **/
+int cdplusg_alsa_context_is_finished (struct cdplusg_alsa_context *context);
+void cdplusg_alsa_context_destroy (struct cdplusg_alsa_context *context);
@@ -0,0 +1,50 @@
+#pragma once
+
+/** The operations every audio backend offers, so that a program can pick one at runtime and
+ * measure them against each other. Each backend also has its own header with the full set
+ * of its operations.
+ *
+ * open takes options specific to the backend, or NULL for its defaults, and returns NULL
+ * on failure, after which a program carries on without audio. The tempo, from 0.5 to 2,
+ * plays the song faster or slower without changing its pitch, and the semitones, up to 6
+ * either way, move its key without changing the tempo; both can be changed during play.
+ * So can the vocal reduction, from 0 to 1, which takes the singing out of the mix.
+ **/
+struct cdplusg_audio_backend
+{
+  const char *name;
+
+  void *(*open) (const char *audio_filename, double tempo, int semitones, const void *options);
+  void (*start) (void *context);
+  void (*pause) (void *context);
+  double (*get_position) (void *context);
+  void (*seek) (void *context, unsigned int ms);
+  void (*set_tempo) (void *context, double tempo);
+  void (*set_pitch) (void *context, int semitones);
+  void (*set_vocal_reduction) (void *context, double amount);
+  int (*is_finished) (void *context);
+  void (*destroy) (void *context);
+};
+
+/** A backend together with the context it opened. **/
+struct cdplusg_audio
+{
+  const struct cdplusg_audio_backend *backend;
+  void *context;
+};
+
+/** The backends built in, NULL terminated, the lowest latency first. The null backend is
+ * last and never chosen unless asked for by name.
+ **/
+extern const struct cdplusg_audio_backend *const cdplusg_audio_backends [];
+
+const struct cdplusg_audio_backend *cdplusg_audio_backend_find (const char *name);
+
+/** Opens audio_filename with the named backend, or when name is NULL with the first one
+ * that works on this machine, which then gets its default options. Returns 0 when none does.
+ **/
+int cdplusg_audio_open (struct cdplusg_audio *audio, const char *name, const char *audio_filename, double tempo, int semitones, const void *options);
+void cdplusg_audio_close (struct cdplusg_audio *audio);
+
+/** A cdplusg_player_clock, with the struct cdplusg_audio as user data. **/
+double cdplusg_audio_clock (void *user_data);
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Measures how loud an mp3 file is as a whole, so that songs can be played back at a
+ * common level. The integrated loudness follows EBU R128 (ITU-R BS.1770): K-weighted
+ * mean square over 400 ms blocks, gated at -70 LUFS and then 10 LU below the ungated
+ * level. Mono files are measured as played, on both channels.
+ *
+ * The file is decoded in parallel, in chunks split at frame boundaries of the minimp3
+ * index, which is taken from the mp3 cache like the result is, so a file is only ever
+ * analyzed once.
+ **/
+
+/** Points of the waveform overview, each the peak of an equal stretch of the song. **/
+#define CDPLUSG_LOUDNESS_OVERVIEW_POINTS 1024
+
+/** The level songs are brought to, the ReplayGain 2.0 reference. **/
+#define CDPLUSG_LOUDNESS_TARGET_LUFS -18.0
+
+/** How far a quiet song is brought up at most, so that a near silent one is not boosted
+ * into noise; loud songs are brought down as far as it takes.
+ **/
+#define CDPLUSG_LOUDNESS_MAX_GAIN_DB 12.0
+
+struct cdplusg_loudness
+{
+  // -INFINITY when nothing is above the gates, as in silence
+  double integrated_lufs;
+
+  // of the highest sample, 1 for full scale
+  double peak;
+
+  uint64_t frame_count;
+  uint16_t overview [CDPLUSG_LOUDNESS_OVERVIEW_POINTS];
+};
+
+/** Fills loudness for filename, from the cache or else by decoding the file with up to
+ * thread_count threads, the calling one included, 0 meaning one for each processor.
+ * Returns 0 when the file could not be decoded to the end.
+ **/
+int cdplusg_loudness_analyze (const char *filename, unsigned int thread_count, struct cdplusg_loudness *loudness);
+
+/** Linear gain that brings the song to the target level, as far as it can go without
+ * clipping its peak.
+ **/
+double cdplusg_loudness_get_gain (const struct cdplusg_loudness *loudness);
+
+/** Multiplies interleaved 16-bit stereo frames by gain in place, saturating. **/
+void cdplusg_loudness_apply_gain (short *samples, size_t frame_count, double gain);
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cdplusg/audio.h>
+
+/** An audio backend without a sound card, for CI and load-test machines: the operations of
+ * cdplusg/portaudio.h, with a thread standing in for the device that consumes the decoded
+ * samples buffer by buffer and optionally writes them to a WAV file.
+ *
+ * On the real-time clock buffers are consumed at the pace a sound card would, one buffer
+ * period apart and with one buffer of output latency. On the virtual clock they are
+ * consumed back to back as fast as the decoder delivers them, and time is however much
+ * audio has been consumed, which measures decoding throughput and keeps runs repeatable.
+ **/
+struct cdplusg_null_audio_context;
+
+/** These operations as a backend for cdplusg_audio_open; open takes a pointer to
+ * struct cdplusg_null_audio_options.
+ **/
+extern const struct cdplusg_audio_backend cdplusg_null_audio_backend;
+
+struct cdplusg_null_audio_options
+{
+  int is_virtual_clock;
+
+  /** Frames per buffer, 0 for the default of 512. **/
+  unsigned int buffer_frames;
+
+  /** Where to write what is played, silence included, or NULL. **/
+  const char *wav_filename;
+};
+
+/** What the device thread saw, callback times covering only the decoder read and the
+ * timing update, as in the PortAudio callback.
+ **/
+struct cdplusg_null_audio_statistics
+{
+  unsigned long callback_count;
+  unsigned long frame_count;
+  unsigned long underrun_count;
+  unsigned long silent_frame_count;
+
+  /** Real-time callbacks that started over a buffer period late and so skipped ahead. **/
+  unsigned long late_count;
+
+  double max_callback_us;
+  double mean_callback_us;
+  double max_lateness_us;
+
+  /** Time spent playing, and on the virtual clock how much of it went waiting for the decoder. **/
+  double elapsed_seconds;
+  double stall_seconds;
+};
+
+/** Opens the file and starts playing; options may be NULL for the real-time clock and no
+ * WAV file.
+ **/
+struct cdplusg_null_audio_context * cdplusg_null_audio_context_initialize (const char *audio_filename, double tempo, int semitones, const struct cdplusg_null_audio_options *options);
+
+/** Milliseconds of the song played so far, as from the portaudio backend. **/
+unsigned int cdplusg_null_audio_context_get_elapsed_time_ms (struct cdplusg_null_audio_context *context);
+
+/** Position of the audio leaving the virtual DAC right now, in seconds of the song, the
+ * same as cdplusg_portaudio_context_get_position.
+ **/
+double cdplusg_null_audio_context_get_position (struct cdplusg_null_audio_context *context);
+void cdplusg_null_audio_context_seek (struct cdplusg_null_audio_context *context, unsigned int ms);
+
+/** As cdplusg_portaudio_context_set_tempo; the WAV file goes on at the same rate. **/
+void cdplusg_null_audio_context_set_tempo (struct cdplusg_null_audio_context *context, double tempo);
+
+/** As cdplusg_portaudio_context_set_pitch. **/
+void cdplusg_null_audio_context_set_pitch (struct cdplusg_null_audio_context *context, int semitones);
+
+/** As cdplusg_portaudio_context_set_vocal_reduction, heard in the WAV file too. **/
+void cdplusg_null_audio_context_set_vocal_reduction (struct cdplusg_null_audio_context *context, double amount);
+void cdplusg_null_audio_context_restart (struct cdplusg_null_audio_context *context);
+void cdplusg_null_audio_context_pause (struct cdplusg_null_audio_context *context);
+void cdplusg_null_audio_context_resume (struct cdplusg_null_audio_context *context);
+void cdplusg_null_audio_context_toggle_playback (struct cdplusg_null_audio_context *context);
+
+/** Returns 1 once the whole song has been consumed, until the next seek. **/
+int cdplusg_null_audio_context_is_finished (struct cdplusg_null_audio_context *context);
+void cdplusg_null_audio_context_get_statistics (struct cdplusg_null_audio_context *context, struct cdplusg_null_audio_statistics *statistics);
+void cdplusg_null_audio_context_destroy (struct cdplusg_null_audio_context *context);
@@ -1,9 +1,42 @@
 #pragma once
 
+#include <cdplusg/audio.h>
+
 struct cdplusg_portaudio_context;
 
-struct cdplusg_portaudio_context * cdplusg_portaudio_context_initialize (const char *audio_filename, double scale);
+/** These operations as a backend for cdplusg_audio_open; open takes no options. **/
+extern const struct cdplusg_audio_backend cdplusg_portaudio_backend;
+
+struct cdplusg_portaudio_context * cdplusg_portaudio_context_initialize (const char *audio_filename, double tempo, int semitones);
+
+/** Milliseconds of the song played so far, the position below in whole milliseconds. **/
 unsigned int cdplusg_portaudio_context_get_elapsed_time_ms (struct cdplusg_portaudio_context *context);
+
+/** Position of the audio leaving the speakers right now, in seconds of the song: the last
+ * buffer's DAC time on the stream clock accounts for the output latency, and playing at
+ * another tempo advances it faster or slower. Meant as the clock of a cdplusg_player.
+ **/
+double cdplusg_portaudio_context_get_position (struct cdplusg_portaudio_context *context);
+
+/** Continues playback from ms into the song, to the sample, using the frame index built
+ * when the file was opened. The position reports the target right away.
+ **/
+void cdplusg_portaudio_context_seek (struct cdplusg_portaudio_context *context, unsigned int ms);
+
+/** Continues at a new tempo from the current position. Like a seek, this drops the audio
+ * already buffered, which was stretched at the old tempo.
+ **/
+void cdplusg_portaudio_context_set_tempo (struct cdplusg_portaudio_context *context, double tempo);
+
+/** Continues in another key, semitones from the original, from the current position; like
+ * a change of tempo, by way of a seek.
+ **/
+void cdplusg_portaudio_context_set_pitch (struct cdplusg_portaudio_context *context, int semitones);
+
+/** Takes out as much of the vocals as amount says, from 0 to 1, without a seek: the
+ * change fades in once the audio already buffered has played.
+ **/
+void cdplusg_portaudio_context_set_vocal_reduction (struct cdplusg_portaudio_context *context, double amount);
 void cdplusg_portaudio_context_restart (struct cdplusg_portaudio_context *context);
 void cdplusg_portaudio_context_pause (struct cdplusg_portaudio_context *context);
 void cdplusg_portaudio_context_resume (struct cdplusg_portaudio_context *context);
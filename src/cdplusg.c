@@ -7,6 +7,7 @@
 #include "cdplusg.h"
 
 static_assert (sizeof (struct cdplusg_color_table_entry) == 4, "struct padding error, contact the maintainer");
+static_assert (CDPLUSG_TILE_COLUMNS <= 64, "a row of tiles must fit the dirty tile mask");
 
 #ifdef __GLIBC__
 extern char *program_invocation_short_name;
@@ -21,6 +22,16 @@ cdplusg_get_pixels_at (unsigned char *pixels, int row, int col)
   return &pixels[row * CDPLUSG_SCREEN_WIDTH + col];
 }
 
+static void
+cdplusg_graphics_state_mark_dirty (struct cdplusg_graphics_state *gpx_state, int first_row, int last_row, int first_column, int last_column)
+{
+  // rows and columns are in tiles, both bounds inclusive
+  uint64_t mask = (UINT64_C (2) << last_column) - (UINT64_C (1) << first_column);
+
+  for (int i = first_row; i <= last_row; i++)
+    gpx_state->dirty_tiles[i] |= mask;
+}
+
 static void
 cdplusg_decode_color_to_struct (const unsigned char *color_data, struct cdplusg_color_table_entry *color_struct)
 {
@@ -37,6 +48,17 @@ cdplusg_decode_color_to_struct (const unsigned char *color_data, struct cdplusg_
   color_struct->b = 255 * color_struct->b / 15;
 }
 
+static void
+cdplusg_encode_color_from_struct (const struct cdplusg_color_table_entry *color_struct, unsigned char *color_data)
+{
+  // the inverse of cdplusg_decode_color_to_struct, rounding colors that are not 4-bit
+  unsigned char r = (color_struct->r * 15 + 127) / 255;
+  unsigned char g = (color_struct->g * 15 + 127) / 255;
+  unsigned char b = (color_struct->b * 15 + 127) / 255;
+
+  color_data[0] = (r << 2) | (g >> 2);
+  color_data[1] = ((g & 0x03) << 4) | b;
+}
 
 void
 cdplusg_instruction_initialize_no_op (struct cdplusg_instruction *instruction)
@@ -158,10 +180,16 @@ cdplusg_instruction_initialize_load_color_table_low  (struct cdplusg_instruction
   memcpy (instruction->color_table, color_table, sizeof (struct cdplusg_color_table_entry) * CDPLUSG_LOAD_COLOR_TABLE_SIZE);
 }
 
-static void
+static int
 cdplusg_instruction_execute_load_color_table_low (const struct cdplusg_instruction *this, struct cdplusg_color_table_entry *colors)
 {
-  memcpy (&colors[0], this->color_table, sizeof (struct cdplusg_color_table_entry) * CDPLUSG_LOAD_COLOR_TABLE_SIZE);
+  size_t size = sizeof (struct cdplusg_color_table_entry) * CDPLUSG_LOAD_COLOR_TABLE_SIZE;
+
+  if (memcmp (&colors[0], this->color_table, size) == 0)
+    return 0;
+
+  memcpy (&colors[0], this->color_table, size);
+  return 1;
 }
 
 void
@@ -171,10 +199,16 @@ cdplusg_instruction_initialize_load_color_table_high  (struct cdplusg_instructio
   memcpy (instruction->color_table, color_table, sizeof (struct cdplusg_color_table_entry) * CDPLUSG_LOAD_COLOR_TABLE_SIZE);
 }
 
-static void
+static int
 cdplusg_instruction_execute_load_color_table_high (const struct cdplusg_instruction *this, struct cdplusg_color_table_entry *colors)
 {
-  memcpy (&colors[8], this->color_table, sizeof (struct cdplusg_color_table_entry) * CDPLUSG_LOAD_COLOR_TABLE_SIZE);
+  size_t size = sizeof (struct cdplusg_color_table_entry) * CDPLUSG_LOAD_COLOR_TABLE_SIZE;
+
+  if (memcmp (&colors[8], this->color_table, size) == 0)
+    return 0;
+
+  memcpy (&colors[8], this->color_table, size);
+  return 1;
 }
 
 void
@@ -267,6 +301,10 @@ cdplusg_graphics_state_new ()
     (struct cdplusg_color_table_entry *) calloc (CDPLUSG_COLOR_TABLE_SIZE,
         sizeof (struct cdplusg_color_table_entry));
 
+  gpx_state->palette_version = 0;
+
+  cdplusg_graphics_state_mark_dirty (gpx_state, 0, CDPLUSG_TILE_ROWS - 1, 0, CDPLUSG_TILE_COLUMNS - 1);
+
   return gpx_state;
 }
 
@@ -291,21 +329,44 @@ cdplusg_graphics_state_apply_instruction (struct cdplusg_graphics_state *gpx_sta
       break;
     case MEMORY_PRESET:
       cdplusg_instruction_execute_memory_preset (instruction, gpx_state->pixels);
+      if (instruction->repeat == 0)
+        cdplusg_graphics_state_mark_dirty (gpx_state, 0, CDPLUSG_TILE_ROWS - 1, 0, CDPLUSG_TILE_COLUMNS - 1);
       break;
     case BORDER_PRESET:
+    {
       cdplusg_instruction_execute_border_preset (instruction, gpx_state->pixels);
+
+      // the right border is drawn one pixel to the left and straddles two tile columns
+      int last_row = CDPLUSG_TILE_ROWS - 1;
+      int last_column = CDPLUSG_TILE_COLUMNS - 1;
+
+      cdplusg_graphics_state_mark_dirty (gpx_state, 0, 0, 0, last_column);
+      cdplusg_graphics_state_mark_dirty (gpx_state, last_row, last_row, 0, last_column);
+      cdplusg_graphics_state_mark_dirty (gpx_state, 1, last_row - 1, 0, 0);
+      cdplusg_graphics_state_mark_dirty (gpx_state, 1, last_row - 1, last_column - 1, last_column);
       break;
+    }
     case TILE_BLOCK:
-      cdplusg_instruction_execute_tile_block (instruction, gpx_state->pixels);
-      break;
     case TILE_BLOCK_XOR:
-      cdplusg_instruction_execute_tile_block_xor (instruction, gpx_state->pixels);
+    {
+      if (instruction->type == TILE_BLOCK)
+        cdplusg_instruction_execute_tile_block (instruction, gpx_state->pixels);
+      else
+        cdplusg_instruction_execute_tile_block_xor (instruction, gpx_state->pixels);
+
+      int row = instruction->row / CDPLUSG_FONT_HEIGHT;
+      int column = instruction->column / CDPLUSG_FONT_WIDTH;
+
+      cdplusg_graphics_state_mark_dirty (gpx_state, row, row, column, column);
       break;
+    }
     case LOAD_COLOR_TABLE_LOW:
-      cdplusg_instruction_execute_load_color_table_low (instruction, gpx_state->color_table);
+      if (cdplusg_instruction_execute_load_color_table_low (instruction, gpx_state->color_table))
+        gpx_state->palette_version++;
       break;
     case LOAD_COLOR_TABLE_HIGH:
-      cdplusg_instruction_execute_load_color_table_high (instruction, gpx_state->color_table);
+      if (cdplusg_instruction_execute_load_color_table_high (instruction, gpx_state->color_table))
+        gpx_state->palette_version++;
       break;
     default:
       fprintf (stderr, "%s: warning: invalid instruction %2d found.\n", PROGNAME(), instruction->type);
@@ -313,56 +374,56 @@ cdplusg_graphics_state_apply_instruction (struct cdplusg_graphics_state *gpx_sta
   }
 }
 
-void
-cdplusg_graphics_state_to_pixmap (struct cdplusg_graphics_state *gpx_state, unsigned char *pixmap, unsigned int scale_factor, enum cdplusg_byte_order byte_order)
+unsigned int
+cdplusg_graphics_state_get_palette (const struct cdplusg_graphics_state *gpx_state, struct cdplusg_color_table_entry *palette)
+{
+  memcpy (palette, gpx_state->color_table, sizeof (struct cdplusg_color_table_entry) * CDPLUSG_COLOR_TABLE_SIZE);
+  return gpx_state->palette_version;
+}
+
+int
+cdplusg_graphics_state_get_dirty_rect (const struct cdplusg_graphics_state *gpx_state, struct cdplusg_rect *rect)
 {
-  unsigned int source_index = 0;
-  unsigned int target_index = 0;
-  unsigned int saved_target_index = 0;
-  unsigned int scale_factor_sq = scale_factor * scale_factor;
+  uint64_t columns = 0;
+  int first_row = -1;
+  int last_row = -1;
 
-  while (source_index < CDPLUSG_SCREEN_WIDTH * CDPLUSG_SCREEN_HEIGHT)
+  for (int i = 0; i < CDPLUSG_TILE_ROWS; i++)
   {
-    unsigned int color_index = gpx_state->pixels[source_index];
-    struct cdplusg_color_table_entry *color = &gpx_state->color_table[color_index];
+    if (gpx_state->dirty_tiles[i] == 0)
+      continue;
 
-    for (unsigned int i = 0; i < scale_factor; i++)
-    {
-      assert (target_index < scale_factor_sq * 4 * CDPLUSG_SCREEN_HEIGHT * CDPLUSG_SCREEN_WIDTH);
+    if (first_row < 0)
+      first_row = i;
 
-      if (byte_order == CDPLUSG_BYTE_ORDER_RGB)
-      {
-        pixmap[target_index++] = color->r;
-        pixmap[target_index++] = color->g;
-        pixmap[target_index++] = color->b;
-        pixmap[target_index++] = 0xFF;
-      }
-      else
-      {
-        pixmap[target_index++] = color->b;
-        pixmap[target_index++] = color->g;
-        pixmap[target_index++] = color->r;
-        pixmap[target_index++] = 0xFF;
-      }
-    }
+    last_row = i;
+    columns |= gpx_state->dirty_tiles[i];
+  }
+
+  if (first_row < 0)
+    return 0;
 
-    source_index += 1;
+  int first_column = 0;
+  int last_column = CDPLUSG_TILE_COLUMNS - 1;
 
-    if (source_index % CDPLUSG_SCREEN_WIDTH == 0)
-    {
-      for (unsigned int i = 1; i < scale_factor; i++)
-      {
-        assert (target_index < scale_factor_sq * 4 * CDPLUSG_SCREEN_HEIGHT * CDPLUSG_SCREEN_WIDTH);
+  while (!(columns & (UINT64_C (1) << first_column)))
+    first_column++;
 
-        memcpy
-          (&pixmap[target_index], &pixmap[saved_target_index], scale_factor * 4 * CDPLUSG_SCREEN_WIDTH);
-        
-        target_index += scale_factor * 4 * CDPLUSG_SCREEN_WIDTH;
-      }
+  while (!(columns & (UINT64_C (1) << last_column)))
+    last_column--;
 
-      saved_target_index = target_index;
-    }
-  }
+  rect->x = first_column * CDPLUSG_FONT_WIDTH;
+  rect->y = first_row * CDPLUSG_FONT_HEIGHT;
+  rect->width = (last_column - first_column + 1) * CDPLUSG_FONT_WIDTH;
+  rect->height = (last_row - first_row + 1) * CDPLUSG_FONT_HEIGHT;
+
+  return 1;
+}
+
+void
+cdplusg_graphics_state_clear_dirty (struct cdplusg_graphics_state *gpx_state)
+{
+  memset (gpx_state->dirty_tiles, 0, sizeof (gpx_state->dirty_tiles));
 }
 
 int
@@ -381,6 +442,174 @@ cdplusg_instruction_initialize_from_file (struct cdplusg_instruction *instructio
   return 1;
 }
 
+// GF(64) generated by x^6 + x + 1, in which the subcode parity is computed
+struct cdplusg_parity_tables
+{
+  unsigned char exp [2 * 63];
+  unsigned char log [64];
+
+  // generators (x - alpha^0) ... (x - alpha^(n - 1)) for the Q and P parity, lowest
+  // coefficient first
+  unsigned char q_generator [3];
+  unsigned char p_generator [5];
+};
+
+static unsigned char
+cdplusg_gf64_multiply (const struct cdplusg_parity_tables *tables, unsigned char a, unsigned char b)
+{
+  if (a == 0 || b == 0)
+    return 0;
+
+  return tables->exp[tables->log[a] + tables->log[b]];
+}
+
+static void
+cdplusg_build_generator (const struct cdplusg_parity_tables *tables, unsigned char *generator, int parity_count)
+{
+  memset (generator, 0, parity_count + 1);
+  generator[0] = 1;
+
+  for (int i = 0; i < parity_count; i++)
+  {
+    unsigned char root = tables->exp[i];
+
+    for (int j = i + 1; j > 0; j--)
+      generator[j] = generator[j - 1] ^ cdplusg_gf64_multiply (tables, generator[j], root);
+
+    generator[0] = cdplusg_gf64_multiply (tables, generator[0], root);
+  }
+}
+
+static void
+cdplusg_parity_tables_initialize (struct cdplusg_parity_tables *tables)
+{
+  unsigned char value = 1;
+
+  for (int i = 0; i < 63; i++)
+  {
+    tables->exp[i] = tables->exp[i + 63] = value;
+    tables->log[value] = i;
+
+    value <<= 1;
+
+    if (value & 0x40)
+      value ^= 0x43;
+  }
+
+  cdplusg_build_generator (tables, tables->q_generator, 2);
+  cdplusg_build_generator (tables, tables->p_generator, 4);
+}
+
+// Systematic Reed-Solomon parity, the first symbol being the highest power: the remainder of
+// the message times x^parity_count divided by the generator, computed with a shift register.
+static void
+cdplusg_compute_parity (const struct cdplusg_parity_tables *tables, const unsigned char *generator,
+    const unsigned char *symbols, int symbol_count, unsigned char *parity, int parity_count)
+{
+  unsigned char remainder [4] = { 0 };
+
+  for (int i = 0; i < symbol_count; i++)
+  {
+    unsigned char feedback = (symbols[i] & 0x3F) ^ remainder[parity_count - 1];
+
+    for (int j = parity_count - 1; j > 0; j--)
+      remainder[j] = remainder[j - 1] ^ cdplusg_gf64_multiply (tables, feedback, generator[j]);
+
+    remainder[0] = cdplusg_gf64_multiply (tables, feedback, generator[0]);
+  }
+
+  for (int i = 0; i < parity_count; i++)
+    parity[i] = remainder[parity_count - 1 - i];
+}
+
+static void
+cdplusg_instruction_pack (const struct cdplusg_instruction *this, unsigned char *packet,
+    const struct cdplusg_parity_tables *tables)
+{
+  unsigned char *data = &packet[4];
+
+  memset (packet, 0, CDPLUSG_SUBCHANNEL_WIDTH);
+
+  switch (this->type)
+  {
+    case MEMORY_PRESET:
+      data[0] = this->color0 & 0x0F;
+      data[1] = this->repeat & 0x0F;
+      break;
+    case BORDER_PRESET:
+      data[0] = this->color0 & 0x0F;
+      break;
+    case TILE_BLOCK:
+    case TILE_BLOCK_XOR:
+      data[0] = this->color0 & 0x0F;
+      data[1] = this->color1 & 0x0F;
+      data[2] = (this->row / CDPLUSG_FONT_HEIGHT) & 0x1F;
+      data[3] = (this->column / CDPLUSG_FONT_WIDTH) & 0x3F;
+
+      for (int i = 0; i < CDPLUSG_FONT_HEIGHT; i++)
+        data[4 + i] = this->tile[i] & 0x3F;
+      break;
+    case LOAD_COLOR_TABLE_LOW:
+    case LOAD_COLOR_TABLE_HIGH:
+      for (int i = 0; i < CDPLUSG_LOAD_COLOR_TABLE_SIZE; i++)
+        cdplusg_encode_color_from_struct (&this->color_table[i], &data[2 * i]);
+      break;
+    default:
+      // NO_OP and the instructions that cannot be constructed yet are written as an empty
+      // packet, which reads back as NO_OP
+      return;
+  }
+
+  packet[0] = 0x09;
+  packet[1] = this->type;
+
+  if (tables)
+  {
+    // Q parity covers the command and instruction, P parity the first 20 symbols
+    cdplusg_compute_parity (tables, tables->q_generator, &packet[0], 2, &packet[2], 2);
+    cdplusg_compute_parity (tables, tables->p_generator, &packet[0], 20, &packet[20], 4);
+  }
+}
+
+void
+cdplusg_instructions_to_subchannel (const struct cdplusg_instruction *instructions, size_t count, char *subchannel, int with_parity)
+{
+  struct cdplusg_parity_tables tables;
+
+  if (with_parity)
+    cdplusg_parity_tables_initialize (&tables);
+
+  for (size_t i = 0; i < count; i++)
+  {
+    cdplusg_instruction_pack (&instructions[i], (unsigned char *) &subchannel[i * CDPLUSG_SUBCHANNEL_WIDTH],
+        with_parity ? &tables : NULL);
+  }
+}
+
+void
+cdplusg_instruction_to_subchannel (const struct cdplusg_instruction *instruction, char *subchannel, int with_parity)
+{
+  cdplusg_instructions_to_subchannel (instruction, 1, subchannel, with_parity);
+}
+
+int
+cdplusg_instructions_write_to_file (const struct cdplusg_instruction *instructions, size_t count, FILE *file, int with_parity)
+{
+  char buffer [256 * CDPLUSG_SUBCHANNEL_WIDTH];
+
+  for (size_t i = 0; i < count; i += 256)
+  {
+    size_t batch_count = count - i < 256 ? count - i : 256;
+
+    cdplusg_instructions_to_subchannel (&instructions[i], batch_count, buffer, with_parity);
+
+    if (fwrite (buffer, CDPLUSG_SUBCHANNEL_WIDTH, batch_count, file) != batch_count)
+      return 0;
+  }
+
+  return 1;
+}
+
 const char *cdplusg_instruction_type_to_string (enum cdplusg_instruction_type type)
 {
   switch (type)
@@ -0,0 +1,1331 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// the shuffle kernels are built whatever the compiler flags, and only picked when the
+// processor running them has SSSE3
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define CDPLUSG_HAVE_SSSE3_KERNELS
+#define CDPLUSG_SSSE3_TARGET __attribute__ ((target ("ssse3")))
+#include <tmmintrin.h>
+#endif
+
+#include "cdplusg.h"
+#include "thread_pool.h"
+
+#define CDPLUSG_MAX_BYTES_PER_PIXEL 4
+#define CDPLUSG_MAX_SPECIALIZED_SCALE 4
+#define CDPLUSG_MAX_SCALER_FACTOR 3
+
+struct cdplusg_packed_color
+{
+  unsigned char bytes [CDPLUSG_MAX_BYTES_PER_PIXEL];
+};
+
+typedef void (*cdplusg_row_kernel) (const unsigned char *source, unsigned int width,
+                                      const struct cdplusg_packed_color *palette,
+                                      unsigned char *target, unsigned int scale_factor);
+
+// per-thread state of the pixel-art scalers
+struct cdplusg_scaler_scratch
+{
+  int prescaled_row_index;
+  unsigned char prescaled_row [CDPLUSG_MAX_SCALER_FACTOR * CDPLUSG_SCREEN_WIDTH];
+  unsigned char *index_rows;
+};
+
+struct cdplusg_converter
+{
+  enum cdplusg_pixel_format format;
+
+  unsigned int scale_factor;
+  unsigned int bytes_per_pixel;
+
+  unsigned int width;
+  unsigned int height;
+
+  // only used when the output size is not an integer multiple of the screen, or when
+  // a pixel-art scaler is applied to the color indices before the palette lookup
+  enum cdplusg_scaler scaler;
+  unsigned int scaler_factor;
+
+  unsigned int *column_map;
+  unsigned int *row_map;
+
+  struct cdplusg_scaler_scratch *scratch;
+  unsigned int scratch_count;
+
+  // NULL when converting on the calling thread only
+  struct cdplusg_thread_pool *thread_pool;
+
+  // for word formats, the position of each channel in a native-endian word
+  uint32_t red_mask;
+  uint32_t green_mask;
+  uint32_t blue_mask;
+  uint32_t alpha_mask;
+
+  cdplusg_row_kernel kernel;
+
+  // vector kernels by bytes per pixel, NULL where there is none or the processor lacks them
+  const cdplusg_row_kernel *vector_kernels;
+
+  // the color table, pre-packed into the output format; for the YUV formats this
+  // holds the luma and the chroma tables hold U, V and interleaved UV
+  struct cdplusg_packed_color palette [CDPLUSG_COLOR_TABLE_SIZE];
+
+  cdplusg_row_kernel chroma_kernel;
+  cdplusg_row_kernel interleaved_chroma_kernel;
+
+  struct cdplusg_packed_color u_palette [CDPLUSG_COLOR_TABLE_SIZE];
+  struct cdplusg_packed_color v_palette [CDPLUSG_COLOR_TABLE_SIZE];
+  struct cdplusg_packed_color uv_palette [CDPLUSG_COLOR_TABLE_SIZE];
+
+  // the color table the packed tables were built from, they are only rebuilt when it changes
+  struct cdplusg_color_table_entry color_table [CDPLUSG_COLOR_TABLE_SIZE];
+  int palette_is_valid;
+};
+
+// each kernel expands one row of color indices into one row of packed pixels, the
+// replication of the row itself is done by the caller; with BPP and SCALE known at
+// compile time the inner loop becomes a fixed sequence of stores
+#define CDPLUSG_DEFINE_ROW_KERNEL(BPP, SCALE)                                             \
+  static void                                                                             \
+  cdplusg_row_kernel_##BPP##_##SCALE (const unsigned char *source, unsigned int width,    \
+      const struct cdplusg_packed_color *palette,                                         \
+      unsigned char *target, unsigned int scale_factor)                                   \
+  {                                                                                       \
+    (void) scale_factor;                                                                  \
+                                                                                          \
+    for (unsigned int i = 0; i < width; i++)                                              \
+    {                                                                                     \
+      const unsigned char *color = palette[source[i]].bytes;                              \
+                                                                                          \
+      for (unsigned int j = 0; j < SCALE; j++)                                            \
+      {                                                                                   \
+        memcpy (target, color, BPP);                                                      \
+        target += BPP;                                                                    \
+      }                                                                                   \
+    }                                                                                     \
+  }
+
+CDPLUSG_DEFINE_ROW_KERNEL (1, 1)
+CDPLUSG_DEFINE_ROW_KERNEL (1, 2)
+CDPLUSG_DEFINE_ROW_KERNEL (1, 3)
+CDPLUSG_DEFINE_ROW_KERNEL (1, 4)
+CDPLUSG_DEFINE_ROW_KERNEL (2, 1)
+CDPLUSG_DEFINE_ROW_KERNEL (2, 2)
+CDPLUSG_DEFINE_ROW_KERNEL (2, 3)
+CDPLUSG_DEFINE_ROW_KERNEL (2, 4)
+CDPLUSG_DEFINE_ROW_KERNEL (3, 1)
+CDPLUSG_DEFINE_ROW_KERNEL (3, 2)
+CDPLUSG_DEFINE_ROW_KERNEL (3, 3)
+CDPLUSG_DEFINE_ROW_KERNEL (3, 4)
+CDPLUSG_DEFINE_ROW_KERNEL (4, 1)
+CDPLUSG_DEFINE_ROW_KERNEL (4, 2)
+CDPLUSG_DEFINE_ROW_KERNEL (4, 3)
+CDPLUSG_DEFINE_ROW_KERNEL (4, 4)
+
+#define CDPLUSG_DEFINE_GENERIC_ROW_KERNEL(BPP)                                            \
+  static void                                                                             \
+  cdplusg_row_kernel_##BPP##_generic (const unsigned char *source, unsigned int width,    \
+      const struct cdplusg_packed_color *palette,                                         \
+      unsigned char *target, unsigned int scale_factor)                                   \
+  {                                                                                       \
+    for (unsigned int i = 0; i < width; i++)                                              \
+    {                                                                                     \
+      const unsigned char *color = palette[source[i]].bytes;                              \
+                                                                                          \
+      for (unsigned int j = 0; j < scale_factor; j++)                                     \
+      {                                                                                   \
+        memcpy (target, color, BPP);                                                      \
+        target += BPP;                                                                    \
+      }                                                                                   \
+    }                                                                                     \
+  }
+
+CDPLUSG_DEFINE_GENERIC_ROW_KERNEL (1)
+CDPLUSG_DEFINE_GENERIC_ROW_KERNEL (2)
+CDPLUSG_DEFINE_GENERIC_ROW_KERNEL (3)
+CDPLUSG_DEFINE_GENERIC_ROW_KERNEL (4)
+
+static const cdplusg_row_kernel cdplusg_row_kernels [CDPLUSG_MAX_BYTES_PER_PIXEL][CDPLUSG_MAX_SPECIALIZED_SCALE + 1] =
+{
+  { cdplusg_row_kernel_1_generic, cdplusg_row_kernel_1_1, cdplusg_row_kernel_1_2, cdplusg_row_kernel_1_3, cdplusg_row_kernel_1_4 },
+  { cdplusg_row_kernel_2_generic, cdplusg_row_kernel_2_1, cdplusg_row_kernel_2_2, cdplusg_row_kernel_2_3, cdplusg_row_kernel_2_4 },
+  { cdplusg_row_kernel_3_generic, cdplusg_row_kernel_3_1, cdplusg_row_kernel_3_2, cdplusg_row_kernel_3_3, cdplusg_row_kernel_3_4 },
+  { cdplusg_row_kernel_4_generic, cdplusg_row_kernel_4_1, cdplusg_row_kernel_4_2, cdplusg_row_kernel_4_3, cdplusg_row_kernel_4_4 }
+};
+
+#if defined(CDPLUSG_HAVE_SSSE3_KERNELS)
+
+// for each scale factor, where each index of the replicated run of 16 comes from in the 16
+// source indices, for as many runs as the scale factor makes of them
+static const unsigned char cdplusg_ssse3_replicate_masks [CDPLUSG_MAX_SPECIALIZED_SCALE][CDPLUSG_MAX_SPECIALIZED_SCALE][16] =
+{
+  {
+    { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 }
+  },
+  {
+    { 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7 },
+    { 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13, 14, 14, 15, 15 },
+    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 }
+  },
+  {
+    { 0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5 },
+    { 5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10 },
+    { 10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15 },
+    { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 }
+  },
+  {
+    { 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3 },
+    { 4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7 },
+    { 8, 8, 8, 8, 9, 9, 9, 9, 10, 10, 10, 10, 11, 11, 11, 11 },
+    { 12, 12, 12, 12, 13, 13, 13, 13, 14, 14, 14, 14, 15, 15, 15, 15 }
+  }
+};
+
+// with only 16 colors the whole color table fits in one register per output byte, so
+// the lookup is a single shuffle per byte lane; each 16 indices are replicated by the
+// scale factor with shuffles as well, which makes a run of 16 pixels per lookup
+#define CDPLUSG_DEFINE_SSSE3_ROW_KERNEL(BPP)                                              \
+  CDPLUSG_SSSE3_TARGET static void                                                        \
+  cdplusg_row_kernel_##BPP##_ssse3 (const unsigned char *source, unsigned int width,      \
+      const struct cdplusg_packed_color *palette,                                         \
+      unsigned char *target, unsigned int scale_factor)                                   \
+  {                                                                                       \
+    unsigned char planes [BPP][CDPLUSG_COLOR_TABLE_SIZE];                                 \
+    __m128i lookup [BPP];                                                                 \
+    __m128i replicate [CDPLUSG_MAX_SPECIALIZED_SCALE];                                    \
+                                                                                          \
+    for (int i = 0; i < CDPLUSG_COLOR_TABLE_SIZE; i++)                                    \
+      for (int j = 0; j < BPP; j++)                                                       \
+        planes[j][i] = palette[i].bytes[j];                                               \
+                                                                                          \
+    for (int j = 0; j < BPP; j++)                                                         \
+      lookup[j] = _mm_loadu_si128 ((const __m128i *) planes[j]);                          \
+                                                                                          \
+    for (unsigned int k = 0; k < scale_factor; k++)                                       \
+      replicate[k] = _mm_loadu_si128 (                                                    \
+          (const __m128i *) cdplusg_ssse3_replicate_masks[scale_factor - 1][k]);          \
+                                                                                          \
+    unsigned int i = 0;                                                                   \
+                                                                                          \
+    for (; i + 16 <= width; i += 16)                                                      \
+    {                                                                                     \
+      __m128i indices = _mm_loadu_si128 ((const __m128i *) &source[i]);                   \
+                                                                                          \
+      for (unsigned int k = 0; k < scale_factor; k++)                                     \
+        cdplusg_ssse3_store_##BPP (lookup, _mm_shuffle_epi8 (indices, replicate[k]),      \
+            &target[(i * scale_factor + 16 * k) * BPP]);                                  \
+    }                                                                                     \
+                                                                                          \
+    cdplusg_row_kernel_##BPP##_generic (&source[i], width - i, palette,                   \
+        &target[i * scale_factor * BPP], scale_factor);                                   \
+  }
+
+CDPLUSG_SSSE3_TARGET static inline void
+cdplusg_ssse3_store_1 (const __m128i *lookup, __m128i indices, unsigned char *target)
+{
+  _mm_storeu_si128 ((__m128i *) target, _mm_shuffle_epi8 (lookup[0], indices));
+}
+
+CDPLUSG_SSSE3_TARGET static inline void
+cdplusg_ssse3_store_2 (const __m128i *lookup, __m128i indices, unsigned char *target)
+{
+  __m128i byte0 = _mm_shuffle_epi8 (lookup[0], indices);
+  __m128i byte1 = _mm_shuffle_epi8 (lookup[1], indices);
+
+  _mm_storeu_si128 ((__m128i *) &target[0], _mm_unpacklo_epi8 (byte0, byte1));
+  _mm_storeu_si128 ((__m128i *) &target[16], _mm_unpackhi_epi8 (byte0, byte1));
+}
+
+CDPLUSG_SSSE3_TARGET static inline void
+cdplusg_ssse3_store_4 (const __m128i *lookup, __m128i indices, unsigned char *target)
+{
+  __m128i byte0 = _mm_shuffle_epi8 (lookup[0], indices);
+  __m128i byte1 = _mm_shuffle_epi8 (lookup[1], indices);
+  __m128i byte2 = _mm_shuffle_epi8 (lookup[2], indices);
+  __m128i byte3 = _mm_shuffle_epi8 (lookup[3], indices);
+
+  __m128i low01 = _mm_unpacklo_epi8 (byte0, byte1);
+  __m128i high01 = _mm_unpackhi_epi8 (byte0, byte1);
+  __m128i low23 = _mm_unpacklo_epi8 (byte2, byte3);
+  __m128i high23 = _mm_unpackhi_epi8 (byte2, byte3);
+
+  _mm_storeu_si128 ((__m128i *) &target[0], _mm_unpacklo_epi16 (low01, low23));
+  _mm_storeu_si128 ((__m128i *) &target[16], _mm_unpackhi_epi16 (low01, low23));
+  _mm_storeu_si128 ((__m128i *) &target[32], _mm_unpacklo_epi16 (high01, high23));
+  _mm_storeu_si128 ((__m128i *) &target[48], _mm_unpackhi_epi16 (high01, high23));
+}
+
+// where each of the 48 bytes of 16 packed pixels comes from in the lookups of the first,
+// second and third byte of a color, -1 where it comes from another
+static const signed char cdplusg_ssse3_store_3_masks [3][3][16] =
+{
+  {
+    { 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5 },
+    { -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1 },
+    { -1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1 }
+  },
+  {
+    { -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1 },
+    { 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10 },
+    { -1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1 }
+  },
+  {
+    { -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1 },
+    { -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1 },
+    { 10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15 }
+  }
+};
+
+CDPLUSG_SSSE3_TARGET static inline void
+cdplusg_ssse3_store_3 (const __m128i *lookup, __m128i indices, unsigned char *target)
+{
+  __m128i bytes [3];
+
+  for (int j = 0; j < 3; j++)
+    bytes[j] = _mm_shuffle_epi8 (lookup[j], indices);
+
+  // no unpack interleaves three ways, so every output vector gathers from all three
+  for (int k = 0; k < 3; k++)
+  {
+    __m128i packed = _mm_setzero_si128 ();
+
+    for (int j = 0; j < 3; j++)
+    {
+      __m128i mask = _mm_loadu_si128 ((const __m128i *) cdplusg_ssse3_store_3_masks[k][j]);
+      packed = _mm_or_si128 (packed, _mm_shuffle_epi8 (bytes[j], mask));
+    }
+
+    _mm_storeu_si128 ((__m128i *) &target[16 * k], packed);
+  }
+}
+
+CDPLUSG_DEFINE_SSSE3_ROW_KERNEL (1)
+CDPLUSG_DEFINE_SSSE3_ROW_KERNEL (2)
+CDPLUSG_DEFINE_SSSE3_ROW_KERNEL (3)
+CDPLUSG_DEFINE_SSSE3_ROW_KERNEL (4)
+
+static const cdplusg_row_kernel cdplusg_ssse3_row_kernels [CDPLUSG_MAX_BYTES_PER_PIXEL] =
+{
+  cdplusg_row_kernel_1_ssse3,
+  cdplusg_row_kernel_2_ssse3,
+  cdplusg_row_kernel_3_ssse3,
+  cdplusg_row_kernel_4_ssse3
+};
+
+#endif
+
+// the best vector kernels the processor running this can take, NULL for the scalar ones
+static const cdplusg_row_kernel *
+cdplusg_get_vector_row_kernels (void)
+{
+#if defined(CDPLUSG_HAVE_SSSE3_KERNELS)
+  if (__builtin_cpu_supports ("ssse3"))
+    return cdplusg_ssse3_row_kernels;
+#endif
+
+  return NULL;
+}
+
+static uint32_t
+cdplusg_pack_channel (unsigned char value, uint32_t mask)
+{
+  if (mask == 0)
+    return 0;
+
+  unsigned int shift = 0;
+  while (!(mask & (1u << shift)))
+    shift++;
+
+  uint32_t max_value = mask >> shift;
+  return (((uint32_t) value * max_value + 127) / 255) << shift;
+}
+
+static unsigned char
+cdplusg_color_to_luma (const struct cdplusg_color_table_entry *color)
+{
+  // ITU-R BT.601 weights in 8-bit fixed point
+  return (unsigned char) ((77 * color->r + 150 * color->g + 29 * color->b + 128) >> 8);
+}
+
+static void
+cdplusg_converter_set_masks (struct cdplusg_converter *converter, uint32_t red_mask, uint32_t green_mask, uint32_t blue_mask, uint32_t alpha_mask)
+{
+  converter->red_mask = red_mask;
+  converter->green_mask = green_mask;
+  converter->blue_mask = blue_mask;
+  converter->alpha_mask = alpha_mask;
+}
+
+static void
+cdplusg_color_to_yuv (const struct cdplusg_color_table_entry *color, unsigned char *y, unsigned char *u, unsigned char *v)
+{
+  // ITU-R BT.601, limited range, as expected by most video encoders
+  int r = color->r;
+  int g = color->g;
+  int b = color->b;
+
+  *y = (unsigned char) (((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+  *u = (unsigned char) (((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+  *v = (unsigned char) (((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+}
+
+// two color indices per byte, the left pixel in the high nibble; the scale factor is
+// handled with a running counter since pixel pairs can straddle source pixels
+static void
+cdplusg_row_kernel_nibble (const unsigned char *source, unsigned int width,
+    const struct cdplusg_packed_color *palette, unsigned char *target, unsigned int scale_factor)
+{
+  unsigned int repeat = 0;
+  unsigned int count = width * scale_factor;
+
+  (void) palette;
+
+  for (unsigned int i = 0; i + 1 < count; i += 2)
+  {
+    unsigned char high = *source & 0x0F;
+
+    if (++repeat == scale_factor)
+    {
+      source++;
+      repeat = 0;
+    }
+
+    unsigned char low = *source & 0x0F;
+
+    if (++repeat == scale_factor)
+    {
+      source++;
+      repeat = 0;
+    }
+
+    *target++ = (unsigned char) (high << 4 | low);
+  }
+
+  if (count % 2 != 0)
+    *target = (unsigned char) ((*source & 0x0F) << 4);
+}
+
+static int
+cdplusg_pixel_format_is_yuv (enum cdplusg_pixel_format format)
+{
+  return format == CDPLUSG_PIXEL_FORMAT_YUV420P || format == CDPLUSG_PIXEL_FORMAT_NV12;
+}
+
+static cdplusg_row_kernel
+cdplusg_select_row_kernel (const struct cdplusg_converter *converter, unsigned int bytes_per_pixel,
+    unsigned int scale_factor)
+{
+  if (scale_factor > CDPLUSG_MAX_SPECIALIZED_SCALE)
+    scale_factor = 0;
+
+  if (scale_factor != 0 && converter->vector_kernels != NULL
+        && converter->vector_kernels[bytes_per_pixel - 1] != NULL)
+    return converter->vector_kernels[bytes_per_pixel - 1];
+
+  return cdplusg_row_kernels[bytes_per_pixel - 1][scale_factor];
+}
+
+static void
+cdplusg_converter_select_kernel (struct cdplusg_converter *converter)
+{
+  if (converter->format == CDPLUSG_PIXEL_FORMAT_INDEX4)
+  {
+    converter->kernel = cdplusg_row_kernel_nibble;
+    return;
+  }
+
+  converter->kernel = cdplusg_select_row_kernel (converter, converter->bytes_per_pixel, converter->scale_factor);
+
+  // with an even scale factor every 2x2 chroma block lies inside a single source
+  // pixel, so the chroma planes are plain replications at half the scale
+  if (cdplusg_pixel_format_is_yuv (converter->format) && converter->scale_factor % 2 == 0)
+  {
+    converter->chroma_kernel = cdplusg_select_row_kernel (converter, 1, converter->scale_factor / 2);
+    converter->interleaved_chroma_kernel = cdplusg_select_row_kernel (converter, 2, converter->scale_factor / 2);
+  }
+}
+
+static int
+cdplusg_converter_setup (struct cdplusg_converter *converter, enum cdplusg_pixel_format format, unsigned int scale_factor,
+    const cdplusg_row_kernel *vector_kernels)
+{
+  if (scale_factor == 0)
+    return 0;
+
+  converter->vector_kernels = vector_kernels;
+
+  cdplusg_converter_set_masks (converter, 0, 0, 0, 0);
+
+  switch (format)
+  {
+    case CDPLUSG_PIXEL_FORMAT_RGBA:
+    case CDPLUSG_PIXEL_FORMAT_BGRA:
+      converter->bytes_per_pixel = 4;
+      break;
+    case CDPLUSG_PIXEL_FORMAT_XRGB8888:
+      converter->bytes_per_pixel = 4;
+      cdplusg_converter_set_masks (converter, 0x00FF0000, 0x0000FF00, 0x000000FF, 0);
+      break;
+    case CDPLUSG_PIXEL_FORMAT_ARGB8888:
+      converter->bytes_per_pixel = 4;
+      cdplusg_converter_set_masks (converter, 0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000);
+      break;
+    case CDPLUSG_PIXEL_FORMAT_RGB24:
+    case CDPLUSG_PIXEL_FORMAT_BGR24:
+      converter->bytes_per_pixel = 3;
+      break;
+    case CDPLUSG_PIXEL_FORMAT_RGB565:
+      converter->bytes_per_pixel = 2;
+      cdplusg_converter_set_masks (converter, 0xF800, 0x07E0, 0x001F, 0);
+      break;
+    case CDPLUSG_PIXEL_FORMAT_GRAY8:
+    case CDPLUSG_PIXEL_FORMAT_INDEX8:
+    case CDPLUSG_PIXEL_FORMAT_INDEX4:
+    case CDPLUSG_PIXEL_FORMAT_YUV420P:
+    case CDPLUSG_PIXEL_FORMAT_NV12:
+      converter->bytes_per_pixel = 1;
+      break;
+    default:
+      return 0;
+  }
+
+  converter->format = format;
+  converter->scale_factor = scale_factor;
+  converter->palette_is_valid = 0;
+
+  converter->width = scale_factor * CDPLUSG_SCREEN_WIDTH;
+  converter->height = scale_factor * CDPLUSG_SCREEN_HEIGHT;
+
+  converter->scaler = CDPLUSG_SCALER_NEAREST;
+  converter->scaler_factor = 1;
+  converter->column_map = NULL;
+  converter->row_map = NULL;
+  converter->scratch = NULL;
+  converter->scratch_count = 0;
+  converter->thread_pool = NULL;
+
+  cdplusg_converter_select_kernel (converter);
+
+  return 1;
+}
+
+static void
+cdplusg_converter_pack_palette (struct cdplusg_converter *converter, const struct cdplusg_color_table_entry *color_table)
+{
+  size_t color_table_size = sizeof (struct cdplusg_color_table_entry) * CDPLUSG_COLOR_TABLE_SIZE;
+
+  if (converter->palette_is_valid && memcmp (converter->color_table, color_table, color_table_size) == 0)
+    return;
+
+  memcpy (converter->color_table, color_table, color_table_size);
+  converter->palette_is_valid = 1;
+
+  for (int i = 0; i < CDPLUSG_COLOR_TABLE_SIZE; i++)
+  {
+    const struct cdplusg_color_table_entry *color = &color_table[i];
+    unsigned char *packed = converter->palette[i].bytes;
+
+    switch (converter->format)
+    {
+      case CDPLUSG_PIXEL_FORMAT_RGBA:
+        packed[0] = color->r;
+        packed[1] = color->g;
+        packed[2] = color->b;
+        packed[3] = 0xFF;
+        break;
+      case CDPLUSG_PIXEL_FORMAT_BGRA:
+        packed[0] = color->b;
+        packed[1] = color->g;
+        packed[2] = color->r;
+        packed[3] = 0xFF;
+        break;
+      case CDPLUSG_PIXEL_FORMAT_RGB24:
+        packed[0] = color->r;
+        packed[1] = color->g;
+        packed[2] = color->b;
+        break;
+      case CDPLUSG_PIXEL_FORMAT_BGR24:
+        packed[0] = color->b;
+        packed[1] = color->g;
+        packed[2] = color->r;
+        break;
+      case CDPLUSG_PIXEL_FORMAT_GRAY8:
+        packed[0] = cdplusg_color_to_luma (color);
+        break;
+      case CDPLUSG_PIXEL_FORMAT_INDEX8:
+      case CDPLUSG_PIXEL_FORMAT_INDEX4:
+        packed[0] = (unsigned char) i;
+        break;
+      case CDPLUSG_PIXEL_FORMAT_YUV420P:
+      case CDPLUSG_PIXEL_FORMAT_NV12:
+      {
+        unsigned char *u = converter->u_palette[i].bytes;
+        unsigned char *v = converter->v_palette[i].bytes;
+
+        cdplusg_color_to_yuv (color, &packed[0], u, v);
+
+        converter->uv_palette[i].bytes[0] = *u;
+        converter->uv_palette[i].bytes[1] = *v;
+        break;
+      }
+      default:
+      {
+        // word formats, stored in native byte order
+        uint32_t word = cdplusg_pack_channel (color->r, converter->red_mask)
+                          | cdplusg_pack_channel (color->g, converter->green_mask)
+                          | cdplusg_pack_channel (color->b, converter->blue_mask)
+                          | converter->alpha_mask;
+
+        if (converter->bytes_per_pixel == 2)
+        {
+          uint16_t half_word = (uint16_t) word;
+          memcpy (packed, &half_word, 2);
+        }
+        else
+        {
+          memcpy (packed, &word, 4);
+        }
+
+        break;
+      }
+    }
+  }
+}
+
+struct cdplusg_converter *
+cdplusg_converter_create (enum cdplusg_pixel_format format, unsigned int scale_factor)
+{
+  struct cdplusg_converter *converter =
+    (struct cdplusg_converter *) calloc (1, sizeof (struct cdplusg_converter));
+
+  if (converter && !cdplusg_converter_setup (converter, format, scale_factor, cdplusg_get_vector_row_kernels ()))
+  {
+    free (converter);
+    return NULL;
+  }
+
+  return converter;
+}
+
+struct cdplusg_converter *
+cdplusg_converter_create_from_masks (unsigned int bytes_per_pixel, uint32_t red_mask, uint32_t green_mask, uint32_t blue_mask, unsigned int scale_factor)
+{
+  if (bytes_per_pixel != 2 && bytes_per_pixel != 4)
+    return NULL;
+
+  struct cdplusg_converter *converter =
+    cdplusg_converter_create (CDPLUSG_PIXEL_FORMAT_XRGB8888, scale_factor);
+
+  // packed like any other word format, only with caller supplied masks
+  if (converter)
+  {
+    converter->bytes_per_pixel = bytes_per_pixel;
+    cdplusg_converter_set_masks (converter, red_mask, green_mask, blue_mask, 0);
+    cdplusg_converter_select_kernel (converter);
+  }
+
+  return converter;
+}
+
+static void
+cdplusg_build_sample_map (unsigned int *map, unsigned int target_size, unsigned int source_size)
+{
+  // sample at pixel centers, so that the rounding error is spread evenly over the output
+  for (unsigned int i = 0; i < target_size; i++)
+    map[i] = (unsigned int) ((2 * (uint64_t) i + 1) * source_size / (2 * (uint64_t) target_size));
+}
+
+static void
+cdplusg_scaler_scratch_free (struct cdplusg_scaler_scratch *scratch, unsigned int count)
+{
+  if (scratch == NULL)
+    return;
+
+  for (unsigned int i = 0; i < count; i++)
+    free (scratch[i].index_rows);
+
+  free (scratch);
+}
+
+// one scratch per thread, for output rows of width pixels
+static struct cdplusg_scaler_scratch *
+cdplusg_scaler_scratch_new (unsigned int count, unsigned int width)
+{
+  struct cdplusg_scaler_scratch *scratch =
+    (struct cdplusg_scaler_scratch *) calloc (count, sizeof (struct cdplusg_scaler_scratch));
+
+  if (scratch == NULL)
+    return NULL;
+
+  for (unsigned int i = 0; i < count; i++)
+  {
+    scratch[i].prescaled_row_index = -1;
+    scratch[i].index_rows = (unsigned char *) malloc (2 * width);
+
+    if (scratch[i].index_rows == NULL)
+    {
+      cdplusg_scaler_scratch_free (scratch, count);
+      return NULL;
+    }
+  }
+
+  return scratch;
+}
+
+static void
+cdplusg_converter_free_scratch (struct cdplusg_converter *converter)
+{
+  cdplusg_scaler_scratch_free (converter->scratch, converter->scratch_count);
+  converter->scratch = NULL;
+  converter->scratch_count = 0;
+}
+
+// only the pixel-art scalers and fractional sizes need scratch space
+static int
+cdplusg_converter_needs_scratch (const struct cdplusg_converter *converter)
+{
+  return converter->row_map != NULL;
+}
+
+static int
+cdplusg_converter_allocate_scratch (struct cdplusg_converter *converter, unsigned int count)
+{
+  cdplusg_converter_free_scratch (converter);
+
+  if (!cdplusg_converter_needs_scratch (converter))
+    return 1;
+
+  converter->scratch = cdplusg_scaler_scratch_new (count, converter->width);
+
+  if (converter->scratch == NULL)
+    return 0;
+
+  converter->scratch_count = count;
+  return 1;
+}
+
+struct cdplusg_converter *
+cdplusg_converter_create_scaled (enum cdplusg_pixel_format format, enum cdplusg_scaler scaler, unsigned int width, unsigned int height)
+{
+  unsigned int scaler_factor;
+
+  switch (scaler)
+  {
+    case CDPLUSG_SCALER_NEAREST:
+      scaler_factor = 1;
+      break;
+    case CDPLUSG_SCALER_SCALE2X:
+      scaler_factor = 2;
+      break;
+    case CDPLUSG_SCALER_SCALE3X:
+      scaler_factor = 3;
+      break;
+    default:
+      return NULL;
+  }
+
+  if (width == 0 || height == 0)
+    return NULL;
+
+  if (cdplusg_pixel_format_is_yuv (format) && (width % 2 != 0 || height % 2 != 0))
+    return NULL;
+
+  if (format == CDPLUSG_PIXEL_FORMAT_INDEX4 && width % 2 != 0)
+    return NULL;
+
+  // integer multiples without a pixel-art scaler take the specialized path
+  if (scaler == CDPLUSG_SCALER_NEAREST && width % CDPLUSG_SCREEN_WIDTH == 0
+        && width / CDPLUSG_SCREEN_WIDTH == height / CDPLUSG_SCREEN_HEIGHT
+        && height % CDPLUSG_SCREEN_HEIGHT == 0)
+  {
+    return cdplusg_converter_create (format, width / CDPLUSG_SCREEN_WIDTH);
+  }
+
+  struct cdplusg_converter *converter = cdplusg_converter_create (format, 1);
+
+  if (converter == NULL)
+    return NULL;
+
+  converter->width = width;
+  converter->height = height;
+  converter->scaler = scaler;
+  converter->scaler_factor = scaler_factor;
+
+  converter->column_map = (unsigned int *) malloc (width * sizeof (unsigned int));
+  converter->row_map = (unsigned int *) malloc (height * sizeof (unsigned int));
+
+  if (!converter->column_map || !converter->row_map || !cdplusg_converter_allocate_scratch (converter, 1))
+  {
+    cdplusg_converter_destroy (converter);
+    return NULL;
+  }
+
+  cdplusg_build_sample_map (converter->column_map, width, scaler_factor * CDPLUSG_SCREEN_WIDTH);
+  cdplusg_build_sample_map (converter->row_map, height, scaler_factor * CDPLUSG_SCREEN_HEIGHT);
+
+  return converter;
+}
+
+void
+cdplusg_converter_destroy (struct cdplusg_converter *converter)
+{
+  if (converter)
+  {
+    cdplusg_thread_pool_free (converter->thread_pool);
+    cdplusg_converter_free_scratch (converter);
+    free (converter->column_map);
+    free (converter->row_map);
+  }
+
+  free (converter);
+}
+
+unsigned int
+cdplusg_converter_get_width (const struct cdplusg_converter *converter)
+{
+  return converter->width;
+}
+
+unsigned int
+cdplusg_converter_get_height (const struct cdplusg_converter *converter)
+{
+  return converter->height;
+}
+
+static size_t
+cdplusg_converter_get_row_size (const struct cdplusg_converter *converter, unsigned int pixel_count)
+{
+  if (converter->format == CDPLUSG_PIXEL_FORMAT_INDEX4)
+    return ((size_t) pixel_count + 1) / 2;
+
+  return (size_t) pixel_count * converter->bytes_per_pixel;
+}
+
+size_t
+cdplusg_converter_get_pixmap_size (const struct cdplusg_converter *converter)
+{
+  size_t size = cdplusg_converter_get_row_size (converter, converter->width) * converter->height;
+
+  // plus two chroma planes (or one interleaved plane) at half resolution each way
+  if (cdplusg_pixel_format_is_yuv (converter->format))
+    size += size / 2;
+
+  return size;
+}
+
+static const unsigned char *
+cdplusg_get_pixels_at_const (const unsigned char *pixels, int row, int col)
+{
+  return &pixels[row * CDPLUSG_SCREEN_WIDTH + col];
+}
+
+static const struct cdplusg_rect cdplusg_screen_rect =
+{
+  0, 0, CDPLUSG_SCREEN_WIDTH, CDPLUSG_SCREEN_HEIGHT
+};
+
+static void
+cdplusg_convert_rows (cdplusg_row_kernel kernel, const struct cdplusg_packed_color *palette, const unsigned char *pixels,
+    const struct cdplusg_rect *rect, unsigned char *target, size_t pitch, unsigned int scale_factor, size_t row_size)
+{
+  for (int i = 0; i < rect->height; i++)
+  {
+    const unsigned char *source = cdplusg_get_pixels_at_const (pixels, rect->y + i, rect->x);
+    unsigned char *row = &target[i * scale_factor * pitch];
+
+    kernel (source, rect->width, palette, row, scale_factor);
+
+    for (unsigned int j = 1; j < scale_factor; j++)
+      memcpy (&row[j * pitch], row, row_size);
+  }
+}
+
+static void
+cdplusg_average_chroma_row (const struct cdplusg_converter *converter, const unsigned char *row0, const unsigned char *row1,
+    unsigned int width, unsigned int scale_factor, unsigned char *u_row, unsigned char *v_row, unsigned int step)
+{
+  const struct cdplusg_packed_color *u_palette = converter->u_palette;
+  const struct cdplusg_packed_color *v_palette = converter->v_palette;
+
+  for (unsigned int j = 0; j < width; j++)
+  {
+    unsigned int column0 = 2 * j / scale_factor;
+    unsigned int column1 = (2 * j + 1) / scale_factor;
+
+    unsigned int u = u_palette[row0[column0]].bytes[0] + u_palette[row0[column1]].bytes[0]
+                       + u_palette[row1[column0]].bytes[0] + u_palette[row1[column1]].bytes[0];
+    unsigned int v = v_palette[row0[column0]].bytes[0] + v_palette[row0[column1]].bytes[0]
+                       + v_palette[row1[column0]].bytes[0] + v_palette[row1[column1]].bytes[0];
+
+    u_row[j * step] = (unsigned char) ((u + 2) / 4);
+    v_row[j * step] = (unsigned char) ((v + 2) / 4);
+  }
+}
+
+// the pixel-art scalers work on color indices, before the palette lookup; each call
+// produces one row of the scaled image, written so that the compiler can vectorize it
+static void
+cdplusg_scale2x_row (const unsigned char *pixels, unsigned int row, unsigned char *target)
+{
+  unsigned int source_row = row / 2;
+  const unsigned char *center = &pixels[source_row * CDPLUSG_SCREEN_WIDTH];
+  const unsigned char *above = source_row > 0 ? center - CDPLUSG_SCREEN_WIDTH : center;
+  const unsigned char *below = source_row + 1 < CDPLUSG_SCREEN_HEIGHT ? center + CDPLUSG_SCREEN_WIDTH : center;
+
+  // the lower half of a 2x2 block is the upper half mirrored vertically
+  if (row % 2 == 1)
+  {
+    const unsigned char *swap = above;
+    above = below;
+    below = swap;
+  }
+
+  for (unsigned int i = 0; i < CDPLUSG_SCREEN_WIDTH; i++)
+  {
+    unsigned char b = above[i];
+    unsigned char d = center[i > 0 ? i - 1 : i];
+    unsigned char e = center[i];
+    unsigned char f = center[i + 1 < CDPLUSG_SCREEN_WIDTH ? i + 1 : i];
+    unsigned char h = below[i];
+
+    target[2 * i + 0] = (d == b && b != f && d != h) ? d : e;
+    target[2 * i + 1] = (b == f && b != d && f != h) ? f : e;
+  }
+}
+
+static void
+cdplusg_scale3x_row (const unsigned char *pixels, unsigned int row, unsigned char *target)
+{
+  unsigned int source_row = row / 3;
+  const unsigned char *center = &pixels[source_row * CDPLUSG_SCREEN_WIDTH];
+  const unsigned char *above = source_row > 0 ? center - CDPLUSG_SCREEN_WIDTH : center;
+  const unsigned char *below = source_row + 1 < CDPLUSG_SCREEN_HEIGHT ? center + CDPLUSG_SCREEN_WIDTH : center;
+
+  // the bottom row of a 3x3 block is the top row mirrored vertically
+  if (row % 3 == 2)
+  {
+    const unsigned char *swap = above;
+    above = below;
+    below = swap;
+  }
+
+  for (unsigned int i = 0; i < CDPLUSG_SCREEN_WIDTH; i++)
+  {
+    unsigned int left = i > 0 ? i - 1 : i;
+    unsigned int right = i + 1 < CDPLUSG_SCREEN_WIDTH ? i + 1 : i;
+
+    unsigned char a = above[left], b = above[i], c = above[right];
+    unsigned char d = center[left], e = center[i], f = center[right];
+    unsigned char g = below[left], h = below[i], k = below[right];
+
+    int top_left = (d == b && b != f && d != h);
+    int top_right = (b == f && b != d && f != h);
+    int bottom_left = (d == h && d != b && h != f);
+    int bottom_right = (h == f && d != h && b != f);
+
+    if (row % 3 == 1)
+    {
+      target[3 * i + 0] = ((top_left && e != g) || (bottom_left && e != a)) ? d : e;
+      target[3 * i + 1] = e;
+      target[3 * i + 2] = ((top_right && e != k) || (bottom_right && e != c)) ? f : e;
+    }
+    else
+    {
+      target[3 * i + 0] = top_left ? d : e;
+      target[3 * i + 1] = ((top_left && e != c) || (top_right && e != a)) ? b : e;
+      target[3 * i + 2] = top_right ? f : e;
+    }
+  }
+}
+
+static void
+cdplusg_converter_scale_row (const struct cdplusg_converter *converter, struct cdplusg_scaler_scratch *scratch,
+    const unsigned char *pixels, unsigned int row, unsigned int first_column, unsigned int last_column, unsigned char *indices)
+{
+  unsigned int prescaled_row_index = converter->row_map[row];
+  const unsigned char *prescaled_row = scratch->prescaled_row;
+
+  switch (converter->scaler)
+  {
+    case CDPLUSG_SCALER_SCALE2X:
+      if ((int) prescaled_row_index != scratch->prescaled_row_index)
+        cdplusg_scale2x_row (pixels, prescaled_row_index, scratch->prescaled_row);
+      break;
+    case CDPLUSG_SCALER_SCALE3X:
+      if ((int) prescaled_row_index != scratch->prescaled_row_index)
+        cdplusg_scale3x_row (pixels, prescaled_row_index, scratch->prescaled_row);
+      break;
+    default:
+      prescaled_row = &pixels[prescaled_row_index * CDPLUSG_SCREEN_WIDTH];
+      break;
+  }
+
+  scratch->prescaled_row_index = (int) prescaled_row_index;
+
+  for (unsigned int i = first_column; i < last_column; i++)
+    indices[i - first_column] = prescaled_row[converter->column_map[i]];
+}
+
+static unsigned int
+cdplusg_sample_map_lower_bound (const unsigned int *map, unsigned int size, unsigned int value)
+{
+  unsigned int low = 0;
+  unsigned int high = size;
+
+  while (low < high)
+  {
+    unsigned int middle = low + (high - low) / 2;
+
+    if (map[middle] < value)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+
+  return low;
+}
+
+// one conversion call, split into horizontal bands that can be converted independently
+struct cdplusg_conversion
+{
+  const struct cdplusg_converter *converter;
+  const unsigned char *pixels;
+
+  // the clipped source rectangle and the output rows and columns it covers
+  struct cdplusg_rect rect;
+  unsigned int first_column;
+  unsigned int last_column;
+  unsigned int first_row;
+  unsigned int last_row;
+
+  // where the first output pixel of the rectangle goes
+  unsigned char *target;
+  size_t pitch;
+
+  // the chroma planes of a whole-frame YUV conversion, NULL otherwise
+  unsigned char *u_plane;
+  unsigned char *v_plane;
+  unsigned int chroma_step;
+};
+
+static void
+cdplusg_split_band (unsigned int first, unsigned int last, unsigned int band, unsigned int band_count,
+    unsigned int *band_first, unsigned int *band_last)
+{
+  unsigned int count = last - first;
+
+  *band_first = first + (unsigned int) ((uint64_t) count * band / band_count);
+  *band_last = first + (unsigned int) ((uint64_t) count * (band + 1) / band_count);
+}
+
+static void
+cdplusg_conversion_run_scaled_band (const struct cdplusg_conversion *conversion, struct cdplusg_scaler_scratch *scratch,
+    unsigned int band, unsigned int band_count)
+{
+  const struct cdplusg_converter *converter = conversion->converter;
+  unsigned int width = conversion->last_column - conversion->first_column;
+  size_t row_size = cdplusg_converter_get_row_size (converter, width);
+  unsigned char *indices = scratch->index_rows;
+
+  unsigned int first_row, last_row;
+  cdplusg_split_band (conversion->first_row, conversion->last_row, band, band_count, &first_row, &last_row);
+
+  // rows are cached by index only, the pixels may have changed since the last frame
+  scratch->prescaled_row_index = -1;
+
+  for (unsigned int i = first_row; i < last_row; i++)
+  {
+    unsigned char *row = &conversion->target[(i - conversion->first_row) * conversion->pitch];
+
+    if (i > first_row && converter->row_map[i] == converter->row_map[i - 1])
+    {
+      memcpy (row, row - conversion->pitch, row_size);
+      continue;
+    }
+
+    cdplusg_converter_scale_row (converter, scratch, conversion->pixels, i,
+        conversion->first_column, conversion->last_column, indices);
+    converter->kernel (indices, width, converter->palette, row, 1);
+  }
+
+  if (conversion->u_plane == NULL)
+    return;
+
+  unsigned int chroma_width = converter->width / 2;
+  unsigned int first_chroma_row, last_chroma_row;
+  cdplusg_split_band (0, converter->height / 2, band, band_count, &first_chroma_row, &last_chroma_row);
+
+  scratch->prescaled_row_index = -1;
+
+  for (unsigned int i = first_chroma_row; i < last_chroma_row; i++)
+  {
+    size_t offset = (size_t) i * chroma_width * conversion->chroma_step;
+
+    cdplusg_converter_scale_row (converter, scratch, conversion->pixels, 2 * i, 0, converter->width, &indices[0]);
+    cdplusg_converter_scale_row (converter, scratch, conversion->pixels, 2 * i + 1, 0, converter->width, &indices[converter->width]);
+    cdplusg_average_chroma_row (converter, &indices[0], &indices[converter->width], chroma_width, 1,
+        &conversion->u_plane[offset], &conversion->v_plane[offset], conversion->chroma_step);
+  }
+}
+
+static void
+cdplusg_conversion_run_band (void *data, unsigned int band, unsigned int band_count)
+{
+  const struct cdplusg_conversion *conversion = (const struct cdplusg_conversion *) data;
+  const struct cdplusg_converter *converter = conversion->converter;
+
+  if (converter->row_map != NULL)
+  {
+    cdplusg_conversion_run_scaled_band (conversion, &converter->scratch[band], band, band_count);
+    return;
+  }
+
+  // each band converts whole source rows, including their replicated copies
+  unsigned int scale_factor = converter->scale_factor;
+  struct cdplusg_rect rect = conversion->rect;
+  unsigned int first_row, last_row;
+
+  cdplusg_split_band (rect.y, rect.y + rect.height, band, band_count, &first_row, &last_row);
+
+  rect.y = (int) first_row;
+  rect.height = (int) (last_row - first_row);
+
+  unsigned char *target = &conversion->target[(first_row - conversion->rect.y) * scale_factor * conversion->pitch];
+
+  cdplusg_convert_rows (converter->kernel, converter->palette, conversion->pixels, &rect,
+      target, conversion->pitch, scale_factor, cdplusg_converter_get_row_size (converter, scale_factor * rect.width));
+
+  if (conversion->u_plane == NULL)
+    return;
+
+  // with an even scale factor every 2x2 chroma block lies inside a single source pixel
+  if (scale_factor % 2 == 0)
+  {
+    size_t chroma_pitch = (size_t) scale_factor / 2 * CDPLUSG_SCREEN_WIDTH * conversion->chroma_step;
+    size_t offset = (size_t) first_row * scale_factor / 2 * chroma_pitch;
+
+    // the chroma planes are always whole rows, so the pitch is also the row size
+
+    if (converter->format == CDPLUSG_PIXEL_FORMAT_NV12)
+    {
+      cdplusg_convert_rows (converter->interleaved_chroma_kernel, converter->uv_palette, conversion->pixels, &rect,
+          &conversion->u_plane[offset], chroma_pitch, scale_factor / 2, chroma_pitch);
+    }
+    else
+    {
+      cdplusg_convert_rows (converter->chroma_kernel, converter->u_palette, conversion->pixels, &rect,
+          &conversion->u_plane[offset], chroma_pitch, scale_factor / 2, chroma_pitch);
+      cdplusg_convert_rows (converter->chroma_kernel, converter->v_palette, conversion->pixels, &rect,
+          &conversion->v_plane[offset], chroma_pitch, scale_factor / 2, chroma_pitch);
+    }
+
+    return;
+  }
+
+  // with an odd scale factor a 2x2 chroma block can straddle up to four source pixels,
+  // so each chroma sample is the average of the four covered table entries
+  unsigned int chroma_width = scale_factor * CDPLUSG_SCREEN_WIDTH / 2;
+  unsigned int first_chroma_row, last_chroma_row;
+
+  cdplusg_split_band (0, scale_factor * CDPLUSG_SCREEN_HEIGHT / 2, band, band_count, &first_chroma_row, &last_chroma_row);
+
+  for (unsigned int i = first_chroma_row; i < last_chroma_row; i++)
+  {
+    const unsigned char *row0 = &conversion->pixels[(2 * i / scale_factor) * CDPLUSG_SCREEN_WIDTH];
+    const unsigned char *row1 = &conversion->pixels[((2 * i + 1) / scale_factor) * CDPLUSG_SCREEN_WIDTH];
+    size_t offset = (size_t) i * chroma_width * conversion->chroma_step;
+
+    cdplusg_average_chroma_row (converter, row0, row1, chroma_width, scale_factor,
+        &conversion->u_plane[offset], &conversion->v_plane[offset], conversion->chroma_step);
+  }
+}
+
+static void
+cdplusg_conversion_initialize (struct cdplusg_conversion *conversion, const struct cdplusg_converter *converter,
+    const unsigned char *pixels, const struct cdplusg_rect *rect)
+{
+  unsigned int scale_factor = converter->scale_factor;
+  unsigned int scaler_factor = converter->scaler_factor;
+
+  conversion->converter = converter;
+  conversion->pixels = pixels;
+  conversion->rect = *rect;
+  conversion->u_plane = NULL;
+  conversion->v_plane = NULL;
+  conversion->chroma_step = 1;
+
+  if (converter->row_map == NULL)
+  {
+    conversion->first_column = rect->x * scale_factor;
+    conversion->last_column = (rect->x + rect->width) * scale_factor;
+    conversion->first_row = rect->y * scale_factor;
+    conversion->last_row = (rect->y + rect->height) * scale_factor;
+    return;
+  }
+
+  // the output pixels whose samples fall inside the source rectangle
+  conversion->first_column =
+    cdplusg_sample_map_lower_bound (converter->column_map, converter->width, rect->x * scaler_factor);
+  conversion->last_column =
+    cdplusg_sample_map_lower_bound (converter->column_map, converter->width, (rect->x + rect->width) * scaler_factor);
+  conversion->first_row =
+    cdplusg_sample_map_lower_bound (converter->row_map, converter->height, rect->y * scaler_factor);
+  conversion->last_row =
+    cdplusg_sample_map_lower_bound (converter->row_map, converter->height, (rect->y + rect->height) * scaler_factor);
+}
+
+static void
+cdplusg_conversion_run (struct cdplusg_conversion *conversion, struct cdplusg_thread_pool *pool)
+{
+  if (pool != NULL)
+    cdplusg_thread_pool_run (pool, cdplusg_conversion_run_band, conversion);
+  else
+    cdplusg_conversion_run_band (conversion, 0, 1);
+}
+
+void
+cdplusg_converter_convert (struct cdplusg_converter *converter, const struct cdplusg_graphics_state *gpx_state, unsigned char *pixmap)
+{
+  struct cdplusg_conversion conversion;
+  size_t luma_size = (size_t) converter->width * converter->height;
+
+  cdplusg_converter_pack_palette (converter, gpx_state->color_table);
+  cdplusg_conversion_initialize (&conversion, converter, gpx_state->pixels, &cdplusg_screen_rect);
+
+  conversion.target = pixmap;
+  conversion.pitch = cdplusg_converter_get_row_size (converter, converter->width);
+
+  if (converter->format == CDPLUSG_PIXEL_FORMAT_NV12)
+  {
+    conversion.u_plane = &pixmap[luma_size];
+    conversion.v_plane = &pixmap[luma_size + 1];
+    conversion.chroma_step = 2;
+  }
+  else if (converter->format == CDPLUSG_PIXEL_FORMAT_YUV420P)
+  {
+    conversion.u_plane = &pixmap[luma_size];
+    conversion.v_plane = &pixmap[luma_size + luma_size / 4];
+  }
+
+  cdplusg_conversion_run (&conversion, converter->thread_pool);
+}
+
+int
+cdplusg_converter_convert_rect (struct cdplusg_converter *converter, const struct cdplusg_graphics_state *gpx_state,
+    const struct cdplusg_rect *source_rect, unsigned char *target, size_t pitch, int x, int y)
+{
+  if (cdplusg_pixel_format_is_yuv (converter->format) || converter->format == CDPLUSG_PIXEL_FORMAT_INDEX4)
+    return 0;
+
+  struct cdplusg_rect rect = source_rect ? *source_rect : cdplusg_screen_rect;
+
+  // clip to the screen
+  if (rect.x < 0)
+  {
+    rect.width += rect.x;
+    rect.x = 0;
+  }
+
+  if (rect.y < 0)
+  {
+    rect.height += rect.y;
+    rect.y = 0;
+  }
+
+  if (rect.x + rect.width > CDPLUSG_SCREEN_WIDTH)
+    rect.width = CDPLUSG_SCREEN_WIDTH - rect.x;
+
+  if (rect.y + rect.height > CDPLUSG_SCREEN_HEIGHT)
+    rect.height = CDPLUSG_SCREEN_HEIGHT - rect.y;
+
+  if (rect.width <= 0 || rect.height <= 0)
+    return 1;
+
+  struct cdplusg_conversion conversion;
+
+  cdplusg_converter_pack_palette (converter, gpx_state->color_table);
+  cdplusg_conversion_initialize (&conversion, converter, gpx_state->pixels, &rect);
+
+  // (x, y) is where the top left corner of the whole frame goes, so the offset of the
+  // rectangle is added on top; it may be negative as long as the rectangle is not
+  ptrdiff_t offset = ((ptrdiff_t) y + conversion.first_row) * (ptrdiff_t) pitch
+                       + ((ptrdiff_t) x + conversion.first_column) * (ptrdiff_t) converter->bytes_per_pixel;
+
+  conversion.target = target + offset;
+  conversion.pitch = pitch;
+
+  cdplusg_conversion_run (&conversion, converter->thread_pool);
+
+  return 1;
+}
+
+int
+cdplusg_converter_set_thread_count (struct cdplusg_converter *converter, unsigned int thread_count)
+{
+  if (thread_count == 0)
+    return 0;
+
+  unsigned int current_thread_count =
+    converter->thread_pool ? cdplusg_thread_pool_get_thread_count (converter->thread_pool) : 1;
+
+  if (thread_count == current_thread_count)
+    return 1;
+
+  // everything new is allocated before anything old is freed, so that a failure leaves the
+  // converter as it was
+  struct cdplusg_scaler_scratch *scratch = NULL;
+  struct cdplusg_thread_pool *thread_pool = NULL;
+
+  if (cdplusg_converter_needs_scratch (converter))
+  {
+    scratch = cdplusg_scaler_scratch_new (thread_count, converter->width);
+
+    if (scratch == NULL)
+      return 0;
+  }
+
+  if (thread_count > 1)
+  {
+    thread_pool = cdplusg_thread_pool_new (thread_count);
+
+    if (thread_pool == NULL)
+    {
+      cdplusg_scaler_scratch_free (scratch, thread_count);
+      return 0;
+    }
+  }
+
+  if (scratch != NULL)
+  {
+    cdplusg_converter_free_scratch (converter);
+    converter->scratch = scratch;
+    converter->scratch_count = thread_count;
+  }
+
+  cdplusg_thread_pool_free (converter->thread_pool);
+  converter->thread_pool = thread_pool;
+
+  return 1;
+}
+
+void
+cdplusg_graphics_state_to_pixmap (struct cdplusg_graphics_state *gpx_state, unsigned char *pixmap, unsigned int scale_factor, enum cdplusg_byte_order byte_order)
+{
+  struct cdplusg_converter converter;
+
+  enum cdplusg_pixel_format format =
+    (byte_order == CDPLUSG_BYTE_ORDER_RGB) ? CDPLUSG_PIXEL_FORMAT_RGBA : CDPLUSG_PIXEL_FORMAT_BGRA;
+
+  if (!cdplusg_converter_setup (&converter, format, scale_factor, cdplusg_get_vector_row_kernels ()))
+    return;
+
+  cdplusg_converter_convert (&converter, gpx_state, pixmap);
+}
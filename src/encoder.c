@@ -0,0 +1,714 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cdplusg.h"
+
+#define CDPLUSG_TILE_COUNT (CDPLUSG_TILE_ROWS * CDPLUSG_TILE_COLUMNS)
+#define CDPLUSG_TILE_PIXELS (CDPLUSG_FONT_WIDTH * CDPLUSG_FONT_HEIGHT)
+
+// colors are carried with four bits per primary, see cdplusg_decode_color_to_struct
+#define CDPLUSG_COLOR_LEVELS 16
+#define CDPLUSG_COLOR_CUBE_SIZE (CDPLUSG_COLOR_LEVELS * CDPLUSG_COLOR_LEVELS * CDPLUSG_COLOR_LEVELS)
+
+// no tile needs more than one packet per bit of a color index
+#define CDPLUSG_MAX_TILE_PACKETS 4
+
+struct cdplusg_tile_packet
+{
+  int is_xor;
+  unsigned char color0;
+  unsigned char color1;
+  unsigned char tile [CDPLUSG_FONT_HEIGHT];
+};
+
+struct cdplusg_tile_plan
+{
+  int packet_count;
+  struct cdplusg_tile_packet packets [CDPLUSG_MAX_TILE_PACKETS];
+};
+
+struct cdplusg_encoder_tile
+{
+  int row;
+  int column;
+  unsigned long priority;
+};
+
+struct cdplusg_encoder
+{
+  // what a decoder fed with everything emitted so far shows
+  struct cdplusg_graphics_state *gpx_state;
+
+  unsigned char target [CDPLUSG_SCREEN_WIDTH * CDPLUSG_SCREEN_HEIGHT];
+  struct cdplusg_color_table_entry target_palette [CDPLUSG_COLOR_TABLE_SIZE];
+
+  // number of encode calls that left each tile differing from the target, so that tiles
+  // with small changes are not starved by busier parts of the screen
+  unsigned int tile_age [CDPLUSG_TILE_COUNT];
+
+  struct cdplusg_encoder_tile tiles [CDPLUSG_TILE_COUNT];
+
+  // palette selection for RGB frames
+  uint32_t color_counts [CDPLUSG_COLOR_CUBE_SIZE];
+  unsigned char color_to_index [CDPLUSG_COLOR_CUBE_SIZE];
+  uint16_t frame_colors [CDPLUSG_SCREEN_WIDTH * CDPLUSG_SCREEN_HEIGHT];
+};
+
+static unsigned int
+cdplusg_quantize_channel (unsigned int value)
+{
+  return (value * (CDPLUSG_COLOR_LEVELS - 1) + 127) / 255;
+}
+
+static unsigned char
+cdplusg_expand_channel (unsigned int level)
+{
+  return 255 * level / (CDPLUSG_COLOR_LEVELS - 1);
+}
+
+static unsigned int
+cdplusg_color_to_cube (struct cdplusg_color_table_entry color)
+{
+  return cdplusg_quantize_channel (color.r) << 8
+    | cdplusg_quantize_channel (color.g) << 4
+    | cdplusg_quantize_channel (color.b);
+}
+
+static struct cdplusg_color_table_entry
+cdplusg_cube_to_color (unsigned int cube_color)
+{
+  struct cdplusg_color_table_entry color = { 0 };
+
+  color.r = cdplusg_expand_channel ((cube_color >> 8) & 0x0F);
+  color.g = cdplusg_expand_channel ((cube_color >> 4) & 0x0F);
+  color.b = cdplusg_expand_channel ((cube_color >> 0) & 0x0F);
+
+  return color;
+}
+
+static int
+cdplusg_cube_distance (unsigned int a, unsigned int b)
+{
+  int r = (int) ((a >> 8) & 0x0F) - (int) ((b >> 8) & 0x0F);
+  int g = (int) ((a >> 4) & 0x0F) - (int) ((b >> 4) & 0x0F);
+  int l = (int) ((a >> 0) & 0x0F) - (int) ((b >> 0) & 0x0F);
+
+  // weighted roughly like luma, green differences are the most visible
+  return 3 * r * r + 6 * g * g + l * l;
+}
+
+static int
+cdplusg_color_luma (struct cdplusg_color_table_entry color)
+{
+  return (77 * color.r + 150 * color.g + 29 * color.b) >> 8;
+}
+
+static int
+cdplusg_popcount4 (unsigned int bits)
+{
+  return (bits & 1) + ((bits >> 1) & 1) + ((bits >> 2) & 1) + ((bits >> 3) & 1);
+}
+
+struct cdplusg_encoder *
+cdplusg_encoder_new (void)
+{
+  struct cdplusg_encoder *encoder = (struct cdplusg_encoder *) calloc (1, sizeof (struct cdplusg_encoder));
+
+  if (encoder == NULL)
+    return NULL;
+
+  encoder->gpx_state = cdplusg_graphics_state_new ();
+
+  return encoder;
+}
+
+void
+cdplusg_encoder_free (struct cdplusg_encoder *encoder)
+{
+  if (encoder)
+    cdplusg_graphics_state_free (encoder->gpx_state);
+
+  free (encoder);
+}
+
+const struct cdplusg_graphics_state *
+cdplusg_encoder_get_graphics_state (const struct cdplusg_encoder *encoder)
+{
+  return encoder->gpx_state;
+}
+
+void
+cdplusg_encoder_set_frame_indexed (struct cdplusg_encoder *encoder, const unsigned char *indices,
+    const struct cdplusg_color_table_entry *palette)
+{
+  for (int i = 0; i < CDPLUSG_SCREEN_WIDTH * CDPLUSG_SCREEN_HEIGHT; i++)
+    encoder->target[i] = indices[i] & 0x0F;
+
+  for (int i = 0; i < CDPLUSG_COLOR_TABLE_SIZE; i++)
+    encoder->target_palette[i] = cdplusg_cube_to_color (cdplusg_color_to_cube (palette[i]));
+}
+
+void
+cdplusg_encoder_set_frame_rgb (struct cdplusg_encoder *encoder, const unsigned char *rgb, size_t pitch)
+{
+  uint16_t present_colors [CDPLUSG_COLOR_CUBE_SIZE];
+  unsigned int present_count = 0;
+
+  for (int i = 0; i < CDPLUSG_SCREEN_HEIGHT; i++)
+  {
+    const unsigned char *row = &rgb[i * pitch];
+
+    for (int j = 0; j < CDPLUSG_SCREEN_WIDTH; j++)
+    {
+      unsigned int cube_color = cdplusg_quantize_channel (row[3 * j + 0]) << 8
+                                 | cdplusg_quantize_channel (row[3 * j + 1]) << 4
+                                 | cdplusg_quantize_channel (row[3 * j + 2]);
+
+      if (encoder->color_counts[cube_color]++ == 0)
+        present_colors[present_count++] = cube_color;
+
+      encoder->frame_colors[i * CDPLUSG_SCREEN_WIDTH + j] = cube_color;
+    }
+  }
+
+  // the 16 most frequent colors make the palette
+  unsigned int chosen [CDPLUSG_COLOR_TABLE_SIZE];
+  unsigned int chosen_count = 0;
+
+  for (; chosen_count < CDPLUSG_COLOR_TABLE_SIZE && chosen_count < present_count; chosen_count++)
+  {
+    unsigned int best = chosen_count;
+
+    for (unsigned int i = chosen_count + 1; i < present_count; i++)
+    {
+      if (encoder->color_counts[present_colors[i]] > encoder->color_counts[present_colors[best]])
+        best = i;
+    }
+
+    uint16_t swap = present_colors[chosen_count];
+    present_colors[chosen_count] = present_colors[best];
+    present_colors[best] = swap;
+
+    chosen[chosen_count] = present_colors[chosen_count];
+  }
+
+  // colors that are already loaded keep their index, so that neither the color table nor
+  // the tiles using them have to be sent again; new colors take over the unused entries
+  int slot_taken [CDPLUSG_COLOR_TABLE_SIZE] = { 0 };
+  int chosen_placed [CDPLUSG_COLOR_TABLE_SIZE] = { 0 };
+  unsigned int slot_color [CDPLUSG_COLOR_TABLE_SIZE];
+
+  for (int i = 0; i < CDPLUSG_COLOR_TABLE_SIZE; i++)
+    slot_color[i] = cdplusg_color_to_cube (encoder->target_palette[i]);
+
+  for (unsigned int i = 0; i < chosen_count; i++)
+  {
+    for (int j = 0; j < CDPLUSG_COLOR_TABLE_SIZE; j++)
+    {
+      if (!slot_taken[j] && slot_color[j] == chosen[i])
+      {
+        slot_taken[j] = 1;
+        chosen_placed[i] = 1;
+        break;
+      }
+    }
+  }
+
+  for (unsigned int i = 0, j = 0; i < chosen_count; i++)
+  {
+    if (chosen_placed[i])
+      continue;
+
+    while (slot_taken[j])
+      j++;
+
+    slot_taken[j] = 1;
+    slot_color[j] = chosen[i];
+    encoder->target_palette[j] = cdplusg_cube_to_color (chosen[i]);
+  }
+
+  // every color in the frame maps to the closest color of the palette
+  for (unsigned int i = 0; i < present_count; i++)
+  {
+    unsigned int cube_color = present_colors[i];
+    int best_distance = -1;
+
+    for (int j = 0; j < CDPLUSG_COLOR_TABLE_SIZE; j++)
+    {
+      if (!slot_taken[j])
+        continue;
+
+      int distance = cdplusg_cube_distance (cube_color, slot_color[j]);
+
+      if (best_distance < 0 || distance < best_distance)
+      {
+        best_distance = distance;
+        encoder->color_to_index[cube_color] = j;
+      }
+    }
+
+    encoder->color_counts[cube_color] = 0;
+  }
+
+  for (int i = 0; i < CDPLUSG_SCREEN_WIDTH * CDPLUSG_SCREEN_HEIGHT; i++)
+    encoder->target[i] = encoder->color_to_index[encoder->frame_colors[i]];
+}
+
+static void
+cdplusg_get_tile (const unsigned char *pixels, int row, int column, unsigned char *values)
+{
+  for (int i = 0; i < CDPLUSG_FONT_HEIGHT; i++)
+  {
+    const unsigned char *row_pixels = &pixels[(row + i) * CDPLUSG_SCREEN_WIDTH + column];
+    memcpy (&values[i * CDPLUSG_FONT_WIDTH], row_pixels, CDPLUSG_FONT_WIDTH);
+  }
+}
+
+// Builds the tile bitmap of the pixels for which (value & mask) == match.
+static void
+cdplusg_tile_plan_add (struct cdplusg_tile_plan *plan, int is_xor, unsigned char color0, unsigned char color1,
+    const unsigned char *values, unsigned char mask, unsigned char match)
+{
+  struct cdplusg_tile_packet *packet = &plan->packets[plan->packet_count++];
+
+  packet->is_xor = is_xor;
+  packet->color0 = color0;
+  packet->color1 = color1;
+
+  for (int i = 0; i < CDPLUSG_FONT_HEIGHT; i++)
+  {
+    unsigned char bits = 0;
+
+    for (int j = 0; j < CDPLUSG_FONT_WIDTH; j++)
+    {
+      if ((values[i * CDPLUSG_FONT_WIDTH + j] & mask) == match)
+        bits |= 0x20 >> j;
+    }
+
+    packet->tile[i] = bits;
+  }
+}
+
+// Values present in a tile, most frequent first; returns how many there are.
+static int
+cdplusg_tile_colors (const unsigned char *values, unsigned char *colors)
+{
+  int counts [CDPLUSG_COLOR_TABLE_SIZE] = { 0 };
+  int color_count = 0;
+
+  for (int i = 0; i < CDPLUSG_TILE_PIXELS; i++)
+    counts[values[i]]++;
+
+  for (int i = 0; i < CDPLUSG_COLOR_TABLE_SIZE; i++)
+  {
+    if (counts[i] == 0)
+      continue;
+
+    int j = color_count++;
+
+    while (j > 0 && counts[colors[j - 1]] < counts[i])
+    {
+      colors[j] = colors[j - 1];
+      j--;
+    }
+
+    colors[j] = i;
+  }
+
+  return color_count;
+}
+
+enum cdplusg_tile_strategy
+{
+  CDPLUSG_TILE_BY_COLOR,
+  CDPLUSG_TILE_BY_BIT,
+  CDPLUSG_TILE_XOR_BY_VALUE,
+  CDPLUSG_TILE_XOR_BY_BIT
+};
+
+// Finds the fewest packets turning the current tile into the target tile. A TILE_BLOCK sets
+// two colors at once and each TILE_BLOCK_XOR flips one set of pixels by one value, so the
+// candidates are: a TILE_BLOCK followed by one XOR per remaining color or per remaining bit
+// of the color index, or XORs alone on top of what is there, again per value or per bit.
+// Drawing per bit never takes more than four packets.
+static void
+cdplusg_plan_tile (const unsigned char *current, const unsigned char *target, struct cdplusg_tile_plan *plan)
+{
+  unsigned char difference [CDPLUSG_TILE_PIXELS];
+  unsigned char base_difference [CDPLUSG_TILE_PIXELS];
+  unsigned char colors [CDPLUSG_COLOR_TABLE_SIZE];
+  unsigned char difference_values [CDPLUSG_COLOR_TABLE_SIZE];
+
+  unsigned int difference_bits = 0;
+
+  for (int i = 0; i < CDPLUSG_TILE_PIXELS; i++)
+  {
+    difference[i] = current[i] ^ target[i];
+    difference_bits |= difference[i];
+  }
+
+  plan->packet_count = 0;
+
+  if (difference_bits == 0)
+    return;
+
+  int color_count = cdplusg_tile_colors (target, colors);
+  unsigned char base = colors[0];
+  unsigned int base_bits = 0;
+
+  for (int i = 0; i < CDPLUSG_TILE_PIXELS; i++)
+  {
+    base_difference[i] = target[i] ^ base;
+    base_bits |= base_difference[i];
+  }
+
+  int difference_count = cdplusg_tile_colors (difference, difference_values);
+  int nonzero_count = difference_count - (memchr (difference_values, 0, difference_count) != NULL);
+
+  // on a tie the plans starting with a TILE_BLOCK win, they do not depend on what was there
+  int costs [] =
+  {
+    color_count > 1 ? color_count - 1 : 1,
+    base_bits ? cdplusg_popcount4 (base_bits) : 1,
+    nonzero_count,
+    cdplusg_popcount4 (difference_bits)
+  };
+
+  enum cdplusg_tile_strategy strategy = CDPLUSG_TILE_BY_COLOR;
+
+  for (int i = CDPLUSG_TILE_BY_BIT; i <= CDPLUSG_TILE_XOR_BY_BIT; i++)
+  {
+    if (costs[i] < costs[strategy])
+      strategy = i;
+  }
+
+  switch (strategy)
+  {
+    case CDPLUSG_TILE_BY_COLOR:
+      if (color_count == 1)
+        cdplusg_tile_plan_add (plan, 0, base, base, target, 0x0F, 0xFF);
+      else
+        cdplusg_tile_plan_add (plan, 0, base, colors[1], target, 0x0F, colors[1]);
+
+      for (int i = 2; i < color_count; i++)
+        cdplusg_tile_plan_add (plan, 1, 0, base ^ colors[i], target, 0x0F, colors[i]);
+      break;
+    case CDPLUSG_TILE_BY_BIT:
+      for (unsigned int bit = 1; bit < CDPLUSG_COLOR_TABLE_SIZE; bit <<= 1)
+      {
+        if (!(base_bits & bit))
+          continue;
+
+        if (plan->packet_count == 0)
+          cdplusg_tile_plan_add (plan, 0, base, base ^ bit, base_difference, bit, bit);
+        else
+          cdplusg_tile_plan_add (plan, 1, 0, bit, base_difference, bit, bit);
+      }
+      break;
+    case CDPLUSG_TILE_XOR_BY_VALUE:
+      for (int i = 0; i < difference_count; i++)
+      {
+        if (difference_values[i] != 0)
+          cdplusg_tile_plan_add (plan, 1, 0, difference_values[i], difference, 0x0F, difference_values[i]);
+      }
+      break;
+    case CDPLUSG_TILE_XOR_BY_BIT:
+      for (unsigned int bit = 1; bit < CDPLUSG_COLOR_TABLE_SIZE; bit <<= 1)
+      {
+        if (difference_bits & bit)
+          cdplusg_tile_plan_add (plan, 1, 0, bit, difference, bit, bit);
+      }
+      break;
+  }
+}
+
+static void
+cdplusg_encoder_emit (struct cdplusg_encoder *encoder, struct cdplusg_instruction *instructions, size_t *count,
+    const struct cdplusg_instruction *instruction)
+{
+  instructions[*count] = *instruction;
+  cdplusg_graphics_state_apply_instruction (encoder->gpx_state, &instructions[*count]);
+  (*count)++;
+}
+
+static int
+cdplusg_encoder_tile_differs (const struct cdplusg_encoder *encoder, int row, int column)
+{
+  for (int i = 0; i < CDPLUSG_FONT_HEIGHT; i++)
+  {
+    int offset = (row + i) * CDPLUSG_SCREEN_WIDTH + column;
+
+    if (memcmp (&encoder->gpx_state->pixels[offset], &encoder->target[offset], CDPLUSG_FONT_WIDTH) != 0)
+      return 1;
+  }
+
+  return 0;
+}
+
+// A MEMORY_PRESET with the dominant color of the target is worth a packet when drawing the
+// remaining tiles on top of it takes fewer packets than fixing up the current screen.
+static int
+cdplusg_encoder_should_preset (struct cdplusg_encoder *encoder, unsigned char *preset_color)
+{
+  int counts [CDPLUSG_COLOR_TABLE_SIZE] = { 0 };
+  unsigned char color = 0;
+
+  for (int i = 0; i < CDPLUSG_SCREEN_WIDTH * CDPLUSG_SCREEN_HEIGHT; i++)
+    counts[encoder->target[i]]++;
+
+  for (int i = 1; i < CDPLUSG_COLOR_TABLE_SIZE; i++)
+  {
+    if (counts[i] > counts[color])
+      color = i;
+  }
+
+  unsigned char current [CDPLUSG_TILE_PIXELS];
+  unsigned char target [CDPLUSG_TILE_PIXELS];
+  unsigned char solid [CDPLUSG_TILE_PIXELS];
+  struct cdplusg_tile_plan plan;
+
+  memset (solid, color, sizeof (solid));
+
+  // every differing tile costs at most four packets to fix and every tile that is not the
+  // preset color at least one to draw, which mostly settles it without planning any tile
+  unsigned long differing_count = 0;
+  unsigned long non_solid_count = 0;
+
+  for (int row = 0; row < CDPLUSG_SCREEN_HEIGHT; row += CDPLUSG_FONT_HEIGHT)
+  {
+    for (int column = 0; column < CDPLUSG_SCREEN_WIDTH; column += CDPLUSG_FONT_WIDTH)
+    {
+      cdplusg_get_tile (encoder->target, row, column, target);
+
+      differing_count += cdplusg_encoder_tile_differs (encoder, row, column);
+      non_solid_count += memcmp (target, solid, sizeof (solid)) != 0;
+    }
+  }
+
+  if (CDPLUSG_MAX_TILE_PACKETS * differing_count <= 1 + non_solid_count)
+    return 0;
+
+  unsigned long keep_cost = 0;
+  unsigned long preset_cost = 1;
+
+  for (int row = 0; row < CDPLUSG_SCREEN_HEIGHT; row += CDPLUSG_FONT_HEIGHT)
+  {
+    for (int column = 0; column < CDPLUSG_SCREEN_WIDTH; column += CDPLUSG_FONT_WIDTH)
+    {
+      cdplusg_get_tile (encoder->target, row, column, target);
+
+      if (cdplusg_encoder_tile_differs (encoder, row, column))
+      {
+        cdplusg_get_tile (encoder->gpx_state->pixels, row, column, current);
+        cdplusg_plan_tile (current, target, &plan);
+        keep_cost += plan.packet_count;
+      }
+
+      cdplusg_plan_tile (solid, target, &plan);
+      preset_cost += plan.packet_count;
+    }
+  }
+
+  *preset_color = color;
+
+  return preset_cost < keep_cost;
+}
+
+static int
+cdplusg_encoder_tile_compare (const void *a, const void *b)
+{
+  const struct cdplusg_encoder_tile *tile_a = (const struct cdplusg_encoder_tile *) a;
+  const struct cdplusg_encoder_tile *tile_b = (const struct cdplusg_encoder_tile *) b;
+
+  if (tile_a->priority != tile_b->priority)
+    return tile_a->priority < tile_b->priority ? 1 : -1;
+
+  // keep the order stable, top to bottom, so that equal changes are drawn like text
+  if (tile_a->row != tile_b->row)
+    return tile_a->row - tile_b->row;
+
+  return tile_a->column - tile_b->column;
+}
+
+// Collects the tiles that differ from the target, most visible change first.
+static int
+cdplusg_encoder_collect_tiles (struct cdplusg_encoder *encoder)
+{
+  int luma [CDPLUSG_COLOR_TABLE_SIZE];
+  int tile_count = 0;
+
+  for (int i = 0; i < CDPLUSG_COLOR_TABLE_SIZE; i++)
+    luma[i] = cdplusg_color_luma (encoder->target_palette[i]);
+
+  for (int row = 0; row < CDPLUSG_TILE_ROWS; row++)
+  {
+    for (int column = 0; column < CDPLUSG_TILE_COLUMNS; column++)
+    {
+      int tile_index = row * CDPLUSG_TILE_COLUMNS + column;
+      unsigned long weight = 0;
+
+      for (int i = 0; i < CDPLUSG_FONT_HEIGHT; i++)
+      {
+        int offset = (row * CDPLUSG_FONT_HEIGHT + i) * CDPLUSG_SCREEN_WIDTH + column * CDPLUSG_FONT_WIDTH;
+
+        for (int j = 0; j < CDPLUSG_FONT_WIDTH; j++)
+        {
+          unsigned char current = encoder->gpx_state->pixels[offset + j];
+          unsigned char target = encoder->target[offset + j];
+
+          if (current != target)
+            weight += 1 + abs (luma[current] - luma[target]);
+        }
+      }
+
+      if (weight == 0)
+      {
+        encoder->tile_age[tile_index] = 0;
+        continue;
+      }
+
+      struct cdplusg_encoder_tile *tile = &encoder->tiles[tile_count++];
+
+      tile->row = row * CDPLUSG_FONT_HEIGHT;
+      tile->column = column * CDPLUSG_FONT_WIDTH;
+      tile->priority = weight * (1 + encoder->tile_age[tile_index]);
+    }
+  }
+
+  qsort (encoder->tiles, tile_count, sizeof (struct cdplusg_encoder_tile), cdplusg_encoder_tile_compare);
+
+  return tile_count;
+}
+
+size_t
+cdplusg_encoder_encode (struct cdplusg_encoder *encoder, struct cdplusg_instruction *instructions, size_t max_count)
+{
+  struct cdplusg_instruction instruction;
+  size_t count = 0;
+
+  // the color table comes first, every visible pixel depends on it
+  for (int half = 0; half < 2 && count < max_count; half++)
+  {
+    const struct cdplusg_color_table_entry *target_colors = &encoder->target_palette[half * CDPLUSG_LOAD_COLOR_TABLE_SIZE];
+    const struct cdplusg_color_table_entry *colors = &encoder->gpx_state->color_table[half * CDPLUSG_LOAD_COLOR_TABLE_SIZE];
+
+    if (memcmp (colors, target_colors, CDPLUSG_LOAD_COLOR_TABLE_SIZE * sizeof (struct cdplusg_color_table_entry)) == 0)
+      continue;
+
+    if (half == 0)
+      cdplusg_instruction_initialize_load_color_table_low (&instruction, target_colors);
+    else
+      cdplusg_instruction_initialize_load_color_table_high (&instruction, target_colors);
+
+    cdplusg_encoder_emit (encoder, instructions, &count, &instruction);
+  }
+
+  unsigned char preset_color;
+
+  if (count < max_count && cdplusg_encoder_should_preset (encoder, &preset_color))
+  {
+    cdplusg_instruction_initialize_memory_preset (&instruction, preset_color, 0);
+    cdplusg_encoder_emit (encoder, instructions, &count, &instruction);
+  }
+
+  int tile_count = cdplusg_encoder_collect_tiles (encoder);
+
+  for (int i = 0; i < tile_count; i++)
+  {
+    struct cdplusg_encoder_tile *tile = &encoder->tiles[i];
+    int tile_index = (tile->row / CDPLUSG_FONT_HEIGHT) * CDPLUSG_TILE_COLUMNS + tile->column / CDPLUSG_FONT_WIDTH;
+
+    unsigned char current [CDPLUSG_TILE_PIXELS];
+    unsigned char target [CDPLUSG_TILE_PIXELS];
+    struct cdplusg_tile_plan plan;
+
+    cdplusg_get_tile (encoder->gpx_state->pixels, tile->row, tile->column, current);
+    cdplusg_get_tile (encoder->target, tile->row, tile->column, target);
+    cdplusg_plan_tile (current, target, &plan);
+
+    // a tile that does not fit is left for the next call, where its age moves it up
+    if (count + plan.packet_count > max_count)
+    {
+      encoder->tile_age[tile_index]++;
+      continue;
+    }
+
+    for (int j = 0; j < plan.packet_count; j++)
+    {
+      const struct cdplusg_tile_packet *packet = &plan.packets[j];
+
+      if (packet->is_xor)
+        cdplusg_instruction_initialize_tile_block_xor (&instruction, packet->color0, packet->color1,
+            tile->row, tile->column, packet->tile);
+      else
+        cdplusg_instruction_initialize_tile_block (&instruction, packet->color0, packet->color1,
+            tile->row, tile->column, packet->tile);
+
+      cdplusg_encoder_emit (encoder, instructions, &count, &instruction);
+    }
+
+    encoder->tile_age[tile_index] = 0;
+  }
+
+  return count;
+}
+
+size_t
+cdplusg_graphics_state_synthesize (const struct cdplusg_graphics_state *gpx_state, struct cdplusg_instruction *instructions)
+{
+  size_t count = 0;
+
+  // both halves of the color table are always loaded, whatever the player had before
+  cdplusg_instruction_initialize_load_color_table_low (&instructions[count++], &gpx_state->color_table[0]);
+  cdplusg_instruction_initialize_load_color_table_high (&instructions[count++],
+      &gpx_state->color_table[CDPLUSG_LOAD_COLOR_TABLE_SIZE]);
+
+  int counts [CDPLUSG_COLOR_TABLE_SIZE] = { 0 };
+  unsigned char color = 0;
+
+  for (int i = 0; i < CDPLUSG_SCREEN_WIDTH * CDPLUSG_SCREEN_HEIGHT; i++)
+    counts[gpx_state->pixels[i] & 0x0F]++;
+
+  for (int i = 1; i < CDPLUSG_COLOR_TABLE_SIZE; i++)
+  {
+    if (counts[i] > counts[color])
+      color = i;
+  }
+
+  // the dominant color covers the most tiles for free, everything else is drawn on top
+  cdplusg_instruction_initialize_memory_preset (&instructions[count++], color, 0);
+
+  unsigned char solid [CDPLUSG_TILE_PIXELS];
+  unsigned char target [CDPLUSG_TILE_PIXELS];
+  struct cdplusg_tile_plan plan;
+
+  memset (solid, color, sizeof (solid));
+
+  for (int row = 0; row < CDPLUSG_SCREEN_HEIGHT; row += CDPLUSG_FONT_HEIGHT)
+  {
+    for (int column = 0; column < CDPLUSG_SCREEN_WIDTH; column += CDPLUSG_FONT_WIDTH)
+    {
+      cdplusg_get_tile (gpx_state->pixels, row, column, target);
+
+      for (int i = 0; i < CDPLUSG_TILE_PIXELS; i++)
+        target[i] &= 0x0F;
+
+      cdplusg_plan_tile (solid, target, &plan);
+
+      for (int i = 0; i < plan.packet_count; i++)
+      {
+        const struct cdplusg_tile_packet *packet = &plan.packets[i];
+
+        if (packet->is_xor)
+          cdplusg_instruction_initialize_tile_block_xor (&instructions[count++], packet->color0, packet->color1,
+              row, column, packet->tile);
+        else
+          cdplusg_instruction_initialize_tile_block (&instructions[count++], packet->color0, packet->color1,
+              row, column, packet->tile);
+      }
+    }
+  }
+
+  return count;
+}
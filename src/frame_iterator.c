@@ -0,0 +1,101 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "cdplusg.h"
+
+int
+cdplusg_frame_iterator_initialize (struct cdplusg_frame_iterator *iterator, unsigned int numerator,
+    unsigned int denominator)
+{
+  if (numerator == 0 || denominator == 0)
+    return 0;
+
+  uint64_t step = (uint64_t) CDPLUSG_PACKETS_PER_SECOND * denominator;
+
+  iterator->numerator = numerator;
+  iterator->denominator = denominator;
+  iterator->frame = 0;
+  iterator->packet = 0;
+  iterator->step_quotient = step / numerator;
+  iterator->step_remainder = step % numerator;
+  iterator->remainder = 0;
+
+  return 1;
+}
+
+uint64_t
+cdplusg_frame_iterator_next (struct cdplusg_frame_iterator *iterator)
+{
+  // packet stays floor (300 * frame * denominator / numerator) with remainder what floor
+  // dropped, all in integers
+  iterator->frame++;
+  iterator->packet += iterator->step_quotient;
+  iterator->remainder += iterator->step_remainder;
+
+  if (iterator->remainder >= iterator->numerator)
+  {
+    iterator->packet++;
+    iterator->remainder -= iterator->numerator;
+  }
+
+  return iterator->packet;
+}
+
+uint64_t
+cdplusg_frame_iterator_get_next_time_us (const struct cdplusg_frame_iterator *iterator)
+{
+  // whole seconds and the rest apart, like the packets above: a denominator near UINT_MAX
+  // would otherwise overflow the microseconds after a few thousand frames
+  uint64_t frames = (iterator->frame + 1) * iterator->denominator;
+  uint64_t seconds = frames / iterator->numerator;
+  uint64_t remainder = frames % iterator->numerator;
+
+  return seconds * UINT64_C (1000000) + remainder * UINT64_C (1000000) / iterator->numerator;
+}
+
+int
+cdplusg_frame_iterator_parse_frame_rate (const char *string, unsigned int *numerator, unsigned int *denominator)
+{
+  char *end;
+  unsigned long long parsed_numerator = strtoull (string, &end, 10);
+  unsigned long long parsed_denominator = 1;
+
+  if (end == string)
+    return 0;
+
+  if (*end == '/')
+  {
+    const char *denominator_string = end + 1;
+    parsed_denominator = strtoull (denominator_string, &end, 10);
+
+    if (end == denominator_string)
+      return 0;
+  }
+  else if (*end == '.')
+  {
+    for (end++; *end >= '0' && *end <= '9' && parsed_denominator < 1000000; end++)
+    {
+      parsed_numerator = 10 * parsed_numerator + (*end - '0');
+      parsed_denominator *= 10;
+    }
+  }
+
+  if (*end != '\0' || parsed_numerator == 0 || parsed_denominator == 0
+        || parsed_numerator > 1000000000 || parsed_denominator > 1000000000)
+    return 0;
+
+  // reduced, so that the frame iterator steps in the smallest integers
+  unsigned long long a = parsed_numerator;
+  unsigned long long b = parsed_denominator;
+
+  while (b != 0)
+  {
+    unsigned long long remainder = a % b;
+    a = b;
+    b = remainder;
+  }
+
+  *numerator = parsed_numerator / a;
+  *denominator = parsed_denominator / a;
+  return 1;
+}
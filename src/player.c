@@ -0,0 +1,161 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "cdplusg.h"
+
+// backward steps of the clock up to this many packets are jitter in the audio position and
+// are waited out rather than rewinding the screen
+#define CDPLUSG_PLAYER_JITTER_PACKETS 15
+
+// forward jumps beyond this many packets are cheaper to seek than to replay
+#define CDPLUSG_PLAYER_MAX_REPLAY_PACKETS (10 * CDPLUSG_PACKETS_PER_SECOND)
+
+struct cdplusg_player
+{
+  struct cdplusg_stream *stream;
+  struct cdplusg_graphics_state *gpx_state;
+
+  cdplusg_player_clock clock;
+  void *user_data;
+
+  size_t packet;
+
+  struct cdplusg_player_statistics statistics;
+  double total_drift_ms;
+};
+
+struct cdplusg_player *
+cdplusg_player_new (struct cdplusg_stream *stream, cdplusg_player_clock clock, void *user_data)
+{
+  struct cdplusg_player *player = (struct cdplusg_player *) calloc (1, sizeof (struct cdplusg_player));
+
+  if (player == NULL)
+    return NULL;
+
+  player->gpx_state = cdplusg_graphics_state_new ();
+
+  if (player->gpx_state == NULL)
+  {
+    free (player);
+    return NULL;
+  }
+
+  player->stream = stream;
+  player->clock = clock;
+  player->user_data = user_data;
+
+  return player;
+}
+
+void
+cdplusg_player_free (struct cdplusg_player *player)
+{
+  if (player)
+    cdplusg_graphics_state_free (player->gpx_state);
+
+  free (player);
+}
+
+struct cdplusg_graphics_state *
+cdplusg_player_get_graphics_state (struct cdplusg_player *player)
+{
+  return player->gpx_state;
+}
+
+// Packets complete by the given time, packet k being complete at (k + 1) / 300 seconds.
+static size_t
+cdplusg_player_packets_due (double seconds, size_t packet_count)
+{
+  if (!(seconds > 0))
+    return 0;
+
+  double packets = seconds * CDPLUSG_PACKETS_PER_SECOND;
+
+  // truncation is the floor for positive values
+  return packets >= (double) packet_count ? packet_count : (size_t) packets;
+}
+
+size_t
+cdplusg_player_update (struct cdplusg_player *player)
+{
+  size_t packet_count = cdplusg_stream_get_packet_count (player->stream);
+
+  double seconds = player->clock (player->user_data);
+  size_t target = cdplusg_player_packets_due (seconds, packet_count);
+  size_t applied = 0;
+
+  if (target < player->packet && player->packet - target <= CDPLUSG_PLAYER_JITTER_PACKETS)
+  {
+    // hold the current screen until the clock catches up again
+  }
+  else if (target < player->packet || target - player->packet > CDPLUSG_PLAYER_MAX_REPLAY_PACKETS)
+  {
+    cdplusg_stream_seek (player->stream, player->gpx_state, target);
+    player->packet = target;
+    player->statistics.resync_count++;
+  }
+  else
+  {
+    for (; player->packet < target; player->packet++, applied++)
+    {
+      struct cdplusg_instruction instruction = *cdplusg_stream_get_instruction (player->stream, player->packet);
+      cdplusg_graphics_state_apply_instruction (player->gpx_state, &instruction);
+    }
+  }
+
+  double drift_ms = 1000.0 * (seconds - (double) player->packet / CDPLUSG_PACKETS_PER_SECOND);
+
+  // past the end there is nothing left to fall behind on
+  if (player->packet == packet_count && drift_ms > 0)
+    drift_ms = 0;
+
+  struct cdplusg_player_statistics *statistics = &player->statistics;
+
+  statistics->update_count++;
+  statistics->packet_count += applied;
+
+  if (applied > statistics->max_batch_size)
+    statistics->max_batch_size = applied;
+
+  statistics->last_drift_ms = drift_ms;
+
+  double absolute_drift_ms = drift_ms < 0 ? -drift_ms : drift_ms;
+
+  if (absolute_drift_ms > statistics->max_drift_ms)
+    statistics->max_drift_ms = absolute_drift_ms;
+
+  player->total_drift_ms += absolute_drift_ms;
+  statistics->mean_drift_ms = player->total_drift_ms / statistics->update_count;
+
+  return applied;
+}
+
+void
+cdplusg_player_seek (struct cdplusg_player *player, unsigned int ms)
+{
+  size_t packet_count = cdplusg_stream_get_packet_count (player->stream);
+
+  // the same floor as for the clock, in integers so that a seek lands on the same packet
+  uint64_t packet = (uint64_t) ms * CDPLUSG_PACKETS_PER_SECOND / 1000;
+
+  player->packet = packet < packet_count ? (size_t) packet : packet_count;
+  cdplusg_stream_seek (player->stream, player->gpx_state, player->packet);
+}
+
+size_t
+cdplusg_player_get_packet (const struct cdplusg_player *player)
+{
+  return player->packet;
+}
+
+int
+cdplusg_player_is_finished (const struct cdplusg_player *player)
+{
+  return player->packet == cdplusg_stream_get_packet_count (player->stream);
+}
+
+void
+cdplusg_player_get_statistics (const struct cdplusg_player *player, struct cdplusg_player_statistics *statistics)
+{
+  *statistics = player->statistics;
+}
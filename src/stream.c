@@ -0,0 +1,280 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cdplusg.h"
+
+struct cdplusg_stream
+{
+  struct cdplusg_instruction *instructions;
+  size_t packet_count;
+
+  // packets after which the screen does not depend on anything earlier: the ones that
+  // clear the whole screen
+  size_t *keyframes;
+  size_t keyframe_count;
+
+  // packets loading each half of the color table
+  size_t *palette_loads [2];
+  size_t palette_load_count [2];
+
+  // instructions kept by the last seek, in reverse order
+  size_t *replay;
+};
+
+static int
+cdplusg_stream_is_keyframe (const struct cdplusg_instruction *instruction)
+{
+  return instruction->type == MEMORY_PRESET && instruction->repeat == 0;
+}
+
+static int
+cdplusg_stream_build_index (struct cdplusg_stream *stream)
+{
+  size_t count = stream->packet_count;
+
+  // sized for the worst case so that indexing never reallocates
+  stream->keyframes = (size_t *) malloc ((count + 1) * sizeof (size_t));
+  stream->palette_loads[0] = (size_t *) malloc ((count + 1) * sizeof (size_t));
+  stream->palette_loads[1] = (size_t *) malloc ((count + 1) * sizeof (size_t));
+  stream->replay = (size_t *) malloc ((count + 1) * sizeof (size_t));
+
+  if (!stream->keyframes || !stream->palette_loads[0] || !stream->palette_loads[1] || !stream->replay)
+    return 0;
+
+  for (size_t i = 0; i < count; i++)
+  {
+    const struct cdplusg_instruction *instruction = &stream->instructions[i];
+
+    if (cdplusg_stream_is_keyframe (instruction))
+      stream->keyframes[stream->keyframe_count++] = i;
+    else if (instruction->type == LOAD_COLOR_TABLE_LOW)
+      stream->palette_loads[0][stream->palette_load_count[0]++] = i;
+    else if (instruction->type == LOAD_COLOR_TABLE_HIGH)
+      stream->palette_loads[1][stream->palette_load_count[1]++] = i;
+  }
+
+  return 1;
+}
+
+struct cdplusg_stream *
+cdplusg_stream_new_from_memory (const void *data, size_t size)
+{
+  struct cdplusg_stream *stream = (struct cdplusg_stream *) calloc (1, sizeof (struct cdplusg_stream));
+
+  if (stream == NULL)
+    return NULL;
+
+  const char *subchannel = (const char *) data;
+
+  stream->packet_count = size / CDPLUSG_SUBCHANNEL_WIDTH;
+  stream->instructions = (struct cdplusg_instruction *)
+    malloc ((stream->packet_count + 1) * sizeof (struct cdplusg_instruction));
+
+  if (stream->instructions == NULL)
+  {
+    cdplusg_stream_free (stream);
+    return NULL;
+  }
+
+  for (size_t i = 0; i < stream->packet_count; i++)
+  {
+    cdplusg_instruction_initialize_from_subchannel (&stream->instructions[i],
+        &subchannel[i * CDPLUSG_SUBCHANNEL_WIDTH]);
+  }
+
+  if (!cdplusg_stream_build_index (stream))
+  {
+    cdplusg_stream_free (stream);
+    return NULL;
+  }
+
+  return stream;
+}
+
+struct cdplusg_stream *
+cdplusg_stream_new_from_file (FILE *file)
+{
+  size_t size = 0;
+  size_t capacity = 1 << 20;
+  char *data = (char *) malloc (capacity);
+
+  if (data == NULL)
+    return NULL;
+
+  for (;;)
+  {
+    if (size == capacity)
+    {
+      char *larger_data = (char *) realloc (data, 2 * capacity);
+
+      if (larger_data == NULL)
+      {
+        free (data);
+        return NULL;
+      }
+
+      data = larger_data;
+      capacity *= 2;
+    }
+
+    size_t read_size = fread (&data[size], 1, capacity - size, file);
+
+    if (read_size == 0)
+      break;
+
+    size += read_size;
+  }
+
+  struct cdplusg_stream *stream = NULL;
+
+  if (!ferror (file))
+    stream = cdplusg_stream_new_from_memory (data, size);
+
+  free (data);
+
+  return stream;
+}
+
+void
+cdplusg_stream_free (struct cdplusg_stream *stream)
+{
+  if (stream)
+  {
+    free (stream->instructions);
+    free (stream->keyframes);
+    free (stream->palette_loads[0]);
+    free (stream->palette_loads[1]);
+    free (stream->replay);
+  }
+
+  free (stream);
+}
+
+size_t
+cdplusg_stream_get_packet_count (const struct cdplusg_stream *stream)
+{
+  return stream->packet_count;
+}
+
+const struct cdplusg_instruction *
+cdplusg_stream_get_instruction (const struct cdplusg_stream *stream, size_t packet)
+{
+  return packet < stream->packet_count ? &stream->instructions[packet] : NULL;
+}
+
+// Returns how many of the sorted positions are before packet.
+static size_t
+cdplusg_stream_count_before (const size_t *positions, size_t count, size_t packet)
+{
+  size_t low = 0;
+  size_t high = count;
+
+  while (low < high)
+  {
+    size_t middle = low + (high - low) / 2;
+
+    if (positions[middle] < packet)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+
+  return low;
+}
+
+static void
+cdplusg_stream_restore_palette (const struct cdplusg_stream *stream, struct cdplusg_graphics_state *gpx_state,
+    size_t packet)
+{
+  for (int half = 0; half < 2; half++)
+  {
+    size_t load_count = cdplusg_stream_count_before (stream->palette_loads[half],
+        stream->palette_load_count[half], packet);
+
+    struct cdplusg_instruction instruction;
+
+    if (load_count > 0)
+    {
+      instruction = stream->instructions[stream->palette_loads[half][load_count - 1]];
+    }
+    else
+    {
+      // nothing loaded yet, so this half is still the zeroed table of a new state
+      struct cdplusg_color_table_entry colors [CDPLUSG_LOAD_COLOR_TABLE_SIZE] = { { 0 } };
+
+      if (half == 0)
+        cdplusg_instruction_initialize_load_color_table_low (&instruction, colors);
+      else
+        cdplusg_instruction_initialize_load_color_table_high (&instruction, colors);
+    }
+
+    // applied like any other load, so the palette version only moves if the table changes
+    cdplusg_graphics_state_apply_instruction (gpx_state, &instruction);
+  }
+}
+
+void
+cdplusg_stream_seek (struct cdplusg_stream *stream, struct cdplusg_graphics_state *gpx_state, size_t packet)
+{
+  if (packet > stream->packet_count)
+    packet = stream->packet_count;
+
+  size_t keyframe_count = cdplusg_stream_count_before (stream->keyframes, stream->keyframe_count, packet);
+  size_t first = 0;
+
+  if (keyframe_count > 0)
+  {
+    size_t keyframe = stream->keyframes[keyframe_count - 1];
+
+    cdplusg_graphics_state_apply_instruction (gpx_state, &stream->instructions[keyframe]);
+    first = keyframe + 1;
+  }
+  else
+  {
+    memset (gpx_state->pixels, 0, CDPLUSG_SCREEN_WIDTH * CDPLUSG_SCREEN_HEIGHT);
+  }
+
+  // walk back from the target: once a tile is overwritten by a TILE_BLOCK, nothing drawn
+  // into it earlier can be seen, so only the instructions that are still visible are kept
+  uint64_t covered [CDPLUSG_TILE_ROWS] = { 0 };
+  size_t replay_count = 0;
+
+  for (size_t i = packet; i > first; i--)
+  {
+    const struct cdplusg_instruction *instruction = &stream->instructions[i - 1];
+
+    switch (instruction->type)
+    {
+      case TILE_BLOCK:
+      case TILE_BLOCK_XOR:
+      {
+        int row = instruction->row / CDPLUSG_FONT_HEIGHT;
+        uint64_t column_bit = UINT64_C (1) << (instruction->column / CDPLUSG_FONT_WIDTH);
+
+        if (covered[row] & column_bit)
+          break;
+
+        if (instruction->type == TILE_BLOCK)
+          covered[row] |= column_bit;
+
+        stream->replay[replay_count++] = i - 1;
+        break;
+      }
+      case BORDER_PRESET:
+        stream->replay[replay_count++] = i - 1;
+        break;
+      default:
+        break;
+    }
+  }
+
+  while (replay_count > 0)
+    cdplusg_graphics_state_apply_instruction (gpx_state, &stream->instructions[stream->replay[--replay_count]]);
+
+  cdplusg_stream_restore_palette (stream, gpx_state, packet);
+
+  for (int i = 0; i < CDPLUSG_TILE_ROWS; i++)
+    gpx_state->dirty_tiles[i] = (UINT64_C (1) << CDPLUSG_TILE_COLUMNS) - 1;
+}
@@ -0,0 +1,167 @@
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "thread_pool.h"
+
+struct cdplusg_thread_pool
+{
+  pthread_t *threads;
+  unsigned int thread_count;
+  unsigned int worker_count;
+
+  pthread_mutex_t mutex;
+  pthread_cond_t work_ready;
+  pthread_cond_t work_done;
+
+  unsigned long generation;
+  unsigned int pending;
+  int is_shutting_down;
+
+  cdplusg_thread_pool_work work;
+  void *data;
+};
+
+struct cdplusg_thread_pool_worker
+{
+  struct cdplusg_thread_pool *pool;
+  unsigned int band;
+};
+
+static void *
+cdplusg_thread_pool_worker_main (void *user_data)
+{
+  struct cdplusg_thread_pool_worker *worker = (struct cdplusg_thread_pool_worker *) user_data;
+  struct cdplusg_thread_pool *pool = worker->pool;
+  unsigned int band = worker->band;
+  unsigned long generation = 0;
+
+  free (worker);
+
+  pthread_mutex_lock (&pool->mutex);
+
+  for (;;)
+  {
+    while (pool->generation == generation && !pool->is_shutting_down)
+      pthread_cond_wait (&pool->work_ready, &pool->mutex);
+
+    if (pool->is_shutting_down)
+      break;
+
+    generation = pool->generation;
+    pthread_mutex_unlock (&pool->mutex);
+
+    pool->work (pool->data, band, pool->thread_count);
+
+    pthread_mutex_lock (&pool->mutex);
+
+    if (--pool->pending == 0)
+      pthread_cond_signal (&pool->work_done);
+  }
+
+  pthread_mutex_unlock (&pool->mutex);
+  return NULL;
+}
+
+struct cdplusg_thread_pool *
+cdplusg_thread_pool_new (unsigned int thread_count)
+{
+  if (thread_count == 0)
+    return NULL;
+
+  struct cdplusg_thread_pool *pool =
+    (struct cdplusg_thread_pool *) calloc (1, sizeof (struct cdplusg_thread_pool));
+
+  if (pool == NULL)
+    return NULL;
+
+  pool->thread_count = thread_count;
+  pool->threads = (pthread_t *) calloc (thread_count, sizeof (pthread_t));
+
+  pthread_mutex_init (&pool->mutex, NULL);
+  pthread_cond_init (&pool->work_ready, NULL);
+  pthread_cond_init (&pool->work_done, NULL);
+
+  if (pool->threads == NULL)
+  {
+    cdplusg_thread_pool_free (pool);
+    return NULL;
+  }
+
+  // band 0 always runs on the calling thread
+  for (unsigned int i = 1; i < thread_count; i++)
+  {
+    struct cdplusg_thread_pool_worker *worker =
+      (struct cdplusg_thread_pool_worker *) malloc (sizeof (struct cdplusg_thread_pool_worker));
+
+    if (worker == NULL)
+    {
+      cdplusg_thread_pool_free (pool);
+      return NULL;
+    }
+
+    worker->pool = pool;
+    worker->band = i;
+
+    if (pthread_create (&pool->threads[pool->worker_count], NULL, cdplusg_thread_pool_worker_main, worker) != 0)
+    {
+      free (worker);
+      cdplusg_thread_pool_free (pool);
+      return NULL;
+    }
+
+    pool->worker_count++;
+  }
+
+  return pool;
+}
+
+void
+cdplusg_thread_pool_free (struct cdplusg_thread_pool *pool)
+{
+  if (pool == NULL)
+    return;
+
+  pthread_mutex_lock (&pool->mutex);
+  pool->is_shutting_down = 1;
+  pthread_cond_broadcast (&pool->work_ready);
+  pthread_mutex_unlock (&pool->mutex);
+
+  for (unsigned int i = 0; i < pool->worker_count; i++)
+    pthread_join (pool->threads[i], NULL);
+
+  pthread_cond_destroy (&pool->work_done);
+  pthread_cond_destroy (&pool->work_ready);
+  pthread_mutex_destroy (&pool->mutex);
+
+  free (pool->threads);
+  free (pool);
+}
+
+unsigned int
+cdplusg_thread_pool_get_thread_count (const struct cdplusg_thread_pool *pool)
+{
+  return pool->thread_count;
+}
+
+void
+cdplusg_thread_pool_run (struct cdplusg_thread_pool *pool, cdplusg_thread_pool_work work, void *data)
+{
+  pthread_mutex_lock (&pool->mutex);
+
+  pool->work = work;
+  pool->data = data;
+  pool->pending = pool->worker_count;
+  pool->generation++;
+
+  pthread_cond_broadcast (&pool->work_ready);
+  pthread_mutex_unlock (&pool->mutex);
+
+  work (data, 0, pool->thread_count);
+
+  pthread_mutex_lock (&pool->mutex);
+
+  while (pool->pending != 0)
+    pthread_cond_wait (&pool->work_done, &pool->mutex);
+
+  pthread_mutex_unlock (&pool->mutex);
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+/** A small pool of persistent worker threads. Each run splits the work into one band
+ * per thread, including the calling thread, and returns once every band is done.
+ **/
+struct cdplusg_thread_pool;
+
+typedef void (*cdplusg_thread_pool_work) (void *data, unsigned int band, unsigned int band_count);
+
+struct cdplusg_thread_pool *cdplusg_thread_pool_new (unsigned int thread_count);
+void cdplusg_thread_pool_free (struct cdplusg_thread_pool *pool);
+unsigned int cdplusg_thread_pool_get_thread_count (const struct cdplusg_thread_pool *pool);
+void cdplusg_thread_pool_run (struct cdplusg_thread_pool *pool, cdplusg_thread_pool_work work, void *data);